@@ -0,0 +1,235 @@
+/**
+ * Benchmark firmware
+ *
+ * Built instead of transmitter by `make bench` (same flags) or `make bench-o2`
+ * (-O2 instead of -Os), from the same main.cpp, so that carrier loop and
+ * kernels are exactly what transmitter runs. After reset every benchmark runs
+ * once and prints one record per line over serial port:
+ *   Bench: test=<name>, <parameter>=<value>, ..., <result>=<value>
+ * Last field is always the result. Tests:
+ *   build          build name, compiler, core clock and board unique ID
+ *   period         cycles per carrier period of each waveform and engine at
+ *                  several BR LX locations, interrupts masked
+ *   reach          highest carrier of each waveform (BR LX at 0)
+ *   stage          cycles of one call of each kernel main loop and control
+ *                  tasks run per sample or slice, best of BENCH_REPEATS
+ *   kernel         whether each kernel of harness.h gives golden output and
+ *                  its cycles per input sample
+ *   irq            cycles from pending software interrupt to its handler
+ *   calibration    time MEASURING sweep takes for each waveform
+ * Blue LED is on while running, green once done. Records of several runs
+ * (builds, boards, host simulation in tools/bench_sim.cpp) are put side by
+ * side by tools/bench_table.cpp.
+ */
+#ifndef BENCH_BUILD
+#define BENCH_BUILD Os
+#endif
+#define main transmitter_main
+#include "main.cpp"
+#undef main
+#define HARNESS_NOW() DWT->CYCCNT
+#include "harness.h"
+
+#define BENCH_PERIODS 10000     /* Periods per period measurement */
+#define BENCH_REPEATS 16        /* Calls per kernel, best one counts */
+#define BENCH_STRING(x) BENCH_QUOTE(x)
+#define BENCH_QUOTE(x) #x
+
+static const unsigned int bench_indices[] = {0, 16, 32, 48, 64, MAX_OPCODES - 2};
+static const char *bench_waveforms[] = {"sine", "square"};     /* Indexed by SINE, SQUARE */
+static const char *bench_engines[] = {"sled"};
+static volatile uint32_t bench_entered;     /* Cycle software interrupt handler started at */
+
+/**
+ * Print record, waiting for serial port as long as it takes
+ */
+void bench_say(const char *format, ...){
+    char buffer[192];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if(length >= (int)sizeof(buffer)) length = sizeof(buffer) - 1;
+    const char *p = buffer;
+    while(length > 0){
+        ssize_t written = PC.write(p, length);
+        if(written > 0){
+            p += written;
+            length -= written;
+        } else __WFI();
+    }
+}
+
+void bench_swi(){
+    bench_entered = DWT->CYCCNT;
+}
+
+/**
+ * Cycles per carrier period (x100) with given tuning, interrupts masked
+ */
+inline uint32_t bench_period(unsigned int index){
+    sled_init(&sled, index, BENCH_PERIODS);
+    __disable_irq();
+    uint32_t begin = DWT->CYCCNT;
+    transmit(&sled, 32768);
+    uint32_t cycles = DWT->CYCCNT - begin;
+    __enable_irq();
+    return (uint32_t)(((uint64_t)cycles * 100 + BENCH_PERIODS / 2) / BENCH_PERIODS);
+}
+
+/**
+ * Time given statement, best of BENCH_REPEATS without cost of probe itself
+ */
+#define BENCH_STAGE(name, statement) do { \
+        uint32_t best = 0xFFFFFFFF; \
+        __disable_irq(); \
+        for(unsigned int r=0; r<BENCH_REPEATS; r++){ \
+            uint32_t begin = DWT->CYCCNT; \
+            statement; \
+            uint32_t cycles = DWT->CYCCNT - begin; \
+            if(cycles < best) best = cycles; \
+        } \
+        __enable_irq(); \
+        bench_say("Bench: test=stage, stage=%s, cycles=%u\n", name, (unsigned int)(best > overhead ? best - overhead : 0)); \
+    } while(0)
+
+inline void bench_stages(){
+    uint32_t overhead = 0xFFFFFFFF;
+    for(unsigned int r=0; r<BENCH_REPEATS; r++){
+        uint32_t begin = DWT->CYCCNT;
+        uint32_t cycles = DWT->CYCCNT - begin;
+        if(cycles < overhead) overhead = cycles;
+    }
+
+    /* Inputs look like what kernels get while broadcasting */
+    static uint16_t envelope[MONITOR_BLOCK];
+    monitor_init(&monitor);
+    monitor_begin(&monitor);
+    for(unsigned int i=0; i<MONITOR_BLOCK; i++){
+        monitor_record(&monitor, tone[i % TONE_LENGTH]);
+        envelope[i] = tone[(i + 1) % TONE_LENGTH];
+    }
+    static uint16_t captures[COUNTER_SLICE];
+    for(unsigned int i=0; i<COUNTER_SLICE; i++) captures[i] = i * 109;
+    counter_init(&counter);
+    counter_begin(&counter);
+    unsigned int measurements[MAX_OPCODES];
+    for(unsigned int i=0; i<MAX_OPCODES; i++) measurements[i] = 77000 + i * 1675;
+    telemetry_status_t status = {};
+    command_t parsed;
+    volatile unsigned int found;
+
+    BENCH_STAGE("adc_isr", sampling_isr());
+    BENCH_STAGE("monitor_block", monitor_block(&monitor, envelope, MONITOR_LAG, MONITOR_SLICE));
+    BENCH_STAGE("monitor_fit", monitor_fit(&monitor, 0));
+    BENCH_STAGE("counter_slice", for(unsigned int i=0; i<COUNTER_SLICE; i++) counter_edge(&counter, captures[i]));
+    BENCH_STAGE("telemetry_status", telemetry_init(&telemetry); telemetry_status(&telemetry, &status));
+    BENCH_STAGE("console_parse", console_parse("tune 1008000", 12, &parsed));
+    BENCH_STAGE("tune_lookup", found = closest(measurements, MAX_OPCODES - 2, TUNE_HZ(997975)));
+    BENCH_STAGE("tune_lookup_float", found = tune_closest_float(measurements, MAX_OPCODES - 2, MEASURE_PERIODS, 997975.0f));
+    BENCH_STAGE("tune_frequency", found = tune_frequency(MEASURE_PERIODS, measurements[found & 63]));
+    BENCH_STAGE("tune_frequency_float", found = (unsigned int)(MEASURE_PERIODS * 1000000.0f / measurements[found & 63]));
+    BENCH_STAGE("trace_log", trace_log(&trace, TRACE_RETUNE, 1008000));
+    (void)found;
+}
+
+/**
+ * Bit-exact kernels, interrupts masked
+ */
+inline void bench_kernels(){
+    static uint16_t input[HARNESS_LENGTH];
+    harness_input(input, HARNESS_LENGTH);
+    for(unsigned int k=0; k<HARNESS_KERNELS; k++){
+        __disable_irq();
+        harness_result_t result = harness_check(&harness_kernels[k], input, HARNESS_LENGTH, 0);
+        __enable_irq();
+        uint32_t cycles = (uint32_t)(((uint64_t)result.best * 100 + HARNESS_LENGTH / 2) / HARNESS_LENGTH);
+        bench_say("Bench: test=kernel, kernel=%s, exact=%d, hash=%08X, cycles=%u.%02u\n", harness_kernels[k].name,
+            result.exact, (unsigned int)result.hash, (unsigned int)(cycles / 100), (unsigned int)(cycles % 100));
+    }
+}
+
+/**
+ * Software interrupt latency, best and worst of BENCH_REPEATS
+ */
+inline void bench_irq(){
+    uint32_t best = 0xFFFFFFFF, worst = 0;
+    NVIC_SetVector(SWI_IRQn, (uintptr_t)bench_swi);
+    NVIC_EnableIRQ(SWI_IRQn);
+    for(unsigned int r=0; r<BENCH_REPEATS; r++){
+        bench_entered = 0;
+        uint32_t pended = DWT->CYCCNT;
+        NVIC_SetPendingIRQ(SWI_IRQn);
+        while(!bench_entered);
+        uint32_t latency = bench_entered - pended;
+        if(latency < best) best = latency;
+        if(latency > worst) worst = latency;
+    }
+    bench_say("Bench: test=irq, kind=best, cycles=%u\n", (unsigned int)best);
+    bench_say("Bench: test=irq, kind=worst, cycles=%u\n", (unsigned int)worst);
+}
+
+/**
+ * MEASURING sweep as main() does it, interrupts enabled and sampling running
+ */
+inline uint32_t bench_calibration(Timer *timer){
+    uint32_t begin = timer->read_us();
+    sled_init(&sled, 0, MEASURE_PERIODS);
+    for(unsigned int index=0; index<MAX_OPCODES - 1; index++){
+        sled_prepare(&sled, index, MEASURE_PERIODS);
+        transmit(&sled, 32768);
+    }
+    return timer->read_us() - begin;
+}
+
+/**
+ * Run every benchmark once
+ */
+inline void bench_run(){
+    Timer timer;
+    timer.start();
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    red = LED_OFF; green = LED_OFF; blue = LED_ON;
+    for(unsigned int i=0; i<TONE_LENGTH; i++){
+        tone[i] = (uint16_t)(32768 + 32767 * sinf(2.0f * 3.14159265f * i / TONE_LENGTH));
+    }
+    init_adc();
+    init_sampling(22050);
+
+    bench_say("Bench: test=build, name=%s, compiler=%s, clock=%u, board=%08X%08X\n", BENCH_STRING(BENCH_BUILD), __VERSION__,
+        (unsigned int)SystemCoreClock, (unsigned int)SIM->UIDML, (unsigned int)SIM->UIDL);
+    for(unsigned int w=SINE; w<=SQUARE; w++){
+        waveform = w;
+        for(unsigned int e=0; e<sizeof(bench_engines) / sizeof(bench_engines[0]); e++){
+            uint32_t fastest = 0;
+            for(unsigned int i=0; i<sizeof(bench_indices) / sizeof(bench_indices[0]); i++){
+                uint32_t cycles = bench_period(bench_indices[i]);
+                if(!i) fastest = cycles;
+                bench_say("Bench: test=period, waveform=%s, engine=%s, index=%u, cycles=%u.%02u\n", bench_waveforms[w],
+                    bench_engines[e], bench_indices[i], (unsigned int)(cycles / 100), (unsigned int)(cycles % 100));
+            }
+            bench_say("Bench: test=reach, waveform=%s, engine=%s, hz=%u\n", bench_waveforms[w], bench_engines[e],
+                (unsigned int)((uint64_t)SystemCoreClock * 100 / fastest));
+        }
+    }
+    bench_stages();
+    bench_kernels();
+    bench_irq();
+    for(unsigned int w=SINE; w<=SQUARE; w++){
+        waveform = w;
+        uint32_t us = bench_calibration(&timer);
+        bench_say("Bench: test=calibration, waveform=%s, ms=%u\n", bench_waveforms[w], (unsigned int)(us / 1000));
+    }
+    bench_say("Bench: test=done, seconds=%u\n", (unsigned int)(timer.read_us() / 1000000));
+    blue = LED_OFF; green = LED_ON;
+}
+
+/* Host simulation runs benchmarks from its own main() */
+#ifndef BENCH_HOST
+int main(){
+    bench_run();
+    while(true) __WFI();
+}
+#endif
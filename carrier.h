@@ -0,0 +1,106 @@
+#ifndef CARRIER_H
+#define CARRIER_H
+
+#include <stdint.h>
+#include "sled.h"
+
+/**
+ * Carrier loop, composed of policies at compile time
+ *
+ * Transmitter<Waveform, Engine, Pacing>::transmit() sends one sample, that is
+ * periods of carrier as active sled says:
+ *   Waveform   DAC levels of one period, each held for the engine's delay
+ *              (Square: value, 0; Sine: 0, value / 2, value, value / 2)
+ *   Engine     how a level is written and held (SledEngine: DAC write, then
+ *              BR LX into NOP sled)
+ *   Pacing     what may happen while sample is sent (Preemptible: interrupts
+ *              are serviced whenever they come; Realtime: they are masked until
+ *              sample is done and serviced between samples, nothing
+ *              is lost as ADC result and PPS capture are latched by hardware
+ *              and UART has FIFO)
+ * Policies are static inline functions, so each instantiation compiles into
+ * its own loop with nothing but DAC writes and sleds in it. Modes switch at
+ * run time by picking other instantiation from carrier_select(), which costs
+ * one indirect call per sample.
+ *
+ * Includer provides hooks:
+ *   CARRIER_DAC(value)     write DAC
+ *   CARRIER_EXEC(opcodes)  execute sled
+ *   CARRIER_CYCLES()       core cycle counter
+ *   CARRIER_MASK(), CARRIER_UNMASK()  mask and unmask interrupts
+ */
+
+#define SINE 0
+#define SQUARE 1
+
+/**
+ * Sends one sample, returns cycles its periods took
+ */
+typedef uint32_t (*carrier_t)(sled_t *sled, const int value);
+
+static uint32_t carrier_switched = 0;   /* Cycle counter at last sled switch, right before first DAC write on new tuning */
+
+struct Square {
+    template<class Engine> static inline void period(const uint16_t *opcodes, const int value){
+        Engine::hold(opcodes, value);
+        Engine::hold(opcodes, 0);
+    }
+};
+
+struct Sine {
+    template<class Engine> static inline void period(const uint16_t *opcodes, const int value){
+        Engine::hold(opcodes, 0);
+        Engine::hold(opcodes, value >> 1);
+        Engine::hold(opcodes, value);
+        Engine::hold(opcodes, value >> 1);
+    }
+};
+
+struct SledEngine {
+    static inline void hold(const uint16_t *opcodes, const int value){
+        CARRIER_DAC(value);
+        CARRIER_EXEC(opcodes);
+    }
+};
+
+struct Preemptible {
+    static inline void enter(){}
+    static inline void leave(){}
+};
+
+struct Realtime {
+    static inline void enter(){ CARRIER_MASK(); }
+    static inline void leave(){ CARRIER_UNMASK(); }
+};
+
+template<class Waveform, class Engine, class Pacing>
+struct Transmitter {
+    /**
+     * Previous sample ended with complete period, so this is where prepared tuning is switched to
+     */
+    static uint32_t transmit(sled_t *sled, const int value){
+        Pacing::enter();
+        uint32_t start = CARRIER_CYCLES();
+        if(sled_switch(sled)) carrier_switched = CARRIER_CYCLES();
+        const uint16_t *opcodes = sled_opcodes(sled);
+        for(unsigned int i=sled_periods(sled); i; i--){
+            Waveform::template period<Engine>(opcodes, value);
+        }
+        uint32_t cycles = CARRIER_CYCLES() - start;
+        Pacing::leave();
+        return cycles;
+    }
+};
+
+/**
+ * Carrier loop of given waveform (SINE or SQUARE) and pacing
+ */
+inline carrier_t carrier_select(unsigned int waveform, bool realtime){
+    static const carrier_t carriers[2][2] = {
+        {Transmitter<Sine, SledEngine, Preemptible>::transmit, Transmitter<Sine, SledEngine, Realtime>::transmit},
+        {Transmitter<Square, SledEngine, Preemptible>::transmit, Transmitter<Square, SledEngine, Realtime>::transmit},
+    };
+    return carriers[waveform][realtime];
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include "hop.h"
+#include "tuning.h"
+
+/**
+ * Channel table, worked out at compile time
+ *
+ * Channels are frequencies a radio is tuned to. Broadcast is upper sideband,
+ * so carrier has to sit sample_rate / 2 below channel; carriers of every
+ * channel at every supported sample rate are computed by compiler and kept
+ * in flash, so neither boot nor rate change touches them.
+ *
+ * I just listed stuff that my radio at home is able to handle :D
+ * Nothing special about these numbers, you can change them to anything else,
+ * as long as they are ascending (static_assert below catches duplicates)
+ */
+
+#define RATES 5                 /* Amount of supported sample rates */
+
+static constexpr unsigned int rates[RATES] = {8000, 11025, 16000, 22050, 32000};  /* Supported sample rates */
+
+static constexpr unsigned int channel_rasters[] = {
+    531000, 540000, 549000, 558000, 567000, 576000, 585000, 594000,
+    603000, 612000, 621000, 630000, 639000, 648000, 651000, 666000,
+    675000, 684000, 693000, 702000, 711000, 720000, 729000, 738000,
+    747000, 756000, 765000, 774000, 783000, 792000, 801000, 810000,
+    819000, 828000, 837000, 846000, 855000, 864000, 873000, 882000,
+    891000, 900000, 909000, 918000, 927000, 936000, 945000, 954000,
+    963000, 972000, 981000, 989000, 990000, 999000, 1008000,
+    1017000, 1026000, 1035000, 1044000, 1053000, 1062000, 1071000, 1080000,
+    1089000, 1098000, 1107000, 1115000, 1116000, 1125000, 1134000, 1143000,
+    1152000, 1161000, 1170000, 1179000, 1188000, 1197000, 1206000, 1215000,
+};
+#define CHANNELS (sizeof(channel_rasters) / sizeof(channel_rasters[0]))
+
+struct channel_table_t {
+    tune_t carriers[RATES][CHANNELS];   /* Carrier, channel - rate / 2 */
+};
+
+constexpr channel_table_t channel_build(){
+    channel_table_t table = {};
+    for(unsigned int r=0; r<RATES; r++){
+        for(unsigned int c=0; c<CHANNELS; c++){
+            table.carriers[r][c] = TUNE_HZ(channel_rasters[c]) - TUNE_HZ(rates[r]) / 2;
+        }
+    }
+    return table;
+}
+
+static constexpr channel_table_t channel_table = channel_build();
+
+constexpr bool channel_ascending(){
+    for(unsigned int c=1; c<CHANNELS; c++){
+        if(channel_rasters[c] <= channel_rasters[c - 1]) return false;
+    }
+    return true;
+}
+
+static_assert(channel_ascending(), "Channels have to be ascending, without duplicates");
+static_assert(CHANNELS <= HOP_CHANNELS, "Hop cache can't hold every channel");
+static_assert(channel_rasters[0] >= 520000 && channel_rasters[CHANNELS - 1] <= 1710000, "Channels have to be in AM broadcast band");
+static_assert(channel_rasters[0] > rates[RATES - 1] / 2, "Carrier of every channel has to be above 0 Hz");
+
+/**
+ * Carrier of given channel at given sample rate (index into rates[])
+ */
+inline tune_t channel_carrier(unsigned int rate, unsigned int channel){
+    return channel_table.carriers[rate][channel];
+}
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+
+/**
+ * Serial command console
+ *
+ * Characters received by serial port are fed here one by one from main loop,
+ * never from carrier loop itself. Complete lines are parsed into commands,
+ * which main loop applies at sample boundary. Nothing here allocates memory,
+ * line is assembled in fixed buffer and too long lines are rejected.
+ *
+ * Commands:
+ *   tune <Hz>                  retune to frequency closest to given one, within AM broadcast band
+ *   mode sine|square           change waveform (needs new measurement)
+ *   depth <0-100>              modulation index in percent
+ *   source adc|tone|silence    audio source
+ *   hop <ms>                   hop across channels, staying given time on each, 0 stops
+ *   sequence <seed>            order of hops, 0 is in order, anything else pseudo-random
+ *   scan <ms>                  visit every channel once with ID tone, sending binary records, 0 stops
+ *   realtime 0|1               mask interrupts while carrier is running
+ *   jitter                     print and reset sample length histograms
+ *   rate <Hz>                  sample rate, one of 8000, 11025, 16000, 22050, 32000
+ *   load                       print CPU load of each sample rate used so far and headroom per stage
+ *   counter 0|1                measure carrier frequency from DAC output
+ *   carrier                    print and reset measured carrier frequency, period jitter and drift
+ *   telemetry <ms>             send binary status frame with given period, 0 stops
+ *   trace                      send event trace as telemetry frames
+ *   monitor <ms>               compare transmitted envelope with audio with given period, 0 stops
+ *   profile                    print and reset cycle profile of main loop
+ *   measured <index>           print period measurements of BR LX locations from given one on
+ *   status                     print current settings
+ */
+
+#define CONSOLE_LINE 32             /* Longest command we accept */
+#define CONSOLE_BUDGET 4            /* Characters read per main loop iteration */
+#define CONSOLE_BAND_LOW 520000     /* AM broadcast band `tune` accepts, Hz */
+#define CONSOLE_BAND_HIGH 1710000
+
+#define CONSOLE_NONE 0
+#define CONSOLE_TUNE 1
+#define CONSOLE_MODE 2
+#define CONSOLE_DEPTH 3
+#define CONSOLE_SOURCE 4
+#define CONSOLE_STATUS 5
+#define CONSOLE_HOP 6
+#define CONSOLE_SEQUENCE 7
+#define CONSOLE_SCAN 8
+#define CONSOLE_REALTIME 9
+#define CONSOLE_JITTER 10
+#define CONSOLE_RATE 11
+#define CONSOLE_LOAD 12
+#define CONSOLE_PROFILE 13
+#define CONSOLE_COUNTER 14
+#define CONSOLE_CARRIER 15
+#define CONSOLE_TELEMETRY 16
+#define CONSOLE_TRACE 17
+#define CONSOLE_MONITOR 18
+#define CONSOLE_MEASURED 19
+#define CONSOLE_ERROR 20
+
+#define SOURCE_ADC 0                /* Audio comes from A0 */
+#define SOURCE_TONE 1               /* 1 kHz test tone */
+#define SOURCE_SILENCE 2            /* Unmodulated carrier */
+
+struct command_t {
+    unsigned int type;              /* One of CONSOLE_* */
+    int32_t value;                  /* Argument, for mode it's SINE or SQUARE, for source one of SOURCE_* */
+};
+
+struct console_t {
+    char line[CONSOLE_LINE];        /* Line being assembled */
+    unsigned int length;            /* Length of line, CONSOLE_LINE + 1 if it overflowed */
+};
+
+inline void console_init(console_t *console){
+    console->length = 0;
+}
+
+/**
+ * Compare word with keyword
+ */
+inline bool console_word(const char *word, unsigned int length, const char *keyword){
+    unsigned int i = 0;
+    for(; i<length && keyword[i]; i++){
+        if(word[i] != keyword[i]) return false;
+    }
+    return i == length && !keyword[i];
+}
+
+/**
+ * Parse complete line into command
+ */
+inline void console_parse(const char *line, unsigned int length, command_t *command){
+    unsigned int i = 0, word, word_length, arg, arg_length;
+    command->type = CONSOLE_ERROR;
+    command->value = 0;
+
+    while(i < length && line[i] == ' ') i++;
+    word = i;
+    while(i < length && line[i] != ' ') i++;
+    word_length = i - word;
+    while(i < length && line[i] == ' ') i++;
+    arg = i;
+    while(i < length && line[i] != ' ') i++;
+    arg_length = i - arg;
+
+    if(!word_length){
+        command->type = CONSOLE_NONE;
+        return;
+    }
+    if(console_word(line + word, word_length, "status")){
+        command->type = CONSOLE_STATUS;
+        return;
+    }
+    if(console_word(line + word, word_length, "jitter")){
+        command->type = CONSOLE_JITTER;
+        return;
+    }
+    if(console_word(line + word, word_length, "load")){
+        command->type = CONSOLE_LOAD;
+        return;
+    }
+    if(console_word(line + word, word_length, "profile")){
+        command->type = CONSOLE_PROFILE;
+        return;
+    }
+    if(console_word(line + word, word_length, "carrier")){
+        command->type = CONSOLE_CARRIER;
+        return;
+    }
+    if(console_word(line + word, word_length, "trace")){
+        command->type = CONSOLE_TRACE;
+        return;
+    }
+    if(console_word(line + word, word_length, "mode")){
+        if(console_word(line + arg, arg_length, "sine")) command->value = 0;
+        else if(console_word(line + arg, arg_length, "square")) command->value = 1;
+        else return;
+        command->type = CONSOLE_MODE;
+        return;
+    }
+    if(console_word(line + word, word_length, "source")){
+        if(console_word(line + arg, arg_length, "adc")) command->value = SOURCE_ADC;
+        else if(console_word(line + arg, arg_length, "tone")) command->value = SOURCE_TONE;
+        else if(console_word(line + arg, arg_length, "silence")) command->value = SOURCE_SILENCE;
+        else return;
+        command->type = CONSOLE_SOURCE;
+        return;
+    }
+
+    /* Remaining commands take unsigned number */
+    if(!arg_length || arg_length > 9) return;
+    int32_t value = 0;
+    for(unsigned int j=0; j<arg_length; j++){
+        char c = line[arg + j];
+        if(c < '0' || c > '9') return;
+        value = value * 10 + (c - '0');
+    }
+    if(console_word(line + word, word_length, "tune") && value >= CONSOLE_BAND_LOW && value <= CONSOLE_BAND_HIGH){
+        command->type = CONSOLE_TUNE;
+    } else if(console_word(line + word, word_length, "depth") && value <= 100){
+        command->type = CONSOLE_DEPTH;
+    } else if(console_word(line + word, word_length, "hop") && value <= 60000){
+        command->type = CONSOLE_HOP;
+    } else if(console_word(line + word, word_length, "sequence")){
+        command->type = CONSOLE_SEQUENCE;
+    } else if(console_word(line + word, word_length, "scan") && value <= 60000){
+        command->type = CONSOLE_SCAN;
+    } else if(console_word(line + word, word_length, "realtime") && value <= 1){
+        command->type = CONSOLE_REALTIME;
+    } else if(console_word(line + word, word_length, "counter") && value <= 1){
+        command->type = CONSOLE_COUNTER;
+    } else if(console_word(line + word, word_length, "telemetry") && value <= 60000){
+        command->type = CONSOLE_TELEMETRY;
+    } else if(console_word(line + word, word_length, "monitor") && value <= 60000){
+        command->type = CONSOLE_MONITOR;
+    } else if(console_word(line + word, word_length, "rate")){
+        command->type = CONSOLE_RATE;
+    } else if(console_word(line + word, word_length, "measured")){
+        command->type = CONSOLE_MEASURED;
+    } else return;
+    command->value = value;
+}
+
+/**
+ * Feed received character
+ * Returns true if it completed command (or invalid line, CONSOLE_ERROR)
+ */
+inline bool console_feed(console_t *console, char c, command_t *command){
+    if(c != '\r' && c != '\n'){
+        if(console->length < CONSOLE_LINE) console->line[console->length] = c;
+        if(console->length <= CONSOLE_LINE) console->length++;
+        return false;
+    }
+    unsigned int length = console->length;
+    console->length = 0;
+    if(length > CONSOLE_LINE){
+        command->type = CONSOLE_ERROR;
+        command->value = 0;
+        return true;
+    }
+    console_parse(console->line, length, command);
+    return command->type != CONSOLE_NONE;
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <stdint.h>
+
+/**
+ * Carrier frequency counter
+ *
+ * Statistics of carrier edge timestamps, captured in batches of COUNTER_EDGES
+ * (see counter_port.h for where they come from on target). Only lower 16 bits
+ * of timer are captured, which is plenty as carrier period is well under
+ * 65536 ticks.
+ *
+ * Periods are compared to reference, which is mean period of previous batch.
+ * Periods within COUNTER_SPAN ticks of it count towards frequency, all periods
+ * up to twice the reference go to jitter histogram (bins of one tick around
+ * reference, end bins take everything further away) and longer ones are gaps,
+ * where carrier stopped between samples. Batch whose periods mostly don't match
+ * reference (carrier was retuned) only sets new reference from its shortest period.
+ *
+ * Frequency is accumulated since last counter_reset(), drift log keeps
+ * frequency of last COUNTER_LOG intervals, counter_log() closes interval.
+ * Retune (counter_rebase()) starts both over, so that they never mix carriers.
+ */
+
+#define COUNTER_EDGES 256           /* Captures per batch */
+#define COUNTER_SPAN 8              /* Histogram covers reference +- COUNTER_SPAN ticks */
+#define COUNTER_BINS (2 * COUNTER_SPAN + 1)
+#define COUNTER_LOG 16              /* Drift log entries */
+
+struct counter_stats_t {
+    uint64_t ticks;                 /* Length of periods within span */
+    uint64_t periods;               /* Periods within span */
+    uint32_t gaps;                  /* Periods longer than twice reference */
+    uint32_t min;                   /* Shortest period that wasn't gap */
+    uint32_t max;                   /* Longest period that wasn't gap */
+    uint32_t bins[COUNTER_BINS];    /* Periods per deviation from reference */
+};
+
+struct counter_t {
+    counter_stats_t batch;          /* Batch being processed */
+    counter_stats_t total;          /* Accepted batches since reset */
+    uint32_t reference;             /* Expected period in 1/256 ticks, 0 if unknown */
+    uint32_t shortest;              /* Shortest period of batch */
+    uint32_t edges;                 /* Periods seen in batch */
+    uint16_t last;                  /* Previous capture */
+    bool started;                   /* Batch has its first capture */
+    uint32_t batches;               /* Accepted batches since reset */
+    uint32_t rejected;              /* Batches that didn't match reference since reset */
+    uint64_t log_ticks;             /* Current drift log interval */
+    uint64_t log_periods;
+    uint32_t log[COUNTER_LOG];      /* Frequency of past intervals in mHz, ring */
+    unsigned int logged;            /* Intervals logged so far */
+};
+
+inline void counter_clear(counter_stats_t *stats){
+    stats->ticks = 0;
+    stats->periods = 0;
+    stats->gaps = 0;
+    stats->min = 0xFFFFFFFF;
+    stats->max = 0;
+    for(unsigned int i=0; i<COUNTER_BINS; i++){
+        stats->bins[i] = 0;
+    }
+}
+
+/**
+ * Start over with statistics, reference and drift log are kept
+ */
+inline void counter_reset(counter_t *counter){
+    counter_clear(&counter->total);
+    counter->batches = 0;
+    counter->rejected = 0;
+}
+
+inline void counter_init(counter_t *counter){
+    counter_reset(counter);
+    counter->reference = 0;
+    counter->started = false;
+    counter->log_ticks = 0;
+    counter->log_periods = 0;
+    counter->logged = 0;
+}
+
+/**
+ * Carrier was retuned, statistics and drift log of old carrier are dropped
+ * and next batch only finds new reference
+ */
+inline void counter_rebase(counter_t *counter){
+    counter_reset(counter);
+    counter->reference = 0;
+    counter->log_ticks = 0;
+    counter->log_periods = 0;
+    counter->logged = 0;
+}
+
+inline void counter_begin(counter_t *counter){
+    counter_clear(&counter->batch);
+    counter->shortest = 0xFFFFFFFF;
+    counter->edges = 0;
+    counter->started = false;
+}
+
+/**
+ * Account captured edge
+ */
+inline void counter_edge(counter_t *counter, uint16_t capture){
+    if(!counter->started){
+        counter->last = capture;
+        counter->started = true;
+        return;
+    }
+    uint32_t period = (uint16_t)(capture - counter->last);
+    counter->last = capture;
+    counter->edges++;
+    if(period < counter->shortest) counter->shortest = period;
+    if(!counter->reference) return;
+
+    counter_stats_t *stats = &counter->batch;
+    if((period << 8) > 2 * counter->reference){
+        stats->gaps++;
+        return;
+    }
+    if(period < stats->min) stats->min = period;
+    if(period > stats->max) stats->max = period;
+    int32_t deviation = ((int32_t)(period << 8) - (int32_t)counter->reference + 128) >> 8;
+    if(deviation < -COUNTER_SPAN){
+        stats->bins[0]++;
+    } else if(deviation > COUNTER_SPAN){
+        stats->bins[COUNTER_BINS - 1]++;
+    } else {
+        stats->bins[deviation + COUNTER_SPAN]++;
+        stats->ticks += period;
+        stats->periods++;
+    }
+}
+
+/**
+ * Finish batch, returns false if it didn't match reference
+ */
+inline bool counter_end(counter_t *counter){
+    counter_stats_t *batch = &counter->batch, *total = &counter->total;
+    if(!counter->reference || batch->periods * 2 < counter->edges){
+        counter->reference = counter->shortest != 0xFFFFFFFF ? counter->shortest << 8 : 0;
+        counter->rejected++;
+        return false;
+    }
+    total->ticks += batch->ticks;
+    total->periods += batch->periods;
+    total->gaps += batch->gaps;
+    if(batch->min < total->min) total->min = batch->min;
+    if(batch->max > total->max) total->max = batch->max;
+    for(unsigned int i=0; i<COUNTER_BINS; i++){
+        total->bins[i] += batch->bins[i];
+    }
+    counter->log_ticks += batch->ticks;
+    counter->log_periods += batch->periods;
+    counter->reference = (uint32_t)(((batch->ticks << 8) + batch->periods / 2) / batch->periods);
+    counter->batches++;
+    return true;
+}
+
+/**
+ * Frequency of given periods in mHz, timer runs from `clock` Hz
+ */
+inline uint64_t counter_millihertz(uint64_t ticks, uint64_t periods, uint32_t clock){
+    if(!ticks) return 0;
+    uint64_t cycles = periods * clock;      /* Split, so that it doesn't overflow after long run */
+    return cycles / ticks * 1000 + (cycles % ticks * 1000 + ticks / 2) / ticks;
+}
+
+/**
+ * Measured frequency since reset in mHz
+ */
+inline uint64_t counter_frequency(const counter_t *counter, uint32_t clock){
+    return counter_millihertz(counter->total.ticks, counter->total.periods, clock);
+}
+
+/**
+ * Close drift log interval, intervals without any accepted batch aren't logged
+ */
+inline void counter_log(counter_t *counter, uint32_t clock){
+    if(!counter->log_periods) return;
+    counter->log[counter->logged % COUNTER_LOG] = (uint32_t)counter_millihertz(counter->log_ticks, counter->log_periods, clock);
+    counter->logged++;
+    counter->log_ticks = 0;
+    counter->log_periods = 0;
+}
+
+/**
+ * Drift log entry, 0 is the oldest one kept
+ */
+inline uint32_t counter_logged(const counter_t *counter, unsigned int i){
+    unsigned int first = counter->logged > COUNTER_LOG ? counter->logged - COUNTER_LOG : 0;
+    return counter->log[(first + i) % COUNTER_LOG];
+}
+
+#endif
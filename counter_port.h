@@ -0,0 +1,95 @@
+#ifndef COUNTER_PORT_H
+#define COUNTER_PORT_H
+
+#include "mbed.h"
+#include "fsl_clock.h"
+#include "counter.h"
+
+/**
+ * Carrier edge capture for counter.h
+ *
+ * DAC0 output is internally connected to comparator CMP1 (input 3), no wiring
+ * is needed. It's compared with CMP1's own 6-bit DAC set just above ground,
+ * so that every period of both sine and square has one rising edge (as long as
+ * sample isn't close to zero, those periods show up as gaps).
+ * Comparator output is routed to FTM1 channel 0 input capture, which runs free
+ * from bus clock, and each capture is moved to buffer by DMA channel COUNTER_DMA.
+ * Carrier runs at around 1 MHz, far too fast for interrupt per edge, and DMA
+ * doesn't need CPU at all. Batch is armed from control task, once DMA is done
+ * (no interrupt, DREQ stops the channel) task works through captures in slices.
+ *
+ * Timer runs from our own crystal, so counter sees what carrier loop does,
+ * not crystal error.
+ */
+
+#define COUNTER_DMA 0               /* DMA channel used for captures */
+#define COUNTER_THRESHOLD 3         /* CMP1 DAC level, (n + 1) / 64 of VDDA */
+
+static uint16_t counter_captures[COUNTER_EDGES];   /* Written by DMA */
+static uint32_t counter_clock = 60000000;          /* Timer clock in Hz */
+
+/**
+ * Initialize CMP1, FTM1 channel 0 capture and DMA, nothing is captured until counter_arm()
+ */
+inline void init_counter(){
+    counter_clock = CLOCK_GetBusClkFreq();
+    SIM->SCGC4 |= SIM_SCGC4_CMP_MASK;           /* Enable comparator clock */
+    SIM->SCGC6 |= SIM_SCGC6_FTM1_MASK | SIM_SCGC6_DMAMUX_MASK;
+    SIM->SCGC7 |= SIM_SCGC7_DMA_MASK;
+
+    CMP1->CR0 = CMP_CR0_HYSTCTR(3);             /* Largest hysteresis */
+    CMP1->DACCR = CMP_DACCR_DACEN_MASK | CMP_DACCR_VRSEL_MASK | CMP_DACCR_VOSEL(COUNTER_THRESHOLD);
+    CMP1->MUXCR = CMP_MUXCR_PSEL(3) | CMP_MUXCR_MSEL(7);   /* DAC0 output against CMP1 DAC */
+    CMP1->CR1 = CMP_CR1_EN_MASK | CMP_CR1_PMODE_MASK;      /* High speed mode */
+    SIM->SOPT4 = (SIM->SOPT4 & ~SIM_SOPT4_FTM1CH0SRC_MASK) | SIM_SOPT4_FTM1CH0SRC(2);  /* FTM1_CH0 = CMP1 output */
+
+    FTM1->MODE |= FTM_MODE_WPDIS_MASK;          /* Disable write protection */
+    FTM1->SC = 0;                               /* Stop counter while configuring */
+    FTM1->CNTIN = 0;
+    FTM1->MOD = 0xFFFF;                         /* Free running */
+    FTM1->CNT = 0;
+    FTM1->CONTROLS[0].CnSC = FTM_CnSC_ELSA_MASK | FTM_CnSC_CHIE_MASK | FTM_CnSC_DMA_MASK;  /* Rising edge, request DMA */
+    FTM1->SC = FTM_SC_CLKS(1) | FTM_SC_PS(0);   /* Bus clock, divide by 1 */
+
+    /* 16-bit lower half of CnV into buffer, back to its start after batch */
+    DMA0->CERQ = COUNTER_DMA;
+    DMA0->TCD[COUNTER_DMA].SADDR = (uint32_t)(uintptr_t)&FTM1->CONTROLS[0].CnV;
+    DMA0->TCD[COUNTER_DMA].SOFF = 0;
+    DMA0->TCD[COUNTER_DMA].ATTR = DMA_ATTR_SSIZE(1) | DMA_ATTR_DSIZE(1);
+    DMA0->TCD[COUNTER_DMA].NBYTES_MLNO = 2;
+    DMA0->TCD[COUNTER_DMA].SLAST = 0;
+    DMA0->TCD[COUNTER_DMA].DADDR = (uint32_t)(uintptr_t)counter_captures;
+    DMA0->TCD[COUNTER_DMA].DOFF = 2;
+    DMA0->TCD[COUNTER_DMA].CITER_ELINKNO = COUNTER_EDGES;
+    DMA0->TCD[COUNTER_DMA].BITER_ELINKNO = COUNTER_EDGES;
+    DMA0->TCD[COUNTER_DMA].DLAST_SGA = -(int32_t)sizeof(counter_captures);
+    DMA0->TCD[COUNTER_DMA].CSR = DMA_CSR_DREQ_MASK;
+    DMAMUX->CHCFG[COUNTER_DMA] = DMAMUX_CHCFG_ENBL_MASK | DMAMUX_CHCFG_SOURCE(kDmaRequestMux0FTM1Channel0 & 0xFF);
+}
+
+/**
+ * Start capturing batch, edge latched while we weren't capturing is dropped
+ */
+inline void counter_arm(){
+    DMA0->CDNE = COUNTER_DMA;
+    FTM1->CONTROLS[0].CnSC &= ~FTM_CnSC_CHF_MASK;
+    DMA0->SERQ = COUNTER_DMA;
+}
+
+/**
+ * Stop capturing, batch in progress is abandoned
+ */
+inline void counter_stop(){
+    DMA0->CERQ = COUNTER_DMA;
+    DMA0->TCD[COUNTER_DMA].DADDR = (uint32_t)(uintptr_t)counter_captures;
+    DMA0->TCD[COUNTER_DMA].CITER_ELINKNO = COUNTER_EDGES;
+}
+
+/**
+ * Whole batch was captured
+ */
+inline bool counter_done(){
+    return DMA0->TCD[COUNTER_DMA].CSR & DMA_CSR_DONE_MASK;
+}
+
+#endif
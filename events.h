@@ -0,0 +1,105 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+/**
+ * Event flags and idle accounting
+ *
+ * Interrupts post events, main loop takes them. Only STANDBY (disciplined board
+ * waiting for lock) sleeps in WFI until next interrupt. While measuring, testing
+ * or broadcasting, carrier is timed by the core itself (NOP sled) and the loop
+ * only polls events between bursts: there is no slack to sleep in, any wait
+ * would be a gap in carrier. Time spent busy and asleep is accounted to current
+ * state, so we can tell how much idle time each state has.
+ *
+ * Platform provides following hooks before including this file:
+ *   EVENTS_NOW()     free running 32-bit counter that keeps running during WFI
+ *   EVENTS_SLEEP()   wait for interrupt
+ *   EVENTS_LOCK()    mask interrupts
+ *   EVENTS_UNLOCK()  unmask interrupts
+ * On target these are us_ticker_read(), __WFI() and __disable_irq() / __enable_irq(),
+ * host simulation (tools/events_sim.cpp) provides virtual ones.
+ */
+
+#define EVENT_SAMPLE 0x01   /* New ADC sample is in ring buffer */
+#define EVENT_PPS 0x02      /* PPS edge was captured */
+#define EVENT_SERIAL 0x04   /* Serial data arrived */
+
+#define EVENTS_STATES 4     /* Amount of states we account time for */
+
+struct events_t {
+    volatile uint32_t pending;      /* Events posted by interrupts, not yet taken */
+    unsigned int state;             /* State time is currently accounted to */
+    uint32_t mark;                  /* Counter value at last accounting point */
+    uint64_t busy[EVENTS_STATES];   /* Time spent running, per state */
+    uint64_t idle[EVENTS_STATES];   /* Time spent in WFI, per state */
+};
+
+static events_t events;
+
+inline void events_init(events_t *ev, unsigned int state){
+    ev->pending = 0;
+    ev->state = state;
+    ev->mark = EVENTS_NOW();
+    for(unsigned int i=0; i<EVENTS_STATES; i++){
+        ev->busy[i] = ev->idle[i] = 0;
+    }
+}
+
+/**
+ * Post event, to be called from interrupt
+ */
+inline void events_post(events_t *ev, uint32_t mask){
+    ev->pending |= mask;
+}
+
+/**
+ * Take all pending events
+ */
+inline uint32_t events_take(events_t *ev){
+    EVENTS_LOCK();
+    uint32_t pending = ev->pending;
+    ev->pending = 0;
+    EVENTS_UNLOCK();
+    return pending;
+}
+
+/**
+ * Switch state time is accounted to
+ */
+inline void events_state(events_t *ev, unsigned int state){
+    uint32_t stamp = EVENTS_NOW();
+    ev->busy[ev->state] += stamp - ev->mark;
+    ev->mark = stamp;
+    ev->state = state;
+}
+
+/**
+ * Sleep until next interrupt, unless some event is already pending
+ *
+ * Interrupts are masked while we check, so that event posted right before
+ * WFI isn't lost. WFI wakes up even with interrupts masked, and pending
+ * interrupt is serviced as soon as we unmask them.
+ */
+inline void events_wait(events_t *ev){
+    EVENTS_LOCK();
+    if(!ev->pending){
+        uint32_t stamp = EVENTS_NOW();
+        ev->busy[ev->state] += stamp - ev->mark;
+        EVENTS_SLEEP();
+        ev->mark = EVENTS_NOW();
+        ev->idle[ev->state] += ev->mark - stamp;
+    }
+    EVENTS_UNLOCK();
+}
+
+/**
+ * Idle time of given state in tenths of percent
+ */
+inline unsigned int events_idle(const events_t *ev, unsigned int state){
+    uint64_t total = ev->busy[state] + ev->idle[state];
+    return total ? (unsigned int)(ev->idle[state] * 1000 / total) : 0;
+}
+
+#endif
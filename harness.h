@@ -0,0 +1,193 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stdint.h>
+#include "monitor.h"
+#include "counter.h"
+#include "sled.h"
+#include "channels.h"
+
+/**
+ * Bit-exact kernel harness
+ *
+ * Integer kernels run here against the same input on host and on target:
+ * input is synthesized with integer math only (triangle tone plus LCG noise,
+ * like audio around midscale), every output word is hashed (FNV-1a) and the
+ * hash is compared with golden one recorded from host build. Any difference
+ * between builds, compilers or hand optimized versions of a kernel shows up
+ * as mismatch. Runs are timed with HARNESS_NOW(), which includer defines
+ * (core cycles on target, nanoseconds on host), best of HARNESS_REPEATS.
+ *
+ * To add kernel, write runner that feeds input through it and harness_put()s
+ * everything it produces, add it to harness_kernels[] with golden hash 0,
+ * then fill in hash printed by `tools/harness_host -g`.
+ *
+ * Target runs it from benchmark image (bench.cpp), host from tools/harness_host.cpp.
+ */
+
+#define HARNESS_LENGTH 1024         /* Input samples */
+#define HARNESS_REPEATS 4           /* Timed runs per kernel */
+#define HARNESS_SEED 2463534242u
+#define HARNESS_FNV_BASIS 2166136261u
+#define HARNESS_FNV_PRIME 16777619u
+
+struct harness_t {
+    uint32_t hash;                  /* FNV-1a of output words, little endian */
+    uint32_t words;                 /* Output words */
+    void (*sink)(uint32_t word);    /* Gets every word too, if set */
+};
+
+struct harness_kernel_t {
+    const char *name;
+    void (*run)(const uint16_t *input, unsigned int length, harness_t *out);
+    uint32_t golden;                /* Hash of output on host, 0 if not recorded yet */
+};
+
+struct harness_result_t {
+    uint32_t hash;
+    uint32_t words;
+    bool exact;                     /* Hash matches golden */
+    uint32_t best;                  /* Shortest run, HARNESS_NOW() units */
+};
+
+inline void harness_put(harness_t *out, uint32_t word){
+    for(unsigned int i=0; i<4; i++){
+        out->hash = (out->hash ^ ((word >> (8 * i)) & 0xFF)) * HARNESS_FNV_PRIME;
+    }
+    out->words++;
+    if(out->sink) out->sink(word);
+}
+
+/**
+ * Triangle of 1/64 of sample rate at half scale plus noise of 1/16 scale
+ */
+inline void harness_input(uint16_t *input, unsigned int length){
+    uint32_t seed = HARNESS_SEED;
+    for(unsigned int i=0; i<length; i++){
+        seed = seed * 1664525u + 1013904223u;
+        int32_t phase = i & 63;
+        int32_t triangle = (phase < 32 ? phase : 64 - phase) * 1024 - 16384;
+        int32_t noise = (int32_t)(seed >> 20) - 2048;
+        input[i] = (uint16_t)(32768 + triangle + noise);
+    }
+}
+
+/**
+ * Monitor over windows of input, envelope follows audio two samples late at 3/4 depth
+ */
+inline void harness_monitor(const uint16_t *input, unsigned int length, harness_t *out){
+    static monitor_t monitor;
+    static uint16_t envelope[MONITOR_BLOCK];
+    monitor_init(&monitor);
+    for(unsigned int first=0; first + MONITOR_BLOCK <= length; first+=MONITOR_BLOCK){
+        monitor_begin(&monitor);
+        for(unsigned int i=0; i<MONITOR_BLOCK; i++){
+            monitor_record(&monitor, input[first + i]);
+            uint16_t late = input[first + i >= 2 ? first + i - 2 : 0];
+            envelope[i] = (uint16_t)(late * 3 / 4 + 8192);
+        }
+        for(unsigned int i=0; i<MONITOR_BLOCK; i+=MONITOR_SLICE){
+            monitor_block(&monitor, envelope, i, MONITOR_SLICE);
+        }
+        for(int lag=-MONITOR_LAG; lag<=MONITOR_LAG; lag++){
+            monitor_fit(&monitor, lag);
+        }
+        monitor_end(&monitor);
+        const monitor_result_t *result = &monitor.last;
+        harness_put(out, result->depth);
+        harness_put(out, result->events);
+        harness_put(out, (uint32_t)(int32_t)result->distortion);
+        harness_put(out, result->level);
+        harness_put(out, result->min);
+        harness_put(out, result->max);
+        harness_put(out, (uint32_t)(int32_t)result->lag);
+        harness_put(out, result->flags);
+    }
+}
+
+/**
+ * Counter on edges whose periods wander with input, with gap every 100 edges
+ */
+inline void harness_counter(const uint16_t *input, unsigned int length, harness_t *out){
+    static counter_t counter;
+    counter_init(&counter);
+    uint16_t capture = 0;
+    for(unsigned int first=0; first + COUNTER_EDGES <= length; first+=COUNTER_EDGES){
+        counter_begin(&counter);
+        for(unsigned int i=0; i<COUNTER_EDGES; i++){
+            capture += 110 + (input[first + i] >> 13) + (i % 100 == 99 ? 300 : 0);
+            counter_edge(&counter, capture);
+        }
+        harness_put(out, counter_end(&counter));
+        harness_put(out, counter.reference);
+    }
+    for(unsigned int i=0; i<COUNTER_BINS; i++){
+        harness_put(out, counter.total.bins[i]);
+    }
+    harness_put(out, counter.total.gaps);
+    harness_put(out, (uint32_t)counter_frequency(&counter, 60000000));
+}
+
+/**
+ * Fixed point logarithm of products of input
+ */
+inline void harness_log2(const uint16_t *input, unsigned int length, harness_t *out){
+    for(unsigned int i=0; i<length; i++){
+        harness_put(out, (uint32_t)monitor_log2((uint64_t)input[i] * (i + 1) * 4099 + 1));
+    }
+}
+
+/**
+ * Fixed point tuning of every channel at every rate, with measurements of
+ * 100000 periods of square carrier (111 + 2.034 cycles per BR LX location at
+ * 120 MHz) wandering with input by up to 63 us
+ */
+inline void harness_tuning(const uint16_t *input, unsigned int length, harness_t *out){
+    static unsigned int measurements[MAX_OPCODES - 2];
+    const unsigned int count = MAX_OPCODES - 2;
+    for(unsigned int first=0; first + count <= length; first+=count * 4){
+        for(unsigned int i=0; i<count; i++){
+            measurements[i] = (unsigned int)((11100000ull + 203400ull * i) / 120) + (input[first + i] >> 10);
+        }
+        for(unsigned int r=0; r<RATES; r++){
+            for(unsigned int c=0; c<CHANNELS; c++){
+                unsigned int i = tune_closest(measurements, count, 100000, channel_carrier(r, c));
+                tune_t frequency = tune_frequency(100000, measurements[i]);
+                unsigned int periods = tune_periods(frequency, rates[r]);
+                harness_put(out, i);
+                harness_put(out, frequency);
+                harness_put(out, tune_cycles(120000000u, frequency, periods));
+            }
+        }
+    }
+}
+
+static const harness_kernel_t harness_kernels[] = {
+    {"monitor", harness_monitor, 0x06dd2a55},
+    {"counter", harness_counter, 0x34018ba2},
+    {"log2", harness_log2, 0x92a62c2e},
+    {"tuning", harness_tuning, 0x5a520d6a},
+};
+#define HARNESS_KERNELS (sizeof(harness_kernels) / sizeof(harness_kernels[0]))
+
+/**
+ * Run kernel HARNESS_REPEATS times on input, every run has to give the same output
+ */
+inline harness_result_t harness_check(const harness_kernel_t *kernel, const uint16_t *input, unsigned int length,
+        void (*sink)(uint32_t word)){
+    harness_result_t result = {0, 0, true, 0xFFFFFFFF};
+    for(unsigned int r=0; r<HARNESS_REPEATS; r++){
+        harness_t out = {HARNESS_FNV_BASIS, 0, r ? 0 : sink};
+        uint32_t begin = HARNESS_NOW();
+        kernel->run(input, length, &out);
+        uint32_t elapsed = HARNESS_NOW() - begin;
+        if(elapsed < result.best) result.best = elapsed;
+        if(r && out.hash != result.hash) result.exact = false;
+        result.hash = out.hash;
+        result.words = out.words;
+    }
+    if(result.hash != kernel->golden) result.exact = false;
+    return result;
+}
+
+#endif
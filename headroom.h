@@ -0,0 +1,148 @@
+#ifndef HEADROOM_H
+#define HEADROOM_H
+
+#include <stdint.h>
+
+/**
+ * CPU headroom accounting
+ *
+ * While broadcasting, each main loop iteration is one carrier burst, half of
+ * sample (BURSTS in main.cpp): it starts carrier of one burst and in the gap
+ * before the next one picks up audio and runs control work. Cycles of every
+ * iteration are split into stages, whatever is left of burst period (sample
+ * period / BURSTS) is padding (carrier repeats burst when there is some,
+ * negative padding means samples get dropped).
+ *
+ * Stages are summed over windows of HEADROOM_WINDOW bursts. When window
+ * closes, it is kept as `last` (rolling load that telemetry reports) and
+ * its padding decides profile: once it drops under HEADROOM_LOW per mille of
+ * burst period, main loop switches to light profile (less control work
+ * between bursts), and back once it is over HEADROOM_HIGH again. Worst burst
+ * is only reported: carrier periods per burst are truncated, so carrier
+ * leaves gap of less than one carrier period (a few percent) and single
+ * control slice overruns it anyway, following bursts catch up as long as
+ * padding of window stays positive.
+ */
+
+#define HEADROOM_SOURCE 0           /* Picking up sample and modulating it */
+#define HEADROOM_CONTROL 1          /* Control tasks, commands, telemetry, discipline */
+#define HEADROOM_CARRIER 2          /* Transmitting burst */
+#define HEADROOM_OTHER 3            /* Hopping, scan records, bookkeeping */
+#define HEADROOM_STAGES 4
+
+#define HEADROOM_WINDOW 2048        /* Bursts per window */
+#define HEADROOM_LOW 0              /* Per mille of burst period, light profile below */
+#define HEADROOM_HIGH 20            /* Per mille of burst period, full profile above */
+
+struct headroom_window_t {
+    uint64_t stages[HEADROOM_STAGES];   /* Cycles spent in each stage */
+    uint64_t busy;                  /* Cycles of whole iterations */
+    uint32_t bursts;
+    uint32_t worst;                 /* Longest iteration in cycles */
+};
+
+struct headroom_t {
+    uint32_t period;                /* Cycles per burst period */
+    uint32_t pending[HEADROOM_STAGES];  /* Stages of iteration in progress */
+    headroom_window_t current;      /* Window being filled */
+    headroom_window_t last;         /* Last complete window */
+    uint32_t windows;               /* Windows completed */
+    uint32_t fallbacks;             /* Switches to light profile */
+    bool light;                     /* Light profile is in use */
+};
+
+inline void headroom_clear(headroom_window_t *window){
+    for(unsigned int i=0; i<HEADROOM_STAGES; i++){
+        window->stages[i] = 0;
+    }
+    window->busy = 0;
+    window->bursts = 0;
+    window->worst = 0;
+}
+
+/**
+ * Iteration isn't accounted (first one after state or rate change)
+ */
+inline void headroom_skip(headroom_t *headroom){
+    for(unsigned int i=0; i<HEADROOM_STAGES; i++){
+        headroom->pending[i] = 0;
+    }
+}
+
+/**
+ * Start over with new burst period, profile is kept
+ */
+inline void headroom_rate(headroom_t *headroom, uint32_t period){
+    headroom->period = period;
+    headroom_skip(headroom);
+    headroom_clear(&headroom->current);
+    headroom_clear(&headroom->last);
+}
+
+inline void headroom_init(headroom_t *headroom, uint32_t period){
+    headroom->windows = 0;
+    headroom->fallbacks = 0;
+    headroom->light = false;
+    headroom_rate(headroom, period);
+}
+
+/**
+ * Cycles spent in stage during current iteration
+ */
+inline void headroom_stage(headroom_t *headroom, unsigned int stage, uint32_t cycles){
+    headroom->pending[stage] += cycles;
+}
+
+/**
+ * Close iteration of `cycles` in which carrier took `carrier`, rest of it that
+ * no stage claimed is HEADROOM_OTHER. Returns true when window closed
+ */
+inline bool headroom_sample(headroom_t *headroom, uint32_t cycles, uint32_t carrier){
+    headroom_window_t *window = &headroom->current;
+    uint32_t claimed = carrier;
+    headroom->pending[HEADROOM_CARRIER] = carrier;
+    for(unsigned int i=0; i<HEADROOM_STAGES; i++){
+        if(i != HEADROOM_CARRIER && i != HEADROOM_OTHER) claimed += headroom->pending[i];
+    }
+    headroom->pending[HEADROOM_OTHER] = cycles > claimed ? cycles - claimed : 0;
+    for(unsigned int i=0; i<HEADROOM_STAGES; i++){
+        window->stages[i] += headroom->pending[i];
+    }
+    headroom_skip(headroom);
+    window->busy += cycles;
+    if(cycles > window->worst) window->worst = cycles;
+    if(++window->bursts < HEADROOM_WINDOW) return false;
+
+    /* Decide profile by padding, with hysteresis so that it doesn't flap */
+    int64_t available = (int64_t)window->bursts * headroom->period;
+    int32_t padding = (int32_t)((available - (int64_t)window->busy) * 1000 / available);
+    if(!headroom->light && padding < HEADROOM_LOW){
+        headroom->light = true;
+        headroom->fallbacks++;
+    } else if(headroom->light && padding > HEADROOM_HIGH){
+        headroom->light = false;
+    }
+    headroom->last = *window;
+    headroom->windows++;
+    headroom_clear(window);
+    return true;
+}
+
+/**
+ * Share of burst period stage took in window, in per mille
+ */
+inline unsigned int headroom_load(const headroom_t *headroom, const headroom_window_t *window, unsigned int stage){
+    if(!window->bursts) return 0;
+    return window->stages[stage] * 1000 / ((uint64_t)window->bursts * headroom->period);
+}
+
+/**
+ * Share of burst period left as padding in window, in per mille, negative if bursts were late
+ */
+inline int headroom_padding(const headroom_t *headroom, const headroom_window_t *window){
+    if(!window->bursts) return 0;
+    int64_t available = (int64_t)window->bursts * headroom->period;
+    return (int)((available - (int64_t)window->busy) * 1000 / available);
+}
+
+#endif
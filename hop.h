@@ -0,0 +1,112 @@
+#ifndef HOP_H
+#define HOP_H
+
+#include <stdint.h>
+
+/**
+ * Frequency hopping
+ *
+ * Tuning of every channel (BR LX location and periods per sample) is worked
+ * out once, after measurement, and kept in compact cache. Hop is then only
+ * a table lookup and sled_prepare(), carrier switches to new channel with next
+ * sample (see sled.h).
+ *
+ * Channels are visited either in order or in pseudo-random order given by
+ * seed, staying `dwell` carrier bursts on each one (hop_next() is called once
+ * per burst, caller converts from samples or time).
+ */
+
+#define HOP_CHANNELS 128            /* Maximum amount of channels in cache, whole 9 or 10 kHz raster fits */
+
+static_assert(HOP_CHANNELS >= 100 && HOP_CHANNELS <= 256, "Cache has to hold band plans of 100+ channels, sequence holds 8-bit channels");
+
+struct tuning_t {
+    uint8_t index;                  /* BR LX location */
+    uint16_t periods;               /* Periods per sample */
+};
+
+struct hop_t {
+    tuning_t cache[HOP_CHANNELS];   /* Tuning of each channel */
+    uint8_t sequence[HOP_CHANNELS]; /* Order channels are visited in */
+    unsigned int channels;          /* Amount of channels in cache */
+    unsigned int position;          /* Current position in sequence */
+    unsigned int dwell;             /* Bursts per hop, 0 if we are not hopping */
+    unsigned int remaining;         /* Bursts left until next hop */
+    unsigned int hops;              /* Hops done so far */
+    uint32_t latency;               /* Worst cycles from hop decision to first carrier edge on new channel */
+    unsigned int settle;            /* Worst bursts until burst length matched new channel */
+};
+
+inline void hop_init(hop_t *hop){
+    hop->channels = 0;
+    hop->position = 0;
+    hop->dwell = 0;
+    hop->remaining = 0;
+    hop->hops = 0;
+    hop->latency = 0;
+    hop->settle = 0;
+}
+
+/**
+ * Store tuning of next channel
+ */
+inline void hop_add(hop_t *hop, unsigned int index, unsigned int periods){
+    if(hop->channels == HOP_CHANNELS) return;
+    hop->cache[hop->channels].index = index;
+    hop->cache[hop->channels].periods = periods;
+    hop->sequence[hop->channels] = hop->channels;
+    hop->channels++;
+}
+
+/**
+ * Order channels are visited in, seed 0 visits them in order,
+ * anything else shuffles them (same seed gives same sequence on all boards)
+ */
+inline void hop_order(hop_t *hop, uint32_t seed){
+    for(unsigned int i=0; i<hop->channels; i++){
+        hop->sequence[i] = i;
+    }
+    for(unsigned int i=hop->channels; seed && i>1; i--){
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        unsigned int j = seed % i;
+        uint8_t swap = hop->sequence[i - 1];
+        hop->sequence[i - 1] = hop->sequence[j];
+        hop->sequence[j] = swap;
+    }
+    hop->position = 0;
+}
+
+/**
+ * Start hopping every `dwell` bursts, 0 stops hopping
+ */
+inline void hop_start(hop_t *hop, unsigned int dwell){
+    hop->dwell = dwell;
+    hop->remaining = 0;
+}
+
+/**
+ * Count one sample, returns tuning to switch to if it's time to hop, 0 otherwise
+ */
+inline const tuning_t *hop_next(hop_t *hop){
+    if(!hop->dwell || !hop->channels) return 0;
+    if(hop->remaining){
+        hop->remaining--;
+        return 0;
+    }
+    hop->remaining = hop->dwell - 1;
+    const tuning_t *tuning = &hop->cache[hop->sequence[hop->position]];
+    if(++hop->position == hop->channels) hop->position = 0;
+    hop->hops++;
+    return tuning;
+}
+
+/**
+ * Channel we are on (or are switching to)
+ */
+inline unsigned int hop_channel(const hop_t *hop){
+    return hop->sequence[(hop->position + hop->channels - 1) % hop->channels];
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef JITTER_H
+#define JITTER_H
+
+#include <stdint.h>
+
+/**
+ * Sample length jitter histogram
+ *
+ * Every sample transmits the same amount of periods, so without preemption
+ * all samples take the same amount of cycles. We take shortest sample seen since
+ * last retune as reference and count how much longer each sample took,
+ * in power of two bins: 0, 1, 2-3, 4-7, ... cycles, last bin takes everything longer.
+ */
+
+#define JITTER_BINS 12
+
+struct jitter_t {
+    uint32_t bins[JITTER_BINS];     /* Samples per bin */
+    uint32_t base;                  /* Shortest sample since retune */
+    uint32_t samples;               /* Samples counted */
+    uint32_t worst;                 /* Longest stretch in cycles */
+};
+
+inline void jitter_init(jitter_t *jitter){
+    for(unsigned int i=0; i<JITTER_BINS; i++){
+        jitter->bins[i] = 0;
+    }
+    jitter->base = 0xFFFFFFFF;
+    jitter->samples = 0;
+    jitter->worst = 0;
+}
+
+/**
+ * Sample length changed, find new reference
+ */
+inline void jitter_rebase(jitter_t *jitter){
+    jitter->base = 0xFFFFFFFF;
+}
+
+/**
+ * Count sample that took given amount of cycles
+ */
+inline void jitter_add(jitter_t *jitter, uint32_t cycles){
+    if(cycles < jitter->base) jitter->base = cycles;
+    uint32_t stretch = cycles - jitter->base;
+    unsigned int bin = 0;
+    while(stretch >> bin && bin < JITTER_BINS - 1) bin++;
+    jitter->bins[bin]++;
+    jitter->samples++;
+    if(stretch > jitter->worst) jitter->worst = stretch;
+}
+
+#endif
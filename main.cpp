@@ -1,6 +1,6 @@
 #include "mbed.h"
 
-Serial PC(USBTX,USBRX);
+UARTSerial PC(USBTX,USBRX,115200);   /* Buffered and interrupt driven, so that printing doesn't stall carrier */
 
 DigitalOut red(LED_RED);
 DigitalOut green(LED_GREEN);
@@ -8,22 +8,474 @@ DigitalOut blue(LED_BLUE);
 
 AnalogOut dac(DAC0_OUT);
 
-/* Execute code at given address */
-#define exec(op) ((void(*)()) ((uintptr_t) op | 1))()
+/* Execute code at given address, host simulation provides its own */
+#ifndef exec
+#define exec(op) ((void(*)()) ((uintptr_t) (op) | 1))()
+#endif
+
+/* Carrier loop policies, see carrier.h */
+#define CARRIER_DAC(value) dac.write_u16(value)
+#define CARRIER_EXEC(op) exec(op)
+#define CARRIER_CYCLES() DWT->CYCCNT
+#define CARRIER_MASK() __disable_irq()
+#define CARRIER_UNMASK() __enable_irq()
+#include "carrier.h"
+#define WAVEFORM SQUARE     /* Waveform we start with, can be changed from console */
+
+/* Hooks for event loop, see events.h (cycle counter stops in WFI, so we account in microseconds) */
+#include "us_ticker_api.h"
+#define EVENTS_NOW() us_ticker_read()
+#define EVENTS_SLEEP() __WFI()
+#define EVENTS_LOCK() __disable_irq()
+#define EVENTS_UNLOCK() __enable_irq()
+#include "events.h"
+/* Profiler, see profile.h, set PROFILE to 0 (here or with -DPROFILE=0) to remove all probes */
+#ifndef PROFILE
+#define PROFILE 1
+#endif
+#define PROFILE_CYCLES() DWT->CYCCNT
+#include "profile.h"
+#include "sampling.h"
+#include "console.h"
+#include "sled.h"
+#include "hop.h"
+#include "tuning.h"
+#include "channels.h"
+#include "scan.h"
+#include "jitter.h"
+#include "counter_port.h"
+#include "monitor_port.h"
+#include "telemetry.h"
+#include "headroom.h"
+#define TRACE_NOW() us_ticker_read()
+#include "trace.h"
+#define SCHED_CYCLES() DWT->CYCCNT
+#include "sched.h"
+
+#define FREE_RUNNING 0      /* Carrier runs from our own crystal */
+#define PPS 1               /* Carrier is disciplined to external 1PPS signal on D6 */
+#define PTP 2               /* Carrier is disciplined to IEEE 1588 grandmaster over ethernet */
+#ifndef DISCIPLINE
+#define DISCIPLINE FREE_RUNNING
+#endif
 
-#define SINE 0
-#define SQUARE 1
-#define WAVEFORM SQUARE
+#if DISCIPLINE == PPS
+#include "pll.h"
+#include "pps.h"
+#elif DISCIPLINE == PTP
+#include "pll.h"
+#include "ptp_port.h"
+#endif
 
-#define MAX_OPCODES 80      /* Maximum length of instructions buffer */
 #define LED_ON 0
 #define LED_OFF 1
 
+#define MEASURE_PERIODS 100000  /* Periods per measurement of each BR LX location */
+#define TEST_PERIODS 250000     /* Periods per final measurement */
+#define SCHED_BUDGET 600        /* Cycles control tasks may take between samples */
+#define SCHED_LIGHT_BUDGET 200  /* Same in light profile, when headroom runs low */
+#define TONE_BITS 6             /* Test tone table has 2^TONE_BITS entries */
+#define TONE_LENGTH (1 << TONE_BITS)
+#define TONE_FREQUENCY 1000     /* Test tone frequency in Hz */
+#define COUNTER_SLICE 16        /* Captures counter task goes through per slice */
+#define TELEMETRY_CHUNK 16      /* Bytes telemetry task hands to serial port per slice */
+#define CLIP_LEVEL 32767        /* Audio input farther than this from midpoint is clipped */
+#define TRIM_TRACE_STEP 20      /* Change of oscillator correction in ppb worth tracing */
+#define MEASURED_LINE 12        /* Measurements printed per `measured` command */
+#define SAY_LENGTH 320          /* Longest line of console output, with newline */
+#define BURSTS 2                /* Carrier bursts per audio sample, each is half of sample long (see tune_periods()) */
+
+#define STANDBY 3
 #define MEASURING 2
 #define TESTING 1
 #define BROADCASTING 0
 
-static uint16_t opcodes[MAX_OPCODES];   /* Instructions buffer */
+static sled_t sled;                     /* Instructions buffers */
+static hop_t hop;                       /* Tuning cache and hopping schedule */
+static scan_t scan;                     /* Channel we are dwelling on during scan */
+static jitter_t jitter[2];              /* Sample length histograms, without and with realtime mode */
+static sched_t sched;                   /* Control tasks */
+static task_t console_task, drift_task, counter_task, telemetry_task, report_task, trace_task, monitor_task, profile_task;
+static counter_t counter;               /* Carrier frequency counter */
+static bool counting = false;           /* Counter captures carrier edges */
+static telemetry_t telemetry;           /* Frames, text and scan records waiting for serial port */
+static headroom_t headroom;             /* Where cycles of each sample go, decides profile */
+static monitor_t monitor;               /* Transmitted envelope against audio */
+static bool monitoring = false;         /* Main loop records audio for monitor */
+static bool report_ready = false;       /* Main loop should take snapshot for status frame */
+static uint32_t level_peak = 0;         /* Audio peak since last status frame */
+static uint32_t level_sum = 0;          /* Audio absolute level sum since last status frame */
+static uint32_t level_count = 0;
+static trace_t trace __attribute__((section(".uninitialized")));   /* Not cleared on reset, see trace.h */
+static bool tracing = false;            /* Trace is being sent */
+static uint32_t trace_from;             /* Oldest entry when sending started */
+static unsigned int trace_sent, trace_total;
+#if PROFILE
+static bool profiling = false;          /* Profile is being printed */
+#endif
+static console_t console;               /* Command being received */
+static command_t command;               /* Command to be applied */
+static bool command_ready = false;      /* Command waits for main loop to apply it */
+static bool serial = false;             /* Serial port may have more data for us */
+static uint32_t bursts = 0;             /* Carrier bursts so far, BURSTS per sample */
+static uint32_t sequence = 0;           /* Seed of hop order given by `sequence` command */
+static int32_t drift = 0;               /* Samples broadcast minus samples taken during last second */
+static unsigned int waveform = WAVEFORM;    /* Current waveform */
+static uint16_t tone[TONE_LENGTH];          /* One period of test tone */
+static const char *sources[] = {"adc", "tone", "silence"};  /* Audio source names, indexed by SOURCE_* */
+
+struct load_t {
+    uint64_t carrier;           /* Cycles spent transmitting */
+    uint64_t total;             /* Cycles of whole main loop iterations */
+    uint32_t bursts;            /* Bursts accounted, BURSTS per sample */
+};
+static load_t load[RATES];      /* Where cycles go at each sample rate */
+
+#define REPORT_STATUS 0x01      /* Snapshot waits to be packed into status frame */
+#define REPORT_HEADROOM 0x02    /* Same for headroom frame */
+
+/**
+ * Raw values of status and headroom frames, main loop only copies them
+ * between bursts (it owns most of them), telemetry task does the division and packing
+ */
+struct report_t {
+    uint32_t time;              /* us */
+    uint8_t state, source, flags;
+    unsigned int depth;         /* 0-256 */
+    tune_t frequency;           /* Carrier */
+    uint64_t ticks, periods;    /* Frequency counter totals, ticks are 0 if it didn't measure anything */
+    uint32_t bursts;
+    int32_t drift;
+    unsigned int rate, sample_rate;
+    load_t load;                /* Load counters of current rate */
+    uint32_t peak, level_sum, level_count;
+    headroom_t headroom;        /* Its last complete window goes into headroom frame */
+};
+static report_t report;
+static unsigned int report_pending = 0; /* REPORT_* frames still to be packed from snapshot */
+
+/**
+ * Print message without blocking
+ * Lines are queued whole into telemetry ring and telemetry task sends them,
+ * line that doesn't fit is dropped (and counted), never cut
+ */
+void say(const char *format, ...){
+    char buffer[SAY_LENGTH];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if(length <= 0) return;
+    if(length >= (int)sizeof(buffer)){
+        /* Longer than any reply should be, still ends with newline */
+        length = sizeof(buffer) - 1;
+        buffer[length - 1] = '\n';
+    }
+    telemetry_write(&telemetry, buffer, length);
+}
+
+/**
+ * Print jitter histogram
+ */
+void say_jitter(const char *name, const jitter_t *jitter){
+    char bins[JITTER_BINS * 11 + 1];
+    unsigned int length = 0;
+    for(unsigned int i=0; i<JITTER_BINS; i++){
+        length += snprintf(bins + length, sizeof(bins) - length, i ? ",%u" : "%u", (unsigned int)jitter->bins[i]);
+    }
+    say("Jitter %s: samples=%u, worst=%u cycles, bins=%s\n", name, (unsigned int)jitter->samples, (unsigned int)jitter->worst, bins);
+}
+
+/**
+ * Print what frequency counter measured since last time and start over
+ * Frequencies are shifted by `offset` Hz, same way as channels are
+ */
+void say_counter(tune_t expected, unsigned int offset){
+    const counter_stats_t *total = &counter.total;
+    if(!counter.batches){
+        say("Carrier: nothing measured, rejected=%u batches\n", (unsigned int)counter.rejected);
+        return;
+    }
+    uint64_t measured = counter_frequency(&counter, counter_clock) + offset * 1000ull;
+    say("Carrier: expected=%d, measured=%u.%03u Hz, periods=%u, gaps=%u, batches=%u, rejected=%u, period=%u-%u ticks\n",
+        tune_hz(expected + TUNE_HZ(offset)), (unsigned int)(measured / 1000), (unsigned int)(measured % 1000), (unsigned int)total->periods,
+        (unsigned int)total->gaps, (unsigned int)counter.batches, (unsigned int)counter.rejected, (unsigned int)total->min, (unsigned int)total->max);
+
+    char text[COUNTER_LOG * 12 + 1];
+    unsigned int length = 0;
+    for(unsigned int i=0; i<COUNTER_BINS; i++){
+        length += snprintf(text + length, sizeof(text) - length, i ? ",%u" : "%u", (unsigned int)total->bins[i]);
+    }
+    say("Carrier jitter: %d..%d ticks from mean, bins=%s\n", -COUNTER_SPAN, COUNTER_SPAN, text);
+
+    /* Drift log relative to its oldest entry */
+    unsigned int logged = counter.logged < COUNTER_LOG ? counter.logged : COUNTER_LOG;
+    if(logged){
+        uint32_t base = counter_logged(&counter, 0);
+        length = 0;
+        for(unsigned int i=0; i<logged; i++){
+            length += snprintf(text + length, sizeof(text) - length, i ? ",%d" : "%d", (int)(counter_logged(&counter, i) - base));
+        }
+        say("Carrier drift: base=%u.%03u Hz, mHz=%s\n", (unsigned int)(base / 1000 + offset), (unsigned int)(base % 1000), text);
+    }
+    counter_reset(&counter);
+}
+
+/**
+ * Serial port has something for us, called from serial interrupt
+ */
+void serial_isr(){
+    events_post(&events, EVENT_SERIAL);
+}
+
+/**
+ * Console task, reads few characters per slice and parses them
+ * Completed command is left for main loop, which applies it at sample boundary
+ */
+unsigned int console_run(task_t *task){
+    static char received[CONSOLE_BUDGET];
+    static ssize_t count, i;
+    TASK_BEGIN(task);
+    while(true){
+        TASK_WAIT(task, serial);
+        count = PC.read(received, CONSOLE_BUDGET);
+        serial = count == CONSOLE_BUDGET;   /* There might be more */
+        for(i=0; i<count; i++){
+            if(console_feed(&console, received[i], &command)){
+                command_ready = true;
+                TASK_WAIT(task, !command_ready);
+            }
+        }
+        TASK_YIELD(task);
+    }
+    TASK_END(task);
+}
+
+/**
+ * Drift task, once per second compares samples broadcast with samples taken by ADC
+ * Positive drift means carrier loop is faster than sample rate and repeats samples
+ */
+unsigned int drift_run(task_t *task){
+    static uint32_t last_bursts = 0, last_samples = 0;
+    uint32_t taken = samples_head;
+    static int32_t last_drift = 0;
+    uint32_t broadcast = (bursts - last_bursts) / BURSTS;
+    drift = (int32_t)(broadcast - (taken - last_samples));
+    last_bursts += broadcast * BURSTS;      /* Odd burst counts next second */
+    last_samples = taken;
+    if(drift > 0 && last_drift <= 0) trace_log(&trace, TRACE_UNDERRUN, drift);
+    if(drift < 0 && last_drift >= 0) trace_log(&trace, TRACE_OVERRUN, drift);
+    last_drift = drift;
+    counter_log(&counter, counter_clock);   /* Carrier frequency drift, once per second too */
+    return TASK_DONE;
+}
+
+/**
+ * Counter task, captures batch of carrier edges once per period
+ * and goes through captures COUNTER_SLICE at a time, light profile skips batches
+ */
+unsigned int counter_run(task_t *task){
+    static unsigned int i;
+    TASK_BEGIN(task);
+    if(counting && !headroom.light){
+        counter_arm();
+        TASK_WAIT(task, counter_done() || !counting);
+        if(counting){
+            counter_begin(&counter);
+            for(i=0; i<COUNTER_EDGES; i++){
+                counter_edge(&counter, counter_captures[i]);
+                if(i % COUNTER_SLICE == COUNTER_SLICE - 1) TASK_YIELD(task);
+            }
+            counter_end(&counter);
+        }
+    }
+    TASK_END(task);
+}
+
+/**
+ * Report task, once per period asks main loop for snapshot of status (values it needs live there)
+ * Period is set by `telemetry` command, with period 0 task has nothing to do
+ */
+unsigned int report_run(task_t *task){
+    if(!task->period) return TASK_IDLE;
+    report_ready = true;
+    return TASK_DONE;
+}
+
+/**
+ * Pack status frame from snapshot
+ * Sequence counts status frames only, so that gap means lost status frame
+ */
+void report_status(const report_t *snapshot){
+    static uint32_t statuses = 0;
+    static load_t reported;         /* Load counters at previous frame */
+    static unsigned int reported_rate = RATES;
+    telemetry_status_t status;
+    status.sequence = statuses++;
+    status.time = snapshot->time / 1000;
+    status.state = snapshot->state;
+    status.source = snapshot->source;
+    status.depth = snapshot->depth * 100 / 256;
+    status.flags = snapshot->flags;
+    status.channel = tune_hz(snapshot->frequency + TUNE_HZ(snapshot->sample_rate / 2));
+    status.measured = snapshot->ticks ? (uint32_t)(counter_millihertz(snapshot->ticks, snapshot->periods, counter_clock) / 1000)
+        + snapshot->sample_rate / 2 : 0;
+    status.bursts = snapshot->bursts / BURSTS;
+    status.drift = snapshot->drift;
+    status.carrier_load = status.total_load = 0;
+    if(reported_rate == snapshot->rate && snapshot->load.bursts > reported.bursts){
+        uint64_t available = (uint64_t)(snapshot->load.bursts - reported.bursts) * (SystemCoreClock / snapshot->sample_rate / BURSTS);
+        status.carrier_load = (snapshot->load.carrier - reported.carrier) * 1000 / available;
+        status.total_load = (snapshot->load.total - reported.total) * 1000 / available;
+    }
+    reported = snapshot->load;
+    reported_rate = snapshot->rate;
+    status.peak = snapshot->peak;
+    status.level = snapshot->level_count ? snapshot->level_sum / snapshot->level_count : 0;
+    status.sample_rate = snapshot->sample_rate;
+    telemetry_status(&telemetry, &status);
+}
+
+/**
+ * Pack headroom frame from snapshot
+ */
+void report_headroom(const report_t *snapshot){
+    const headroom_t *taken = &snapshot->headroom;
+    telemetry_headroom_t frame;
+    frame.window = taken->windows;
+    frame.period = taken->period;
+    frame.worst = taken->last.worst;
+    frame.sample_rate = snapshot->sample_rate;
+    for(unsigned int i=0; i<HEADROOM_STAGES; i++){
+        frame.stages[i] = headroom_load(taken, &taken->last, i);
+    }
+    frame.padding = headroom_padding(taken, &taken->last);
+    frame.flags = taken->light ? TELEMETRY_LIGHT : 0;
+    frame.fallbacks = taken->fallbacks < 255 ? taken->fallbacks : 255;
+    telemetry_headroom(&telemetry, &frame);
+}
+
+/**
+ * Telemetry task, hands frames, text and scan records to serial port TELEMETRY_CHUNK bytes at a time
+ * It's the only writer of serial port, so that nothing gets into middle of frame
+ * Serial port takes what fits into its transmit buffer, rest stays in ring
+ */
+unsigned int telemetry_run(task_t *task){
+    /* Snapshot main loop took, one frame per slice */
+    if(report_pending & REPORT_STATUS){
+        report_status(&report);
+        report_pending &= ~REPORT_STATUS;
+        return TASK_BUSY;
+    }
+    if(report_pending & REPORT_HEADROOM){
+        report_headroom(&report);
+        report_pending &= ~REPORT_HEADROOM;
+        return TASK_BUSY;
+    }
+    const uint8_t *data;
+    unsigned int count = telemetry_peek(&telemetry, &data);
+    if(!count) return TASK_IDLE;
+    if(count > TELEMETRY_CHUNK) count = TELEMETRY_CHUNK;
+    ssize_t written = PC.write(data, count);
+    if(written <= 0) return TASK_IDLE;
+    telemetry_consume(&telemetry, written);
+    return TASK_BUSY;
+}
+
+/**
+ * Trace task, queues trace as telemetry frames, one whenever there's room for it
+ */
+unsigned int trace_run(task_t *task){
+    uint8_t payload[TRACE_HEADER + TRACE_FRAME_ENTRIES * TRACE_ENTRY];
+    if(!tracing || telemetry_free(&telemetry) < sizeof(payload) + TELEMETRY_OVERHEAD) return TASK_IDLE;
+    unsigned int length = trace_encode(&trace, trace_from, trace_sent, trace_total, payload);
+    telemetry_frame(&telemetry, TELEMETRY_TRACE, payload, length);
+    trace_sent += (length - TRACE_HEADER) / TRACE_ENTRY;
+    if(trace_sent < trace_total) return TASK_BUSY;
+    tracing = false;
+    return TASK_DONE;
+}
+
+/**
+ * Profile task, prints probes that were hit one per line, whenever there's room
+ * for the line in telemetry ring, and starts each probe over once it's taken.
+ * Whole line in one vsnprintf() would take several SCHED_BUDGETs, so it's put
+ * together one or two numbers per slice.
+ */
+unsigned int profile_run(task_t *task){
+#if PROFILE
+    static unsigned int probe, bin, used, length;
+    static profile_t taken;             /* Copy of probe, so that probe can start over while we print */
+    static char line[SAY_LENGTH];
+    if(!profiling) return TASK_IDLE;
+    TASK_BEGIN(task);
+    for(probe=0; probe<PROFILE_PROBES; probe++){
+        if(!profiles[probe].count) continue;
+        TASK_WAIT(task, telemetry_free(&telemetry) >= SAY_LENGTH);
+        taken = profiles[probe];
+        profile_reset(&profiles[probe]);
+        TASK_YIELD(task);
+        length = snprintf(line, sizeof(line), "Profile %s: n=%u, ", profile_names[probe], (unsigned int)taken.count);
+        TASK_YIELD(task);
+        length += snprintf(line + length, sizeof(line) - length, "min=%u, mean=%u, ",
+            (unsigned int)taken.min, (unsigned int)(taken.sum / taken.count));
+        TASK_YIELD(task);
+        length += snprintf(line + length, sizeof(line) - length, "max=%u, bins=", (unsigned int)taken.max);
+        used = PROFILE_BINS;
+        while(used > 1 && !taken.bins[used - 1]) used--;
+        for(bin=0; bin<used; bin++){
+            TASK_YIELD(task);
+            length += snprintf(line + length, sizeof(line) - length, bin ? ",%u" : "%u", (unsigned int)taken.bins[bin]);
+        }
+        line[length++] = '\n';     /* Longest line is well under SAY_LENGTH */
+        telemetry_write(&telemetry, line, length);
+        TASK_YIELD(task);
+    }
+    profile_calibrate();        /* Cost of probe was printed too */
+    profiling = false;
+    TASK_END(task);
+#else
+    return TASK_IDLE;
+#endif
+}
+
+/**
+ * Monitor task, captures window of envelope once per period and compares it with
+ * audio main loop sent meanwhile, MONITOR_SLICE samples or one lag per slice
+ * Period is set by `monitor` command, light profile skips windows
+ */
+unsigned int monitor_run(task_t *task){
+    static unsigned int i;
+    static int lag;
+    static uint32_t started;
+    if(!task->period && !task->line) return TASK_IDLE;
+    TASK_BEGIN(task);
+    if(!headroom.light){
+        monitor_begin(&monitor);
+        started = bursts;
+        monitor_arm();
+        monitoring = true;
+        TASK_WAIT(task, (monitor_done() && monitor.recorded == MONITOR_BLOCK) || !task->period);
+        monitoring = false;
+        /* Window only counts if carrier was broadcasting all along */
+        if(task->period && bursts - started >= (MONITOR_BLOCK - MONITOR_LAG) * BURSTS){
+            for(i=0; i<MONITOR_BLOCK; i+=MONITOR_SLICE){
+                monitor_block(&monitor, monitor_envelope, i, MONITOR_SLICE);
+                TASK_YIELD(task);
+            }
+            for(lag=-MONITOR_LAG; lag<=MONITOR_LAG; lag++){
+                monitor_fit(&monitor, lag);
+                TASK_YIELD(task);
+            }
+            monitor_end(&monitor);
+            const monitor_result_t *result = &monitor.last;
+            telemetry_monitor_t frame = {monitor.windows, result->depth, result->events, result->distortion, result->level,
+                result->min, result->max, result->lag, (uint8_t)(result->flags & MONITOR_QUIET_FLAG ? TELEMETRY_QUIET : 0)};
+            telemetry_monitor(&telemetry, &frame);
+        } else monitor_stop();
+    }
+    TASK_END(task);
+}
 
 /**
  * Initialize ADC
@@ -35,35 +487,42 @@ inline void init_adc(){
 }
 
 /**
- * Transmit single period
+ * Transmit one sample with current waveform, interrupts aren't masked
  */
-inline void transmit(const int value){
-#if WAVEFORM == SINE
-    dac.write_u16(0);
-    exec(opcodes);
-    dac.write_u16(value >> 1);
-    exec(opcodes);
-    dac.write_u16(value);
-    exec(opcodes);
-    dac.write_u16(value >> 1);
-    exec(opcodes);
-#else
-    dac.write_u16(value);
-    exec(opcodes);
-    dac.write_u16(0);
-    exec(opcodes);
-#endif
+inline void transmit(sled_t *sled, const int value){
+    carrier_select(waveform, false)(sled, value);
+}
+
+/**
+ * Find BR LX location whose measured frequency is closest to given one
+ */
+inline unsigned int closest(const unsigned int *measurements, unsigned int count, tune_t frequency){
+    return tune_closest(measurements, count, MEASURE_PERIODS, frequency);
+}
+
+/**
+ * Work out tuning of every channel, so that hopping is only a table lookup
+ */
+inline void build_cache(const unsigned int *measurements, unsigned int count, unsigned int rate, unsigned int sample_rate){
+    hop_init(&hop);
+    for(unsigned int j=0; j<CHANNELS; j++){
+        unsigned int i = closest(measurements, count, channel_carrier(rate, j));
+        hop_add(&hop, i, tune_periods(tune_frequency(MEASURE_PERIODS, measurements[i]), sample_rate));
+    }
+    hop_order(&hop, sequence);
 }
 
 int main(){
     Timer timer;    /* We will use this to measure time in microseconds */
     timer.start();  /* Start measuring now */
-    PC.baud(115200);    /* Set-up serial port */
+    PC.set_blocking(false); /* Set-up serial port, we never wait for it */
+    PC.sigio(serial_isr);
+    trace_init(&trace, RCM->SRS1 << 8 | RCM->SRS0);    /* Keeps what happened before warm reset */
 
-    /* Initialize our instructions array to be all NOPs */
-    for(int i=0; i<MAX_OPCODES;i++){ 
-        opcodes[i] = 0xBF00;    
-    }
+    /* Cycle counter, used to measure how long console handling takes */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 
     /**
      * In order to perform sleep in nanoseconds, we cannot use for loop.
@@ -77,80 +536,459 @@ int main(){
     
     unsigned int
         index = 0,              /* Our pointer to where BR LX is currently located at */
-        read_state = 0,         /* ADC state, 0 = begin read, 1 = reading step 1, 2 = reading step 2, 3 = read finished */
         ready_state = MEASURING,/* Ready state */
-        periods = 100000,       /* Amount of periods per one sample */
-        adc_value = 0,          /* Last read ADC value (16-bit integer) */
-        sample_rate = 22050,     /* Sample rate */
+        periods = MEASURE_PERIODS, /* Amount of periods per one sample */
+        adc_value = 0,          /* Last broadcast value (16-bit integer) */
+        source = SOURCE_ADC,    /* Where audio comes from */
+        depth = 256,            /* Modulation index, 256 = 100% */
+        tone_phase = 0,         /* Test tone phase accumulator */
+        tone_step = 0,          /* Test tone phase increment per sample */
+        console_worst = 0,      /* Longest command handling in cycles */
+        hop_expected = 0,       /* Expected cycles per burst on channel we hopped to */
+        hop_settling = 0,       /* Bursts since hop that didn't match expected length yet */
+        sample_rate = 22050,    /* Sample rate */
+        rate = 3,               /* Index of sample rate in rates[] */
+        last_start = 0,         /* When previous sample started (cycles) */
+        last_burst = 0,         /* How long previous sample took (cycles) */
         start = 0,              /* Start time of measurement */
+        active = 0,             /* Instructions buffer sample started with */
         end = 0,                /* End time of measurement */
         best_index = 0,         /* Best pointer yet found */
-        best_frequency = 0;     /* Best frequency we are able to match yet */
+        best_frequency = 0,     /* Best frequency we are able to match yet */
+        clipped = 0;            /* Length of clipping burst so far */
 
-    opcodes[index] = 0x4770;    /* Set initial BR LX */
+    sled_init(&sled, index, periods);   /* Both buffers all NOPs, BR LX at initial location */
 
-    float desired = 558000.0f,  /* Desired frequency */
-          best_diff = desired,  /* Best delta we've found yet ( |Measured - Desired| ) */
-          freq = 0.0f,          /* Current broadcast frequency */
-          diff = 0.0f;          /* Current delta */
+    tune_t desired = TUNE_HZ(558000),   /* Desired frequency */
+           best_diff = desired,         /* Best delta we've found yet ( |Measured - Desired| ) */
+           freq = 0,                    /* Current broadcast frequency */
+           diff = 0;                    /* Current delta */
     unsigned int measure_limit = MAX_OPCODES - 1;    /* Pointer limit, in order to not waste time on values like 5000 (takes 20s to test) */
 
-    /**
-     * List of frequencies we will try to match 
-     * 
-     * I just listed stuff that my radio at home is able to handle :D
-     * Nothing special about these numbers, you can change them to anything else
-     */
-    float frequencies[] = {
-        531000, 540000, 549000, 558000, 567000, 576000, 585000, 594000, 
-        603000, 612000, 621000, 630000, 639000, 648000, 651000, 666000, 
-        675000, 684000, 693000, 702000, 711000, 720000, 729000, 738000, 
-        747000, 756000, 765000, 774000, 783000, 792000, 801000, 810000, 
-        819000, 828000, 837000, 846000, 855000, 864000, 873000, 882000, 
-        891000, 900000, 909000, 918000, 927000, 936000, 945000, 954000, 
-        963000, 972000, 981000, 981000, 989000, 990000, 999000, 1008000, 
-        1017000, 1026000, 1035000, 1044000, 1053000, 1062000, 1071000, 1080000,
-        1089000, 1098000, 1107000, 1115000, 1116000, 1125000, 1134000, 1143000,
-        1152000, 1161000, 1170000, 1179000, 1188000, 1197000, 1206000, 1215000,
-    };
-
-    unsigned int frequencies_n = sizeof(frequencies) / sizeof(float);
-
-    /* Since we are broadcasting in USB mode, we need to shift left by SampleRate / 2 */
-    /* also to speed up computation, we can convert it to periods in us */
-    for(unsigned int i = 0; i < frequencies_n; i++){
-        frequencies[i] -= sample_rate / 2.0f;
+    /* Test tone, one period sampled TONE_LENGTH times */
+    for(unsigned int i=0; i<TONE_LENGTH; i++){
+        tone[i] = (uint16_t)(32768 + 32767 * sinf(2.0f * 3.14159265f * i / TONE_LENGTH));
     }
+    tone_step = (unsigned int)(TONE_FREQUENCY * 4294967296.0 / sample_rate);
+
+    bool settling = false;      /* We are waiting for sample length to settle after hop */
+    bool scanning = false;      /* Hops are channel scan */
+    bool realtime = false;      /* Interrupts are masked while carrier is running */
+    carrier_t transmitter = carrier_select(waveform, realtime);    /* Carrier loop used for broadcasting */
+    bool loading = false;       /* Previous main loop iteration was broadcasting at current rate */
+    bool light = false;         /* Profile last written to trace */
+    unsigned int scan_source = SOURCE_ADC;  /* Source to return to after scan */
+    unsigned int scan_index = 0, scan_periods = 0;  /* Tuning to return to after scan */
+    bool scan_return = false;   /* Scan wasn't stopped by retune, so carrier goes back to scan_index */
+    console_init(&console);
+    sched_init(&sched);
+    sched_add(&sched, &console_task, "console", console_run, 0, 300, us_ticker_read());
+    sched_add(&sched, &drift_task, "drift", drift_run, 1000000, 200, us_ticker_read());
+    sched_add(&sched, &counter_task, "counter", counter_run, 100000, 300, us_ticker_read());
+    sched_add(&sched, &telemetry_task, "telemetry", telemetry_run, 0, 300, us_ticker_read());
+    sched_add(&sched, &report_task, "report", report_run, 0, 50, us_ticker_read());
+    sched_add(&sched, &trace_task, "trace", trace_run, 0, 300, us_ticker_read());
+    sched_add(&sched, &monitor_task, "monitor", monitor_run, 0, 400, us_ticker_read());
+    sched_add(&sched, &profile_task, "profile", profile_run, 0, 400, us_ticker_read());
+    hop_init(&hop);
+    jitter_init(&jitter[0]);
+    jitter_init(&jitter[1]);
+    counter_init(&counter);
+    telemetry_init(&telemetry);
+    headroom_init(&headroom, SystemCoreClock / sample_rate / BURSTS);
+    monitor_init(&monitor);
+    profile_init();
+    profile_calibrate();
+
+    events_init(&events, ready_state);  /* Start accounting idle time */
 
     init_adc(); /* Initialize ADC */
+    init_sampling(sample_rate); /* Start sampling audio input */
+    init_counter(); /* Comparator and capture, idle until `counter 1` */
+    init_monitor(); /* Envelope on ADC1, idle until `monitor <ms>` */
+
+#if DISCIPLINE != FREE_RUNNING
+    steer_t steer = {0, 0, 0, 0};   /* Locations carrier alternates between, see pll.h */
+    tune_t target = desired;    /* Carrier steered to, true frequency */
+    tune_t scan_target = 0;     /* Carrier steered to before scan */
+    int32_t ppb = 0;            /* Oscillator error from PLL or PTP servo */
+    int32_t traced_ppb = 0;     /* Correction last written to trace */
+    bool steered = false;       /* Sled switch of this burst is steering, not retune */
+#endif
+#if DISCIPLINE == PPS
+    pll_t pll;                  /* PLL locking us to PPS */
+    uint32_t stamp = 0;         /* Last PPS timestamp */
+    pll_init(&pll, CLOCK_GetBusClkFreq());
+    init_pps();
+#elif DISCIPLINE == PTP
+    ptp_servo_t servo;          /* Servo locking us to grandmaster */
+    init_ptp();
+    ptp_init(&servo, ptp_identity);
+#endif
 
     /* Switch measuring state signalisation (red LED) */
     red = LED_ON, green = LED_OFF, blue = LED_OFF;
 
     while(true){
+        PROFILE_START(loop);
+        uint32_t begun = DWT->CYCCNT;   /* Stages of iteration for headroom */
+        uint32_t pending = events_take(&events);
+
+        /* Pick up latest sample, if there is new one, and apply modulation index to it */
+        if(pending & EVENT_SAMPLE){
+            PROFILE_START(stamp);
+            int sample = 32768;
+            if(source == SOURCE_ADC){
+                sample = sampling_latest();
+                if(sample > 32768 + CLIP_LEVEL - 1 || sample < 32768 - CLIP_LEVEL) clipped++;
+                else if(clipped){
+                    trace_log(&trace, TRACE_CLIP, clipped);
+                    clipped = 0;
+                }
+            } else if(source == SOURCE_TONE){
+                sample = tone[tone_phase >> (32 - TONE_BITS)];
+                tone_phase += tone_step;
+            }
+            uint32_t magnitude = sample > 32768 ? sample - 32768 : 32768 - sample;
+            if(magnitude > level_peak) level_peak = magnitude;
+            level_sum += magnitude;
+            level_count++;
+            adc_value = 32768 + (((sample - 32768) * (int)depth) >> 8);
+            if(monitoring) monitor_record(&monitor, adc_value);
+            PROFILE_STOP(PROFILE_SAMPLE, stamp);
+        }
+        uint32_t picked = DWT->CYCCNT;
+        headroom_stage(&headroom, HEADROOM_SOURCE, picked - begun);
+
         /**
-         * ADC state machine
-         * Since we cannot use blocking functions like analogin_read(),
-         * we need to read value ourselves by creating simple state machine
-         * that writes and reads correct values to / from ADC
+         * Control tasks run between samples, never inside carrier loop,
+         * in slices that fit into SCHED_BUDGET cycles
          */
-        switch(read_state){
-            case 0:
-                ADC0->SC1[0] = 0x0C & ADC_SC1_ADCH_MASK;    /* Enable ADC12 ( pin A0 ) */
-                read_state = 1;                             /* Move to next state */
-                break;
-            case 1:
-                if(!(ADC0->SC2 & ADC_SC2_ADACT_MASK))       /* Until SC2 has ADC_SC2_ADACT_MASK flag enabled, we wait */
-                    read_state = 2;                         /* Then we move to state 2 */
-                break;
-            case 2:
-                if( (ADC0->SC1[0] & ADC_SC1_COCO_MASK) == ADC_SC1_COCO_MASK )   /* If reading value is finished */
-                    read_state = 3;                                             /* Then we move to final state 3 */
-                break;
-            case 3:
-                adc_value = ADC0->R[0]; /* ADC read is finished, so we preserve value for further use */
-                read_state = 0;         /* And we loop to beginning */
-                break;
+        if(pending & EVENT_SERIAL) serial = true;
+        {
+            PROFILE_START(stamp);
+            sched_run(&sched, us_ticker_read(), headroom.light ? SCHED_LIGHT_BUDGET : SCHED_BUDGET);
+            PROFILE_STOP(PROFILE_TASKS, stamp);
+        }
+
+        /* Apply command console task parsed, we measure how long it took as this time delays next sample */
+        if(command_ready){
+            uint32_t begin = DWT->CYCCNT;
+            switch(command.type){
+                case CONSOLE_TUNE:
+                    /* Move BR LX to location closest to new frequency, old measurements are good enough */
+                    if(ready_state != BROADCASTING && ready_state != STANDBY){
+                        say("Tune: not measured yet\n");
+                        break;
+                    }
+                    desired = TUNE_HZ(command.value) - TUNE_HZ(sample_rate) / 2;
+                    index = closest(measurements, measure_limit - 1, desired);
+                    freq = tune_frequency(MEASURE_PERIODS, measurements[index]);
+                    periods = tune_periods(freq, sample_rate);
+                    sled_prepare(&sled, index, periods);   /* Carrier switches to it with next sample */
+                    hop_start(&hop, 0);
+                    scan_return = false;
+#if DISCIPLINE != FREE_RUNNING
+                    steer_set(&steer, measurements, measure_limit - 1, MEASURE_PERIODS, target = desired, ppb);
+#endif
+                    trace_log(&trace, TRACE_RETUNE, tune_hz(freq + TUNE_HZ(sample_rate / 2)));
+                    say("Tune: desired=%d, estimated=%d, error=%d\n", tune_hz(desired + TUNE_HZ(sample_rate / 2)), tune_hz(freq + TUNE_HZ(sample_rate / 2)), tune_delta(freq, desired));
+                    break;
+                case CONSOLE_MODE:
+                    /* Period length changes with waveform, so we have to measure again */
+                    waveform = command.value;
+                    transmitter = carrier_select(waveform, realtime);
+                    hop_start(&hop, 0);     /* Stops scan too, without record */
+                    scan.samples = 0;
+                    scan_return = false;
+                    periods = MEASURE_PERIODS;
+                    sled_prepare(&sled, index = 0, periods);
+                    best_diff = desired;
+                    ready_state = MEASURING;
+                    red = LED_ON; green = LED_OFF; blue = LED_OFF;
+                    say("Mode: %s, measuring\n", waveform == SINE ? "sine" : "square");
+                    break;
+                case CONSOLE_DEPTH:
+                    depth = command.value * 256 / 100;
+                    say("Depth: %d%%\n", (int)command.value);
+                    break;
+                case CONSOLE_SOURCE:
+                    source = command.value;
+                    say("Source: %s\n", sources[source]);
+                    break;
+                case CONSOLE_SCAN:
+                    /* Scan is hopping through channels in order, with records and ID tone on top */
+                    if(!hop.channels){
+                        say("Scan: not measured yet\n");
+                        break;
+                    }
+                    if(!command.value){
+                        if(scanning) hop_start(&hop, 0);    /* Scan ends with record of this channel */
+                        say("Scan: %s\n", scanning ? "stopping" : "not running");
+                        break;
+                    }
+                    if(!scanning){
+                        scan_source = source;
+                        scan_index = index;
+                        scan_periods = periods;
+#if DISCIPLINE != FREE_RUNNING
+                        scan_target = target;
+#endif
+                        scan_return = true;
+                    }
+                    scanning = true;
+                    source = SOURCE_TONE;
+                    hop.hops = 0;
+                    scan.samples = 0;
+                    hop_order(&hop, 0);     /* Scan goes in order, `sequence` is back after it */
+                    hop_start(&hop, (uint64_t)command.value * sample_rate / 1000 * BURSTS);
+                    say("Scan: dwell=%d samples over %d channels\n", hop.dwell / BURSTS, hop.channels);
+                    break;
+                case CONSOLE_HOP:
+                    if(scanning){
+                        say("Hop: scan in progress\n");
+                        break;
+                    }
+                    if(!hop.channels){
+                        say("Hop: not measured yet\n");
+                        break;
+                    }
+                    hop_start(&hop, (uint64_t)command.value * sample_rate / 1000 * BURSTS);
+                    say("Hop: dwell=%d samples over %d channels\n", hop.dwell / BURSTS, hop.channels);
+                    break;
+                case CONSOLE_SEQUENCE:
+                    sequence = command.value;
+                    if(!scanning) hop_order(&hop, sequence);
+                    say("Sequence: %d\n", (int)command.value);
+                    break;
+                case CONSOLE_REALTIME:
+                    realtime = command.value;
+                    transmitter = carrier_select(waveform, realtime);
+                    jitter_rebase(&jitter[realtime]);
+                    say("Realtime: %d\n", (int)realtime);
+                    break;
+                case CONSOLE_JITTER:
+                    say_jitter("normal", &jitter[0]);
+                    say_jitter("realtime", &jitter[1]);
+                    jitter_init(&jitter[0]);
+                    jitter_init(&jitter[1]);
+                    break;
+                case CONSOLE_RATE:{
+                    /**
+                     * Everything that depends on sample rate changes at once, before next sample:
+                     * ADC trigger, USB offset of channels, test tone, periods per sample
+                     */
+                    unsigned int r = 0;
+                    while(r < RATES && rates[r] != (unsigned int)command.value) r++;
+                    if(r == RATES){
+                        say("Rate: %d Hz isn't supported\n", (int)command.value);
+                        break;
+                    }
+                    desired = desired + TUNE_HZ(sample_rate) / 2 - TUNE_HZ(rates[r]) / 2;
+                    sample_rate = rates[r];
+                    rate = r;
+                    sampling_rate(sample_rate);
+                    headroom_rate(&headroom, SystemCoreClock / sample_rate / BURSTS);
+                    tone_step = (unsigned int)(TONE_FREQUENCY * 4294967296.0 / sample_rate);
+                    hop_start(&hop, 0);         /* Stops scan too */
+                    scan_return = false;
+                    loading = false;
+                    if(hop.channels && (ready_state == BROADCASTING || ready_state == STANDBY)){
+                        /* Already measured, retune current channel and rebuild cache for new offset */
+                        build_cache(measurements, measure_limit - 1, rate, sample_rate);
+                        index = closest(measurements, measure_limit - 1, desired);
+                        freq = tune_frequency(MEASURE_PERIODS, measurements[index]);
+                        periods = tune_periods(freq, sample_rate);
+                        sled_prepare(&sled, index, periods);
+#if DISCIPLINE != FREE_RUNNING
+                        steer_set(&steer, measurements, measure_limit - 1, MEASURE_PERIODS, target = desired, ppb);
+#endif
+                        trace_log(&trace, TRACE_RETUNE, tune_hz(freq + TUNE_HZ(sample_rate / 2)));
+                    }
+                    say("Rate: %d Hz, periods=%d\n", sample_rate, periods);
+                    break;
+                }
+                case CONSOLE_LOAD:
+                    /* Relative to sample period, carrier takes what's left after everything else */
+                    for(unsigned int r=0; r<RATES; r++){
+                        if(!load[r].bursts) continue;
+                        uint64_t available = (uint64_t)load[r].bursts * (SystemCoreClock / rates[r] / BURSTS);
+                        unsigned int carrier = load[r].carrier * 1000 / available, other = (load[r].total - load[r].carrier) * 1000 / available;
+                        say("Load: %d Hz, carrier=%d.%d%%, other=%d.%d%%, total=%d.%d%%, samples=%u\n", rates[r],
+                            carrier / 10, carrier % 10, other / 10, other % 10, (carrier + other) / 10, (carrier + other) % 10, (unsigned int)(load[r].bursts / BURSTS));
+                    }
+                    if(headroom.last.bursts){
+                        /* Last window of current rate, per stage */
+                        const headroom_window_t *window = &headroom.last;
+                        int padding = headroom_padding(&headroom, window);
+                        say("Headroom: source=%d.%d%%, control=%d.%d%%, carrier=%d.%d%%, other=%d.%d%%, padding=%s%d.%d%%, worst=%u cycles of %u, profile=%s, fallbacks=%u\n",
+                            headroom_load(&headroom, window, HEADROOM_SOURCE) / 10, headroom_load(&headroom, window, HEADROOM_SOURCE) % 10,
+                            headroom_load(&headroom, window, HEADROOM_CONTROL) / 10, headroom_load(&headroom, window, HEADROOM_CONTROL) % 10,
+                            headroom_load(&headroom, window, HEADROOM_CARRIER) / 10, headroom_load(&headroom, window, HEADROOM_CARRIER) % 10,
+                            headroom_load(&headroom, window, HEADROOM_OTHER) / 10, headroom_load(&headroom, window, HEADROOM_OTHER) % 10,
+                            padding < 0 ? "-" : "", abs(padding) / 10, abs(padding) % 10, (unsigned int)window->worst, (unsigned int)headroom.period,
+                            headroom.light ? "light" : "full", (unsigned int)headroom.fallbacks);
+                    }
+                    break;
+                case CONSOLE_COUNTER:
+                    counting = command.value;
+                    if(!counting) counter_stop();
+                    counter_rebase(&counter);
+                    say("Counter: %d\n", (int)counting);
+                    break;
+                case CONSOLE_CARRIER:
+                    say_counter(freq, sample_rate / 2);
+                    break;
+                case CONSOLE_TELEMETRY:
+                    report_task.period = command.value * 1000;
+                    report_task.release = us_ticker_read();
+                    say("Telemetry: %d ms\n", (int)command.value);
+                    break;
+                case CONSOLE_MONITOR:
+                    monitor_task.period = command.value * 1000;
+                    monitor_task.release = us_ticker_read();
+                    say("Monitor: %d ms\n", (int)command.value);
+                    break;
+                case CONSOLE_TRACE:
+                    /* Frames are queued by trace task as room in telemetry ring allows */
+                    trace_total = trace_kept(&trace);
+                    trace_from = trace.head - trace_total;
+                    trace_sent = 0;
+                    tracing = true;
+                    say("Trace: entries=%u, boots=%u\n", trace_total, (unsigned int)trace.boots);
+                    break;
+                case CONSOLE_PROFILE:
+                    /* Lines are queued by profile task as room in telemetry ring allows */
+#if PROFILE
+                    profiling = true;       /* Print that is already going on just carries on */
+#else
+                    say("Profile: disabled\n");
+#endif
+                    break;
+                case CONSOLE_MEASURED:
+                    /* Raw measurements, so that timing model (tools/timing_model.cpp) can be checked against board */
+                    if(ready_state == MEASURING){
+                        say("Measured: not measured yet\n");
+                        break;
+                    }
+                    {
+                        char values[MEASURED_LINE * 11 + 1];
+                        unsigned int length = 0, from = command.value;
+                        for(unsigned int i=from; i<measure_limit && i<from + MEASURED_LINE; i++){
+                            length += snprintf(values + length, sizeof(values) - length, i > from ? ",%u" : "%u", measurements[i]);
+                        }
+                        values[length] = 0;
+                        say("Measured: waveform=%s, periods=%d, from=%u, us=%s\n", waveform == SINE ? "sine" : "square",
+                            MEASURE_PERIODS, from, values);
+                    }
+                    break;
+                case CONSOLE_STATUS:
+                    say("Status: state=%d, frequency=%d, waveform=%s, depth=%d%%, source=%s, console=%d cycles of %d per sample\n",
+                        ready_state, tune_hz(freq + TUNE_HZ(sample_rate / 2)), waveform == SINE ? "sine" : "square", depth * 100 / 256, sources[source],
+                        console_worst, (int)(SystemCoreClock / sample_rate));
+                    if(hop.dwell){
+                        say("Hop: channel=%d, hops=%d, latency=%d cycles, settle=%d bursts\n",
+                            (int)channel_rasters[hop_channel(&hop)], hop.hops, (int)hop.latency, hop.settle);
+                    }
+                    say("Tasks: worst=%d cycles of %d, console=%d/%d, drift=%d/%d misses=%d, drift=%d samples/s\n",
+                        (int)sched.worst, SCHED_BUDGET, (int)console_task.worst, (int)console_task.budget,
+                        (int)drift_task.worst, (int)drift_task.budget, (int)drift_task.misses, (int)drift);
+                    if(report_task.period){
+                        say("Telemetry: frames=%u, dropped=%u, worst=%d/%d cycles\n", (unsigned int)telemetry.frames,
+                            (unsigned int)telemetry.dropped, (int)telemetry_task.worst, (int)telemetry_task.budget);
+                    }
+                    if(monitor.windows){
+                        const monitor_result_t *result = &monitor.last;
+                        say("Monitor: windows=%u, depth=%d.%d%%, overmodulation=%d, distortion=%s%d.%d dB, envelope=%d-%d mean=%d, lag=%d, worst=%d/%d cycles\n",
+                            (unsigned int)monitor.windows, result->depth / 10, result->depth % 10, result->events,
+                            result->distortion < 0 ? "-" : "", abs(result->distortion) / 10, abs(result->distortion) % 10,
+                            result->min, result->max, result->level, result->lag, (int)monitor_task.worst, (int)monitor_task.budget);
+                    }
+                    break;
+                default:
+                    say("?\n");
+                    break;
+            }
+            command_ready = false;
+            uint32_t cycles = DWT->CYCCNT - begin;
+            if(cycles > console_worst) console_worst = cycles;
+            PROFILE_ADD(PROFILE_COMMAND, cycles);
+        }
+
+        /* Snapshot for status frame, packed and queued by telemetry task (previous one has to be packed first) */
+        if(report_ready && !report_pending){
+            report.time = us_ticker_read();
+            report.state = ready_state;
+            report.source = source;
+            report.depth = depth;
+            report.flags = (hop.dwell && !scanning ? TELEMETRY_HOPPING : 0) | (scanning ? TELEMETRY_SCANNING : 0)
+                | (realtime ? TELEMETRY_REALTIME : 0) | (counting ? TELEMETRY_COUNTING : 0);
+            report.frequency = freq;
+            report.ticks = counting && counter.batches ? counter.total.ticks : 0;
+            report.periods = counter.total.periods;
+            report.bursts = bursts;
+            report.drift = drift;
+            report.rate = rate;
+            report.sample_rate = sample_rate;
+            report.load = load[rate];
+            report.peak = level_peak;
+            report.level_sum = level_sum;
+            report.level_count = level_count;
+            level_peak = level_sum = level_count = 0;
+            report.headroom = headroom;
+            report_pending = REPORT_STATUS | (headroom.last.bursts ? REPORT_HEADROOM : 0);
+            report_ready = false;
+        }
+
+#if DISCIPLINE == PPS
+        /**
+         * PPS edges are timestamped in interrupt, here we only feed them to PLL.
+         * Once locked, correction steers sample clock and carrier.
+         * Very first locked edge also starts carrier, so that all boards
+         * sharing the same PPS start broadcasting at the same time
+         */
+        if(pps_read(&stamp)){
+            if(pll_update(&pll, stamp) == PLL_LOCKED){
+                ppb = pll_ppb(&pll);
+                sampling_steer(ppb);
+                steer_set(&steer, measurements, measure_limit - 1, MEASURE_PERIODS, target, ppb);
+                if(abs(ppb - traced_ppb) >= TRIM_TRACE_STEP) trace_log(&trace, TRACE_TRIM, traced_ppb = ppb);
+                if(ready_state == STANDBY){
+                    say("PPS: locked, oscillator error=%d ppb\n", (int)pll_ppb(&pll));
+                    ready_state = BROADCASTING;
+                }
+            }
+        }
+#elif DISCIPLINE == PTP
+        /**
+         * Same as with PPS, but reference is grandmaster's time.
+         * Carrier is started on whole second of master's time
+         */
+        if(ptp_poll(&servo) && servo.state == PTP_LOCKED){
+            ppb = ptp_ppb(&servo);
+            sampling_steer(ppb);
+            steer_set(&steer, measurements, measure_limit - 1, MEASURE_PERIODS, target, ppb);
+            if(abs(ppb - traced_ppb) >= TRIM_TRACE_STEP) trace_log(&trace, TRACE_TRIM, traced_ppb = ppb);
+            if(ready_state == STANDBY){
+                say("PTP: locked, oscillator error=%d ppb, delay=%d ns\n", (int)ptp_ppb(&servo), (int)servo.delay);
+                ptp_wait_second(&servo);
+                ready_state = BROADCASTING;
+            }
+        }
+#endif
+        headroom_stage(&headroom, HEADROOM_CONTROL, DWT->CYCCNT - picked);
+
+        /* Keep track of which state we spend time in */
+        if(ready_state != events.state){
+            if(ready_state == BROADCASTING){
+                say("Idle: measuring=%d%%, testing=%d%%, standby=%d%%\n",
+                    events_idle(&events, MEASURING) / 10, events_idle(&events, TESTING) / 10, events_idle(&events, STANDBY) / 10);
+                /* Inform user that we are broadcasting now (green LED) */
+                red = LED_OFF; green = LED_ON; blue = LED_OFF;
+            }
+            events_state(&events, ready_state);
+            trace_log(&trace, TRACE_STATE, ready_state);
+            loading = false;
         }
 
         /**
@@ -165,32 +1003,31 @@ int main(){
                  * We do so by measuring time it takes to execute 100 000 periods at given BR LX location 
                  */
                 start = timer.read_us();
-                for(unsigned int i=periods; i; i--){
-                    transmit(adc_value);
-                }
+                transmit(&sled, adc_value);
                 end = timer.read_us();
                 /**
                  * We save this measurement, and move on to next BR LX location
                  */
                 measurements[index] = end - start;
-                opcodes[index] = 0xBF00;
-                opcodes[++index] = 0x4770;
+                sled_prepare(&sled, ++index, periods);
                 /**
                  * Once we tried all BR LX locations, it's time to evaluate which one matched desired frequencies the best
                  */
                 if(index == measure_limit){
                     /* Inform user that we are evaluating measurements (blue LED) */
                     red = LED_OFF; green = LED_OFF; blue = LED_ON;
+                    PROFILE_START(stamp);
                     for(unsigned int i=0; i<measure_limit - 1; i++){
-                        for(unsigned int j=0; j<frequencies_n; j++){
+                        freq = tune_frequency(periods, measurements[i]);
+                        for(unsigned int j=0; j<CHANNELS; j++){
                             /**
                              * We evaluate each measurement and each desired frequency and 
                              * calculate delta = |measured - desired|
                              * If delta is smaller that best delta we've found yet,
                              * we update best pointer, frequency and best delta
                              */
-                            freq = periods * 1000000.0f / measurements[i];
-                            diff = abs(freq - frequencies[j]);
+                            tune_t carrier = channel_carrier(rate, j);
+                            diff = freq > carrier ? freq - carrier : carrier - freq;
                             if(diff < best_diff){
                                 best_diff = diff;
                                 best_frequency = j;
@@ -203,11 +1040,13 @@ int main(){
                      * So first, let's set BR LX to where it belongs to and inform user
                      * we are testing now (cyan LED)
                      */
-                    freq = periods * 1000000.0f / measurements[index];
-                    periods = 250000;
-                    opcodes[index] = 0xBF00;
-                    opcodes[index = best_index] = 0x4770;
-                    desired = frequencies[best_frequency];
+                    build_cache(measurements, measure_limit - 1, rate, sample_rate);
+                    PROFILE_STOP(PROFILE_EVALUATION, stamp);
+
+                    freq = tune_frequency(periods, measurements[best_index]);
+                    periods = TEST_PERIODS;
+                    sled_prepare(&sled, index = best_index, periods);
+                    desired = channel_carrier(rate, best_frequency);
                     ready_state = TESTING;
                     red = LED_OFF; green = LED_ON; blue = LED_ON;
                 }
@@ -217,13 +1056,16 @@ int main(){
                  * Basically do the same as before, but with period = 1 000
                  */
                 start = timer.read_us();
-                for(unsigned int i=periods; i; i--){
-                    transmit(adc_value);
-                }
+                transmit(&sled, adc_value);
                 end = timer.read_us();
-                freq = periods * 1000000.0f / (end - start);
-                periods = (int)(0.5f * freq / sample_rate);
-                PC.printf("Broadcast: measured=%f, desired=%f (%f), error=%f, final periods=%d\n", freq, desired, desired + sample_rate / 2, freq - desired, periods);
+                freq = tune_frequency(periods, end - start);
+                periods = tune_periods(freq, sample_rate);
+                sled_prepare(&sled, index, periods);
+#if DISCIPLINE != FREE_RUNNING
+                steer_set(&steer, measurements, measure_limit - 1, MEASURE_PERIODS, target = desired, ppb);
+#endif
+                say("Broadcast: measured=%d, desired=%d (%d), error=%d, final periods=%d\n",
+                    tune_hz(freq), tune_hz(desired), tune_hz(desired + TUNE_HZ(sample_rate / 2)), tune_delta(freq, desired), periods);
                 /**
                  * In order to broadcast, we need to set period to something sensible
                  * Since we are broadcasting on frequency F and sample rate SR is smaller than SR
@@ -231,16 +1073,119 @@ int main(){
                  * We calculate this amount as 0.5 Frequency / SampleRate.
                  * Constant 0.5 comes from fact that period consists of two parts: High and Low
                  */
+#if DISCIPLINE != FREE_RUNNING
+                /* Stay silent until we are locked and aligned to reference (yellow LED) */
+                ready_state = STANDBY;
+                red = LED_ON; green = LED_ON; blue = LED_OFF;
+#else
                 ready_state = BROADCASTING;
-                /* Inform user that we are broadcasting now (green LED) */
-                red = LED_OFF; green = LED_ON; blue = LED_OFF;
+#endif
+                break;
+            case STANDBY:
+                /* Nothing to transmit, sleep until something happens */
+                events_wait(&events);
                 break;
             case BROADCASTING:
-                /* Broadcast ADC value that's been read */
-                for(unsigned int i=periods; i; i--){
-                    transmit(adc_value);
+                /* Hop to next channel if it's time, carrier switches to it with this sample */
+                const tuning_t *tuning = hop_next(&hop);
+                uint32_t decided = DWT->CYCCNT;
+                if(tuning){
+                    sled_prepare(&sled, index = tuning->index, periods = tuning->periods);
+                    freq = tune_frequency(MEASURE_PERIODS, measurements[index]);
+#if DISCIPLINE != FREE_RUNNING
+                    steer_set(&steer, measurements, measure_limit - 1, MEASURE_PERIODS, target = channel_carrier(rate, hop_channel(&hop)), ppb);
+#endif
+                    hop_expected = (uint64_t)measurements[index] * (SystemCoreClock / 1000000) * periods / MEASURE_PERIODS;
+                    hop_settling = 0;
+                    settling = true;
+                }
+
+                /* Every hop of scan finishes record of previous channel */
+                if(scanning && (tuning || !hop.dwell)){
+                    bool last = !hop.dwell || hop.hops > hop.channels;
+                    if(scan.samples){
+                        uint8_t record[SCAN_RECORD];
+                        /* Counter restarted with this channel (retune rebases it), so its batches are this dwell */
+                        bool counted = counting && counter.batches;
+                        uint32_t measured = (counted ? (uint32_t)(counter_frequency(&counter, counter_clock) / 1000)
+                            : scan_frequency(&scan, SystemCoreClock)) + sample_rate / 2;
+                        scan_encode(&scan, channel_rasters[scan.channel], measured, (last ? SCAN_LAST : 0) | (counted ? SCAN_COUNTED : 0), record);
+                        telemetry_write(&telemetry, record, SCAN_RECORD);
+                    }
+                    if(last){
+                        hop_start(&hop, 0);
+                        hop_order(&hop, sequence);
+                        scanning = false;
+                        source = scan_source;
+                        tone_step = (unsigned int)(TONE_FREQUENCY * 4294967296.0 / sample_rate);
+                        if(scan_return){
+                            /* Back to where we were before scan, carrier switches with next sample */
+                            sled_prepare(&sled, index = scan_index, periods = scan_periods);
+                            freq = tune_frequency(MEASURE_PERIODS, measurements[index]);
+#if DISCIPLINE != FREE_RUNNING
+                            steer_set(&steer, measurements, measure_limit - 1, MEASURE_PERIODS, target = scan_target, ppb);
+#endif
+                            trace_log(&trace, TRACE_RETUNE, tune_hz(freq + TUNE_HZ(sample_rate / 2)));
+                            scan_return = false;
+                        }
+                    } else {
+                        scan_begin(&scan, hop_channel(&hop));
+                        tone_step = (unsigned int)(scan_tone(scan.channel) * 4294967296.0 / sample_rate);
+                    }
+                }
+
+                /**
+                 * Broadcast ADC value that's been read
+                 * Carrier loop of current waveform and pacing (realtime or not), see carrier.h
+                 */
+#if DISCIPLINE != FREE_RUNNING
+                /* Disciplined carrier alternates bursts between two locations (see pll.h), retune goes first */
+                if(!sled.pending){
+                    unsigned int location = steer_next(&steer);
+                    if(location != sled_index(&sled)){
+                        sled_prepare(&sled, location, periods);
+                        steered = true;
+                    }
+                }
+#endif
+                start = DWT->CYCCNT;
+                active = sled.active;
+                end = transmitter(&sled, adc_value);
+                PROFILE_ADD(PROFILE_TRANSMIT, end);
+
+                bursts++;
+                if(loading){
+                    load[rate].carrier += last_burst;
+                    load[rate].total += start - last_start;
+                    load[rate].bursts++;
+                    if(headroom_sample(&headroom, start - last_start, last_burst) && headroom.light != light){
+                        trace_log(&trace, TRACE_PROFILE, light = headroom.light);
+                    }
+                } else headroom_skip(&headroom);
+                last_start = start;
+                last_burst = end;
+                loading = true;
+#if DISCIPLINE != FREE_RUNNING
+                if(steered) active = sled.active;
+                steered = false;
+#endif
+                if(sled.active != active){
+                    jitter_rebase(&jitter[realtime]);
+                    counter_rebase(&counter);
+                    if(tuning && carrier_switched - decided > hop.latency) hop.latency = carrier_switched - decided;
+                }
+                jitter_add(&jitter[realtime], end);
+                if(scanning) scan_add(&scan, end, sled_periods(&sled));
+                if(settling){
+                    /* Burst is settled, once its length is within 2% of what measurements say */
+                    unsigned int cycles = end;
+                    if(cycles * 50 > hop_expected * 49 && cycles * 50 < hop_expected * 51){
+                        if(hop_settling > hop.settle) hop.settle = hop_settling;
+                        settling = false;
+                    } else hop_settling++;
                 }
                 break;
         }
+        PROFILE_STOP(ready_state, loop);
     }
 }
\ No newline at end of file
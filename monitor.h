@@ -0,0 +1,206 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+
+/**
+ * Modulation monitor
+ *
+ * Envelope of transmitted signal, sampled once per audio sample (see
+ * monitor_port.h for where it comes from on target), is compared with audio
+ * that was sent to carrier over the same window of MONITOR_BLOCK samples:
+ *
+ * - depth is (max - min) / (max + min) of envelope, like trapezoid on a scope
+ * - overmodulation events are runs of envelope below MONITOR_FLOOR, where
+ *   negative peaks cut carrier off
+ * - distortion is power of what's left of envelope after the best straight
+ *   line fit of audio, relative to power of the fit (THD+N), in 0.1 dB; audio
+ *   is tried at MONITOR_LAG samples either way and the lag that fits best wins
+ *
+ * Everything is integer. Samples are reduced to 12 bits (what DAC has), so
+ * that products of a whole window still fit 32-bit accumulators
+ * (4095 * 4095 * 256 < 2^32). Window is worked through MONITOR_SLICE samples
+ * per monitor_block() call, then one lag per monitor_fit() call, only those
+ * and monitor_end() touch 64-bit math.
+ */
+
+#define MONITOR_BLOCK 256           /* Samples per window, 12-bit sums of products must fit 32 bits */
+#define MONITOR_LAG 4               /* Audio to envelope delay tried either way, in samples */
+#define MONITOR_LAGS (2 * MONITOR_LAG + 1)
+#define MONITOR_FITTED (MONITOR_BLOCK - 2 * MONITOR_LAG)  /* Samples that take part in fit */
+#define MONITOR_SLICE 8             /* Samples per monitor_block() call */
+#define MONITOR_FLOOR 32            /* Envelope under this (12-bit) means carrier is cut off */
+#define MONITOR_QUIET 4096          /* Audio variance times MONITOR_BLOCK under this is too quiet to measure distortion */
+
+#define MONITOR_QUIET_FLAG 0x01     /* Result flag, audio was too quiet for distortion */
+
+struct monitor_result_t {
+    uint16_t depth;                 /* Per mille */
+    uint16_t events;                /* Overmodulation events */
+    int16_t distortion;             /* THD+N in 0.1 dB, 0 if audio was too quiet */
+    uint16_t level;                 /* Mean envelope, 12-bit */
+    uint16_t min;                   /* Lowest envelope, 12-bit */
+    uint16_t max;                   /* Highest envelope, 12-bit */
+    int8_t lag;                     /* Envelope follows audio by this many samples */
+    uint8_t flags;                  /* MONITOR_*_FLAG */
+};
+
+struct monitor_t {
+    uint16_t reference[MONITOR_BLOCK];  /* Audio sent to carrier, filled by monitor_record() */
+    volatile unsigned int recorded;     /* Samples in reference */
+    uint32_t e, ee;                 /* Envelope sums over fitted part of window */
+    uint32_t r, rr;                 /* Audio sums over whole window */
+    uint32_t er[MONITOR_LAGS];      /* Envelope times audio, per lag */
+    uint32_t all;                   /* Envelope sum over whole window */
+    int64_t explained;              /* Power explained by the best lag so far, times MONITOR_FITTED */
+    uint16_t min, max;
+    uint16_t events;
+    bool cut;                       /* Envelope is under floor */
+    monitor_result_t last;          /* Last complete window */
+    uint32_t windows;               /* Windows completed */
+};
+
+inline void monitor_init(monitor_t *monitor){
+    monitor->recorded = 0;
+    monitor->windows = 0;
+}
+
+/**
+ * Audio sample as it went to carrier, ignored once window is full
+ */
+inline void monitor_record(monitor_t *monitor, uint16_t sample){
+    unsigned int recorded = monitor->recorded;
+    if(recorded >= MONITOR_BLOCK) return;
+    monitor->reference[recorded] = sample;
+    monitor->recorded = recorded + 1;
+}
+
+/**
+ * Start window, reference is recorded from now on
+ */
+inline void monitor_begin(monitor_t *monitor){
+    monitor->e = monitor->ee = monitor->r = monitor->rr = monitor->all = 0;
+    for(unsigned int i=0; i<MONITOR_LAGS; i++){
+        monitor->er[i] = 0;
+    }
+    monitor->min = 0xFFFF;
+    monitor->max = 0;
+    monitor->events = 0;
+    monitor->cut = false;
+    monitor->explained = 0;
+    monitor->recorded = 0;
+}
+
+/**
+ * Go through `count` samples of envelope (16-bit) from `first` on, reference has to be complete
+ */
+inline void monitor_block(monitor_t *monitor, const uint16_t *envelope, unsigned int first, unsigned int count){
+    const uint16_t *reference = monitor->reference;
+    for(unsigned int n=first; n<first + count; n++){
+        uint32_t e = envelope[n] >> 4, r = reference[n] >> 4;
+        monitor->all += e;
+        monitor->r += r;
+        monitor->rr += r * r;
+        if(e < monitor->min) monitor->min = e;
+        if(e > monitor->max) monitor->max = e;
+        bool cut = e < MONITOR_FLOOR;
+        if(cut && !monitor->cut) monitor->events++;
+        monitor->cut = cut;
+
+        /* Fit uses envelope only where every lag has audio to pair it with */
+        if(n < MONITOR_LAG || n >= MONITOR_BLOCK - MONITOR_LAG) continue;
+        monitor->e += e;
+        monitor->ee += e * e;
+        const uint16_t *paired = reference + n - MONITOR_LAG;
+        for(unsigned int i=0; i<MONITOR_LAGS; i++){
+            monitor->er[i] += e * (paired[i] >> 4);
+        }
+    }
+}
+
+/**
+ * Base 2 logarithm of nonzero `x` in Q8
+ */
+inline int32_t monitor_log2(uint64_t x){
+    int32_t result = 0;
+    while(x >> 31){
+        x >>= 1;
+        result += 256;
+    }
+    while(!(x >> 30)){
+        x <<= 1;
+        result -= 256;
+    }
+    result += 30 * 256;
+    /* Mantissa is in [1, 2) as Q30, each squaring yields one fractional bit */
+    for(int bit=128; bit; bit >>= 1){
+        x = x * x >> 30;
+        if(x >> 31){
+            x >>= 1;
+            result += bit;
+        }
+    }
+    return result;
+}
+
+/**
+ * Try pairing envelope of sample n with audio n + lag, one lag per call,
+ * all of them once window is through monitor_block()
+ */
+inline void monitor_fit(monitor_t *monitor, int lag){
+    const uint16_t *reference = monitor->reference;
+    const int64_t n = MONITOR_FITTED;
+
+    /**
+     * Sums of squares and products are multiplied by n, so that they stay exact integers
+     * (under 2^38 with 12-bit samples). Audio sums of the lag are whole window sums
+     * without samples it doesn't pair
+     */
+    uint32_t r = monitor->r, rr = monitor->rr;
+    for(int i=0; i<MONITOR_LAG + lag; i++){
+        uint32_t x = reference[i] >> 4;
+        r -= x;
+        rr -= x * x;
+    }
+    for(int i=MONITOR_BLOCK - MONITOR_LAG + lag; i<MONITOR_BLOCK; i++){
+        uint32_t x = reference[i] >> 4;
+        r -= x;
+        rr -= x * x;
+    }
+    int64_t sxx = n * rr - (int64_t)r * r;
+    int64_t sxy = n * monitor->er[lag + MONITOR_LAG] - (int64_t)monitor->e * r;
+    if(sxx < MONITOR_QUIET * n || sxy <= 0) return;
+    /* Power explained by fit is sxy^2 / sxx, gain goes through Q24 to stay in 64 bits */
+    int64_t explained = ((sxy << 24) / sxx) * sxy >> 24;
+    if(explained > monitor->explained){
+        monitor->explained = explained;
+        monitor->last.lag = -lag;
+    }
+}
+
+/**
+ * Finish window into monitor->last
+ */
+inline void monitor_end(monitor_t *monitor){
+    monitor_result_t *result = &monitor->last;
+    result->min = monitor->min;
+    result->max = monitor->max;
+    result->level = monitor->all / MONITOR_BLOCK;
+    result->events = monitor->events;
+    result->depth = monitor->max + monitor->min ? (uint32_t)(monitor->max - monitor->min) * 1000 / (monitor->max + monitor->min) : 0;
+    result->flags = 0;
+    result->distortion = 0;
+    if(!monitor->explained){
+        result->flags |= MONITOR_QUIET_FLAG;
+        result->lag = 0;
+    } else {
+        int64_t syy = MONITOR_FITTED * (int64_t)monitor->ee - (int64_t)monitor->e * monitor->e;
+        int64_t residual = syy - monitor->explained;
+        if(residual < 1) residual = 1;
+        /* 10 log10(residual / explained) in 0.1 dB, 100 log10(2) = 30.103 */
+        result->distortion = (monitor_log2(residual) - monitor_log2(monitor->explained)) * 30103 / (1000 * 256);
+    }
+    monitor->windows++;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef MONITOR_PORT_H
+#define MONITOR_PORT_H
+
+#include "mbed.h"
+#include "monitor.h"
+
+/**
+ * Envelope capture for monitor.h
+ *
+ * DAC0 output goes through RC low pass (1 kOhm, 4.7 nF, corner around 34 kHz)
+ * to A2 (PTB10, ADC1 channel 14). Filter takes carrier out and leaves its mean,
+ * which is half of sample value for both sine and square, so that is envelope.
+ * ADC0 is busy with audio and ADC1 has no internal path to DAC0, hence the wire.
+ *
+ * ADC1 is triggered by PDB0 channel 1 together with audio conversion, so
+ * envelope comes once per sample, in step with what main loop records as
+ * reference. Hardware averaging of 4 conversions smooths what's left of carrier
+ * ripple. Results are moved to buffer by DMA channel MONITOR_DMA, window is
+ * armed from control task, DREQ stops the channel once window is full.
+ *
+ * Has to be initialized after init_sampling(), which starts PDB0.
+ */
+
+#define MONITOR_DMA 1               /* DMA channel used for envelope */
+
+static uint16_t monitor_envelope[MONITOR_BLOCK];   /* Written by DMA */
+
+/**
+ * Initialize ADC1, its PDB trigger and DMA, nothing is captured until monitor_arm()
+ */
+inline void init_monitor(){
+    SIM->SCGC3 |= SIM_SCGC3_ADC1_MASK;          /* Enable ADC1 clock */
+    SIM->SCGC6 |= SIM_SCGC6_DMAMUX_MASK;
+    SIM->SCGC7 |= SIM_SCGC7_DMA_MASK;
+
+    ADC1->CFG1 = ADC_CFG1_MODE(3) | ADC_CFG1_ADIV(2);  /* 16bit, bus clock / 4 */
+    ADC1->SC3 = ADC_SC3_AVGE_MASK | ADC_SC3_AVGS(0);   /* Average of 4 conversions */
+    ADC1->SC2 = ADC_SC2_ADTRG_MASK | ADC_SC2_DMAEN_MASK;   /* PDB trigger, result requests DMA */
+    ADC1->SC1[0] = 0x0E & ADC_SC1_ADCH_MASK;           /* A2, no interrupt */
+
+    PDB0->CH[1].C1 = PDB_C1_EN(1) | PDB_C1_TOS(1);     /* Pre-trigger 0 of channel 1 goes to ADC1 */
+    PDB0->CH[1].DLY[0] = 0;
+    PDB0->SC |= PDB_SC_LDOK_MASK;
+
+    /* 16-bit result into buffer, back to its start after window */
+    DMA0->CERQ = MONITOR_DMA;
+    DMA0->TCD[MONITOR_DMA].SADDR = (uint32_t)(uintptr_t)&ADC1->R[0];
+    DMA0->TCD[MONITOR_DMA].SOFF = 0;
+    DMA0->TCD[MONITOR_DMA].ATTR = DMA_ATTR_SSIZE(1) | DMA_ATTR_DSIZE(1);
+    DMA0->TCD[MONITOR_DMA].NBYTES_MLNO = 2;
+    DMA0->TCD[MONITOR_DMA].SLAST = 0;
+    DMA0->TCD[MONITOR_DMA].DADDR = (uint32_t)(uintptr_t)monitor_envelope;
+    DMA0->TCD[MONITOR_DMA].DOFF = 2;
+    DMA0->TCD[MONITOR_DMA].CITER_ELINKNO = MONITOR_BLOCK;
+    DMA0->TCD[MONITOR_DMA].BITER_ELINKNO = MONITOR_BLOCK;
+    DMA0->TCD[MONITOR_DMA].DLAST_SGA = -(int32_t)sizeof(monitor_envelope);
+    DMA0->TCD[MONITOR_DMA].CSR = DMA_CSR_DREQ_MASK;
+    DMAMUX->CHCFG[MONITOR_DMA] = DMAMUX_CHCFG_ENBL_MASK | DMAMUX_CHCFG_SOURCE(kDmaRequestMux0ADC1 & 0xFF);
+}
+
+/**
+ * Start capturing window
+ */
+inline void monitor_arm(){
+    DMA0->CDNE = MONITOR_DMA;
+    DMA0->SERQ = MONITOR_DMA;
+}
+
+/**
+ * Stop capturing, window in progress is abandoned
+ */
+inline void monitor_stop(){
+    DMA0->CERQ = MONITOR_DMA;
+    DMA0->TCD[MONITOR_DMA].DADDR = (uint32_t)(uintptr_t)monitor_envelope;
+    DMA0->TCD[MONITOR_DMA].CITER_ELINKNO = MONITOR_BLOCK;
+}
+
+/**
+ * Whole window was captured
+ */
+inline bool monitor_done(){
+    return DMA0->TCD[MONITOR_DMA].CSR & DMA_CSR_DONE_MASK;
+}
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef PLL_H
+#define PLL_H
+
+#include <stdint.h>
+#include "tuning.h"
+
+/**
+ * Software PLL used to discipline our timebase to external 1PPS reference
+ *
+ * Each PPS edge is timestamped in timer ticks. We predict where next edge
+ * should land, and difference between prediction and reality (phase error)
+ * is fed into PI loop filter, which outputs frequency correction in ticks per second.
+ * Since core clock and timer are both derived from the same crystal, this correction
+ * tells us exactly how much faster or slower our clock runs than it should.
+ * It is applied to audio sample clock (PDB period, see sampling.h) and to
+ * carrier (steering below).
+ *
+ * Code here doesn't touch any hardware, so it can be simulated on host (see tools/pps_sim.cpp)
+ */
+
+#define PLL_ACQUIRING 0     /* Waiting for first two edges */
+#define PLL_TRACKING 1      /* Loop is running, but phase error is still too large */
+#define PLL_LOCKED 2        /* Phase error stayed within limits for PLL_LOCK_COUNT edges */
+
+#define PLL_KP 0.35f        /* Proportional gain (phase -> frequency) */
+#define PLL_KI 0.04f        /* Integral gain (phase -> frequency integrator) */
+#define PLL_LOCK_TICKS 12   /* Phase error (in ticks) considered to be locked */
+#define PLL_LOCK_COUNT 8    /* Amount of consecutive good edges required for lock */
+#define PLL_OUTLIER 2000    /* Maximum accepted phase error in ppm of nominal, beyond that we re-acquire */
+
+struct pll_t {
+    uint32_t nominal;       /* Nominal amount of ticks per second */
+    uint32_t predicted;     /* Tick at which we expect next edge */
+    float fraction;         /* Fractional part of prediction */
+    float integrator;       /* Integrator state, ticks per second */
+    float correction;       /* Current frequency correction, ticks per second */
+    int32_t phase;          /* Last phase error in ticks */
+    unsigned int edges;     /* Amount of edges seen since (re)acquisition */
+    unsigned int good;      /* Amount of consecutive edges within lock limit */
+    unsigned int state;     /* PLL_ACQUIRING, PLL_TRACKING or PLL_LOCKED */
+};
+
+/**
+ * Reset PLL to acquisition state
+ */
+inline void pll_init(pll_t *pll, uint32_t nominal){
+    pll->nominal = nominal;
+    pll->predicted = 0;
+    pll->fraction = 0.0f;
+    pll->integrator = 0.0f;
+    pll->correction = 0.0f;
+    pll->phase = 0;
+    pll->edges = 0;
+    pll->good = 0;
+    pll->state = PLL_ACQUIRING;
+}
+
+/**
+ * Advance prediction by one second worth of (corrected) ticks
+ */
+inline void pll_advance(pll_t *pll){
+    float step = pll->correction + pll->fraction;
+    int32_t whole = (int32_t)step;
+    if(step < 0.0f && (float)whole != step) whole--;    /* floor() for negative corrections */
+    pll->fraction = step - (float)whole;
+    pll->predicted += pll->nominal + whole;
+}
+
+/**
+ * Feed new PPS edge timestamp (in ticks) into PLL
+ * Returns current PLL state
+ */
+inline unsigned int pll_update(pll_t *pll, uint32_t stamp){
+    int32_t limit = (int32_t)(pll->nominal / 1000000u * PLL_OUTLIER);
+    pll->edges++;
+    if(pll->edges == 1){
+        /* First edge only gives us phase reference */
+        pll->predicted = stamp;
+        return pll->state;
+    }
+    if(pll->edges == 2){
+        /* Second edge gives us coarse frequency, which we preload into integrator */
+        int32_t error = (int32_t)(stamp - pll->predicted - pll->nominal);
+        if(error > limit || error < -limit){
+            /* Missed or spurious pulse, start over from this edge */
+            pll->edges = 1;
+            pll->predicted = stamp;
+            return pll->state;
+        }
+        pll->integrator = pll->correction = (float)error;
+        pll->predicted = stamp;
+        pll->fraction = 0.0f;
+        pll->state = PLL_TRACKING;
+        pll_advance(pll);
+        return pll->state;
+    }
+
+    pll->phase = (int32_t)(stamp - pll->predicted);
+    if(pll->phase > limit || pll->phase < -limit){
+        pll_init(pll, pll->nominal);
+        return pll_update(pll, stamp);
+    }
+
+    /**
+     * Type 2 loop: integrator removes frequency error, proportional path
+     * pulls phase error to zero
+     */
+    pll->integrator += PLL_KI * pll->phase;
+    pll->correction = pll->integrator + PLL_KP * pll->phase;
+    pll_advance(pll);
+
+    if(pll->phase <= PLL_LOCK_TICKS && pll->phase >= -PLL_LOCK_TICKS){
+        if(++pll->good >= PLL_LOCK_COUNT) pll->state = PLL_LOCKED;
+    } else {
+        pll->good = 0;
+        pll->state = PLL_TRACKING;
+    }
+    return pll->state;
+}
+
+/**
+ * Frequency error of our oscillator in parts per billion
+ * Positive means we run fast (there are more ticks in one true second than there should be)
+ */
+inline int32_t pll_ppb(const pll_t *pll){
+    return (int32_t)(pll->integrator * 1000.0f / (pll->nominal / 1000000u));
+}
+
+/**
+ * Carrier steering
+ *
+ * Carrier is timed by NOP sled, so its period can only change by one BR LX
+ * location (roughly 1% at 558 kHz, way too coarse). Disciplined carrier
+ * alternates whole bursts between the two locations whose measured periods
+ * bracket target, sigma-delta picks location of each burst so that average
+ * frequency (periods sent over time they took) tracks target in true time.
+ * Average holds over many bursts only, single burst is up to one location step
+ * off, which puts dither sidebands around carrier. Accuracy is bounded by
+ * measurements (1 us of MEASURE_PERIODS periods, a few ppm).
+ */
+struct steer_t {
+    unsigned int slow;          /* Location with longer period */
+    unsigned int fast;          /* Location with shorter period */
+    uint32_t share;             /* Bursts sent from fast location, Q16 */
+    uint32_t accumulator;       /* Fractional accumulator in Q16 */
+};
+
+/**
+ * Steer to target carrier (true frequency) from measurements of `periods`
+ * periods per location (microseconds of our clock, ascending) and oscillator
+ * error in ppb: fast oscillator measures everything longer than it is
+ */
+inline void steer_set(steer_t *steer, const unsigned int *measurements, unsigned int count, uint32_t periods, tune_t target, int32_t ppb){
+    uint64_t base = ((uint64_t)periods * 1000000u << (16 + TUNE_Q)) / target;
+    uint64_t wanted = base + (int64_t)base * ppb / 1000000000;     /* Microseconds in Q16 */
+    steer->slow = steer->fast = 0;
+    steer->share = 0;
+    if(wanted <= (uint64_t)measurements[0] << 16) return;
+    steer->slow = steer->fast = count - 1;
+    if(wanted >= (uint64_t)measurements[count - 1] << 16) return;
+    unsigned int i = 1;
+    while(wanted > (uint64_t)measurements[i] << 16) i++;
+    steer->slow = i;
+    steer->fast = i - 1;
+    steer->share = (uint32_t)((((uint64_t)measurements[i] << 16) - wanted) / (measurements[i] - measurements[i - 1]));
+}
+
+/**
+ * Location to send next burst from
+ */
+inline unsigned int steer_next(steer_t *steer){
+    uint32_t value = steer->accumulator + steer->share;
+    steer->accumulator = value & 0xFFFF;
+    return value >> 16 ? steer->fast : steer->slow;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef PPS_H
+#define PPS_H
+
+#include "mbed.h"
+#include "us_ticker_api.h"
+#include "fsl_clock.h"
+
+/**
+ * 1PPS input capture
+ *
+ * PPS signal is connected to D6 (PTC2), which is FTM0 channel 1 (ALT4).
+ * FTM0 runs free from bus clock with no prescaler, so we get one tick resolution
+ * (16.6 ns at 60 MHz). Counter is only 16-bit and wraps every ~1 ms, but instead of
+ * counting overflows in interrupt (which would preempt carrier 900 times per second)
+ * we extend it using microsecond ticker, which runs from the same clock.
+ * This way there is only one interrupt per second.
+ * The two counters are started at different times, so their offset is captured
+ * once in init_pps() and added to every microsecond reading.
+ */
+
+static volatile uint32_t pps_stamp = 0;     /* Extended timestamp of last edge in bus ticks */
+static volatile uint32_t pps_ready = 0;     /* Set by ISR, cleared by consumer */
+static uint32_t pps_ticks_per_us = 60;      /* Bus ticks per microsecond */
+static uint32_t pps_offset = 0;             /* FTM0 count minus microsecond ticker in bus ticks */
+
+/**
+ * FTM0 interrupt, fired on PPS rising edge
+ */
+void pps_isr(){
+    if(FTM0->CONTROLS[1].CnSC & FTM_CnSC_CHF_MASK){
+        uint32_t fine = FTM0->CONTROLS[1].CnV;
+        uint32_t coarse = us_ticker_read() * pps_ticks_per_us + pps_offset;
+        /**
+         * Coarse timestamp is only few microseconds late (ISR latency), so we
+         * pick value closest to it that has same lower 16 bits as captured one
+         */
+        pps_stamp = coarse + (int16_t)(fine - (coarse & 0xFFFF));
+        pps_ready = 1;
+        FTM0->CONTROLS[1].CnSC &= ~FTM_CnSC_CHF_MASK;
+    }
+}
+
+/**
+ * Initialize FTM0 channel 1 input capture on PTC2
+ */
+inline void init_pps(){
+    pps_ticks_per_us = CLOCK_GetBusClkFreq() / 1000000;
+    SIM->SCGC5 |= SIM_SCGC5_PORTC_MASK;         /* Enable PORTC clock */
+    SIM->SCGC6 |= SIM_SCGC6_FTM0_MASK;          /* Enable FTM0 clock */
+    PORTC->PCR[2] = PORT_PCR_MUX(4);            /* PTC2 = FTM0_CH1 */
+    FTM0->MODE |= FTM_MODE_WPDIS_MASK;          /* Disable write protection */
+    FTM0->SC = 0;                               /* Stop counter while configuring */
+    FTM0->CNTIN = 0;
+    FTM0->MOD = 0xFFFF;                         /* Free running */
+    FTM0->CNT = 0;
+    FTM0->CONTROLS[1].CnSC = FTM_CnSC_ELSA_MASK | FTM_CnSC_CHIE_MASK;  /* Capture on rising edge */
+    NVIC_SetVector(FTM0_IRQn, (uintptr_t)pps_isr);
+    NVIC_EnableIRQ(FTM0_IRQn);
+    __disable_irq();
+    FTM0->SC = FTM_SC_CLKS(1) | FTM_SC_PS(0);   /* Bus clock, divide by 1 */
+    /**
+     * Microsecond reading is truncated, so offset is up to one microsecond
+     * off, which is well within half of counter range we resolve wraps with
+     */
+    uint32_t us = us_ticker_read();
+    pps_offset = FTM0->CNT - us * pps_ticks_per_us;
+    __enable_irq();
+}
+
+/**
+ * Fetch PPS timestamp if new edge arrived
+ */
+inline bool pps_read(uint32_t *stamp){
+    if(!pps_ready) return false;
+    __disable_irq();
+    *stamp = pps_stamp;
+    pps_ready = 0;
+    __enable_irq();
+    return true;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+/**
+ * Cycle counter profiler
+ *
+ * Code of interest is wrapped in PROFILE_START(stamp) / PROFILE_STOP(probe, stamp)
+ * (or PROFILE_ADD(probe, cycles) where cycles are measured anyway),
+ * each probe keeps min, mean, max and histogram of cycles in power of two bins
+ * (0, 1, 2-3, 4-7, ...). Main loop iterations are profiled per state, so probes
+ * 0 to 3 are states (BROADCASTING, TESTING, MEASURING, STANDBY), cycle counter
+ * stops in WFI, so STANDBY only shows time spent awake.
+ *
+ * Define PROFILE as 0 before including this file and all probes compile to nothing.
+ * Cost of probe itself is measured by profile_calibrate() into PROFILE_SELF.
+ *
+ * Platform provides PROFILE_CYCLES() before including this file, free running
+ * 32-bit cycle counter (DWT->CYCCNT on target).
+ */
+
+#ifndef PROFILE
+#define PROFILE 1
+#endif
+
+#define PROFILE_BINS 16
+
+#define PROFILE_TRANSMIT 4          /* Carrier of one sample */
+#define PROFILE_SAMPLE 5            /* Picking up sample and modulating it */
+#define PROFILE_ADC 6               /* ADC conversion complete interrupt */
+#define PROFILE_TASKS 7             /* Control tasks between samples */
+#define PROFILE_COMMAND 8           /* Applying console command */
+#define PROFILE_EVALUATION 9        /* Evaluating measurements */
+#define PROFILE_SELF 10             /* Empty probe, cost of profiling */
+#define PROFILE_PROBES 11
+
+struct profile_t {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t bins[PROFILE_BINS];
+};
+
+#if PROFILE
+
+static profile_t profiles[PROFILE_PROBES];
+static const char *profile_names[PROFILE_PROBES] = {
+    "broadcasting", "testing", "measuring", "standby",
+    "transmit", "sample", "adc", "tasks", "command", "evaluation", "self"
+};
+
+#define PROFILE_START(stamp) uint32_t stamp = PROFILE_CYCLES()
+#define PROFILE_STOP(probe, stamp) profile_add(&profiles[probe], PROFILE_CYCLES() - (stamp))
+#define PROFILE_ADD(probe, cycles) profile_add(&profiles[probe], cycles)
+
+inline void profile_reset(profile_t *profile){
+    profile->count = 0;
+    profile->min = 0xFFFFFFFF;
+    profile->max = 0;
+    profile->sum = 0;
+    for(unsigned int i=0; i<PROFILE_BINS; i++){
+        profile->bins[i] = 0;
+    }
+}
+
+inline void profile_add(profile_t *profile, uint32_t cycles){
+    unsigned int bin = 0;
+    while(cycles >> bin && bin < PROFILE_BINS - 1) bin++;
+    profile->bins[bin]++;
+    profile->count++;
+    profile->sum += cycles;
+    if(cycles < profile->min) profile->min = cycles;
+    if(cycles > profile->max) profile->max = cycles;
+}
+
+inline void profile_init(){
+    for(unsigned int i=0; i<PROFILE_PROBES; i++){
+        profile_reset(&profiles[i]);
+    }
+}
+
+/**
+ * Measure cost of empty probe
+ */
+inline void profile_calibrate(){
+    for(unsigned int i=0; i<16; i++){
+        PROFILE_START(stamp);
+        PROFILE_STOP(PROFILE_SELF, stamp);
+    }
+}
+
+#else
+
+#define PROFILE_START(stamp)
+#define PROFILE_STOP(probe, stamp)
+#define PROFILE_ADD(probe, cycles)
+inline void profile_init(){}
+inline void profile_calibrate(){}
+
+#endif
+
+#endif
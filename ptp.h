@@ -0,0 +1,311 @@
+#ifndef PTP_H
+#define PTP_H
+
+#include <stdint.h>
+
+/**
+ * Minimal IEEE 1588 (PTPv2) slave
+ *
+ * We only speak the subset needed by ordinary slave clock in end-to-end delay mode:
+ * Sync + Follow_Up (two-step) from grandmaster, Delay_Req from us and Delay_Resp back.
+ * Messages are transport agnostic, target sends them in raw ethernet frames,
+ * host simulation (tools/ptp_sim.cpp) sends them over UDP.
+ *
+ * There is no best master clock algorithm: source of first Sync heard in our
+ * domain becomes our master and only its messages are used from then on, until
+ * it stays silent for PTP_SILENT Syncs of other masters. Delay_Resp is only
+ * taken if it answers our own Delay_Req (requestingPortIdentity is ours).
+ *
+ * Our timer is never adjusted. Instead, we keep model of master's time as function
+ * of our local time and steer this model. Frequency part of the model is also
+ * what steers sample clock and carrier, same way as with PPS (see pll.h).
+ */
+
+#define PTP_SYNC 0x0
+#define PTP_DELAY_REQ 0x1
+#define PTP_FOLLOW_UP 0x8
+#define PTP_DELAY_RESP 0x9
+
+#define PTP_HEADER_LENGTH 34
+#define PTP_MESSAGE_LENGTH 44       /* Sync, Delay_Req and Follow_Up */
+#define PTP_RESPONSE_LENGTH 54      /* Delay_Resp */
+#define PTP_TWO_STEP 0x0200         /* twoStepFlag in flagField */
+#define PTP_PORT_IDENTITY 10        /* clockIdentity (8) + portNumber (2) */
+
+#define PTP_ACQUIRING 0     /* No offset measured yet */
+#define PTP_TRACKING 1      /* Servo is running */
+#define PTP_LOCKED 2        /* Offset stayed within PTP_LOCK_NS for PTP_LOCK_COUNT exchanges */
+
+#define PTP_KP 0.7f         /* Proportional gain, ppb per ns of offset per second */
+#define PTP_KI 0.3f         /* Integral gain */
+#define PTP_STEP_NS 1000000 /* Offset beyond which we step instead of slewing */
+#define PTP_LOCK_NS 2000    /* Offset considered to be locked */
+#define PTP_LOCK_COUNT 8    /* Amount of consecutive good exchanges required for lock */
+#define PTP_WINDOW 8        /* Amount of path delay samples in minimum filter */
+#define PTP_DOMAIN 0        /* domainNumber we follow (default profile) */
+#define PTP_SILENT 4        /* Syncs of other masters after which silent master is replaced */
+
+#define PTP_NS 1000000000ll
+
+struct ptp_message_t {
+    uint8_t type;           /* PTP_SYNC, PTP_DELAY_REQ, PTP_FOLLOW_UP or PTP_DELAY_RESP */
+    uint8_t domain;         /* domainNumber */
+    uint16_t flags;         /* flagField */
+    uint16_t sequence;      /* sequenceId */
+    int64_t correction;     /* correctionField in ns (sub-ns part is dropped) */
+    uint8_t source[PTP_PORT_IDENTITY];      /* sourcePortIdentity */
+    int64_t timestamp;      /* Origin or receive timestamp in ns */
+    uint8_t requesting[PTP_PORT_IDENTITY];  /* requestingPortIdentity, Delay_Resp only */
+};
+
+/**
+ * Write big-endian integer of given size
+ */
+inline void ptp_put(uint8_t *at, uint64_t value, unsigned int size){
+    while(size--){
+        at[size] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+/**
+ * Read big-endian integer of given size
+ */
+inline uint64_t ptp_get(const uint8_t *at, unsigned int size){
+    uint64_t value = 0;
+    for(unsigned int i=0; i<size; i++){
+        value = (value << 8) | at[i];
+    }
+    return value;
+}
+
+/**
+ * Serialize message, returns amount of bytes written
+ */
+inline unsigned int ptp_encode(const ptp_message_t *message, uint8_t *buffer){
+    unsigned int length = message->type == PTP_DELAY_RESP ? PTP_RESPONSE_LENGTH : PTP_MESSAGE_LENGTH;
+    for(unsigned int i=0; i<length; i++) buffer[i] = 0;
+    buffer[0] = message->type & 0x0F;
+    buffer[1] = 2;                                              /* versionPTP */
+    ptp_put(buffer + 2, length, 2);
+    buffer[4] = message->domain;
+    ptp_put(buffer + 6, message->flags, 2);
+    ptp_put(buffer + 8, (uint64_t)(message->correction << 16), 8);
+    for(unsigned int i=0; i<PTP_PORT_IDENTITY; i++) buffer[20 + i] = message->source[i];
+    ptp_put(buffer + 30, message->sequence, 2);
+    buffer[32] = message->type == PTP_SYNC ? 0 : message->type == PTP_DELAY_REQ ? 1 : message->type == PTP_FOLLOW_UP ? 2 : 3;
+    buffer[33] = message->type == PTP_DELAY_REQ ? 0x7F : 0;      /* logMessageInterval */
+    ptp_put(buffer + 34, (uint64_t)(message->timestamp / PTP_NS), 6);
+    ptp_put(buffer + 40, (uint64_t)(message->timestamp % PTP_NS), 4);
+    if(message->type == PTP_DELAY_RESP){
+        for(unsigned int i=0; i<PTP_PORT_IDENTITY; i++) buffer[44 + i] = message->requesting[i];
+    }
+    return length;
+}
+
+/**
+ * Parse message, returns false if it's not PTPv2 message we understand
+ */
+inline bool ptp_decode(const uint8_t *buffer, unsigned int length, ptp_message_t *message){
+    if(length < PTP_MESSAGE_LENGTH || (buffer[1] & 0x0F) != 2) return false;
+    message->type = buffer[0] & 0x0F;
+    if(message->type != PTP_SYNC && message->type != PTP_DELAY_REQ &&
+       message->type != PTP_FOLLOW_UP && message->type != PTP_DELAY_RESP) return false;
+    if(message->type == PTP_DELAY_RESP && length < PTP_RESPONSE_LENGTH) return false;
+    message->domain = buffer[4];
+    message->flags = (uint16_t)ptp_get(buffer + 6, 2);
+    message->correction = (int64_t)ptp_get(buffer + 8, 8) >> 16;
+    for(unsigned int i=0; i<PTP_PORT_IDENTITY; i++) message->source[i] = buffer[20 + i];
+    message->sequence = (uint16_t)ptp_get(buffer + 30, 2);
+    message->timestamp = (int64_t)ptp_get(buffer + 34, 6) * PTP_NS + (int64_t)ptp_get(buffer + 40, 4);
+    if(message->type == PTP_DELAY_RESP){
+        for(unsigned int i=0; i<PTP_PORT_IDENTITY; i++) message->requesting[i] = buffer[44 + i];
+    }
+    return true;
+}
+
+struct ptp_servo_t {
+    int64_t base_local;     /* Local time at which model was last rebased */
+    int64_t base_time;      /* Master time at base_local */
+    int32_t model_ppb;      /* Oscillator error used by model */
+    float integrator;       /* Integral part of oscillator error (ppb) */
+    float ppb;              /* Oscillator error, positive = we run fast */
+    int64_t t1;             /* Sync origin timestamp (master) */
+    int64_t t2;             /* Sync receive timestamp (local) */
+    int64_t t3;             /* Delay_Req send timestamp (local) */
+    int64_t last_t1;        /* Origin timestamp of last sync used by servo */
+    uint16_t sync;          /* Sequence of sync we wait follow up for */
+    uint16_t request;       /* Sequence of our last Delay_Req */
+    uint8_t identity[PTP_PORT_IDENTITY];    /* Our port identity */
+    uint8_t master[PTP_PORT_IDENTITY];      /* Port identity of master we follow */
+    bool selected;          /* Master was picked */
+    unsigned int silent;    /* Syncs of other masters since last one of ours */
+    int64_t window[PTP_WINDOW];     /* Recent path delay samples */
+    unsigned int samples;   /* Amount of path delay samples taken */
+    int64_t delay;          /* Mean path delay (ns) */
+    int64_t offset;         /* Last measured offset from master (ns) */
+    unsigned int good;      /* Consecutive exchanges within lock limit */
+    unsigned int state;     /* PTP_ACQUIRING, PTP_TRACKING or PTP_LOCKED */
+};
+
+/**
+ * Reset servo, `identity` is our port identity
+ */
+inline void ptp_init(ptp_servo_t *servo, const uint8_t *identity){
+    for(unsigned int i=0; i<PTP_PORT_IDENTITY; i++) servo->identity[i] = identity[i];
+    servo->selected = false;
+    servo->silent = 0;
+    servo->base_local = servo->base_time = 0;
+    servo->model_ppb = 0;
+    servo->integrator = servo->ppb = 0.0f;
+    servo->t1 = servo->t2 = servo->t3 = servo->last_t1 = 0;
+    servo->sync = servo->request = 0;
+    servo->samples = 0;
+    servo->delay = servo->offset = 0;
+    servo->good = 0;
+    servo->state = PTP_ACQUIRING;
+}
+
+/**
+ * Convert local timestamp to master's time using our model
+ */
+inline int64_t ptp_time(const ptp_servo_t *servo, int64_t local){
+    int64_t elapsed = local - servo->base_local;
+    return servo->base_time + elapsed - elapsed * servo->model_ppb / PTP_NS;
+}
+
+/**
+ * Change model so that it continues from current point with new frequency and phase
+ */
+inline void ptp_rebase(ptp_servo_t *servo, int64_t local, int64_t step){
+    servo->base_time = ptp_time(servo, local) + step;
+    servo->base_local = local;
+    servo->model_ppb = (int32_t)servo->ppb;
+}
+
+/**
+ * Run servo once whole exchange (t1 to t4) is known
+ *
+ * Our receive timestamps may be late (never early), while transmit timestamp
+ * is taken right before frame leaves and master stamps in hardware.
+ * So we estimate path delay as minimum of recent samples (offset cancels out in those)
+ * and take offset from slave to master direction only, which isn't disturbed by latency.
+ */
+inline void ptp_sample(ptp_servo_t *servo, int64_t t4){
+    int64_t forward = ptp_time(servo, servo->t2) - servo->t1;
+    int64_t backward = t4 - ptp_time(servo, servo->t3);
+
+    servo->window[servo->samples++ % PTP_WINDOW] = (forward + backward) / 2;
+    unsigned int n = servo->samples < PTP_WINDOW ? servo->samples : PTP_WINDOW;
+    servo->delay = servo->window[0];
+    for(unsigned int i=1; i<n; i++){
+        if(servo->window[i] < servo->delay) servo->delay = servo->window[i];
+    }
+    if(servo->delay < 0) servo->delay = 0;
+
+    servo->offset = servo->delay - backward;
+    int64_t interval = servo->t1 - servo->last_t1;
+    servo->last_t1 = servo->t1;
+
+    if(servo->state == PTP_ACQUIRING || servo->offset > PTP_STEP_NS || servo->offset < -PTP_STEP_NS){
+        /* First exchange or way off, step model to master's time */
+        ptp_rebase(servo, servo->t3, -servo->offset);
+        servo->good = 0;
+        servo->state = PTP_TRACKING;
+        return;
+    }
+    if(interval <= 0) return;
+
+    float seconds = (float)interval / (float)PTP_NS;
+    servo->integrator += PTP_KI * (float)servo->offset / seconds;
+    servo->ppb = servo->integrator + PTP_KP * (float)servo->offset / seconds;
+    ptp_rebase(servo, servo->t3, 0);
+
+    if(servo->offset <= PTP_LOCK_NS && servo->offset >= -PTP_LOCK_NS){
+        if(++servo->good >= PTP_LOCK_COUNT) servo->state = PTP_LOCKED;
+    } else {
+        servo->good = 0;
+        servo->state = PTP_TRACKING;
+    }
+}
+
+/**
+ * Whether port identities are equal
+ */
+inline bool ptp_same(const uint8_t *a, const uint8_t *b){
+    for(unsigned int i=0; i<PTP_PORT_IDENTITY; i++){
+        if(a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+/**
+ * Whether message comes from master we follow
+ * Sync of unknown master selects it if we have none yet, or ours went silent,
+ * servo starts over then as it's different time
+ */
+inline bool ptp_master(ptp_servo_t *servo, const ptp_message_t *message){
+    if(message->domain != PTP_DOMAIN) return false;
+    if(servo->selected && ptp_same(message->source, servo->master)){
+        if(message->type == PTP_SYNC) servo->silent = 0;
+        return true;
+    }
+    if(message->type != PTP_SYNC) return false;
+    if(servo->selected && ++servo->silent < PTP_SILENT) return false;
+    ptp_init(servo, servo->identity);
+    for(unsigned int i=0; i<PTP_PORT_IDENTITY; i++) servo->master[i] = message->source[i];
+    servo->selected = true;
+    return true;
+}
+
+/**
+ * Handle incoming message
+ * `local` is our timestamp of its reception
+ * Returns PTP_REQUEST when Delay_Req should be sent, PTP_UPDATED when servo ran, 0 otherwise
+ */
+#define PTP_REQUEST 1
+#define PTP_UPDATED 2
+
+inline unsigned int ptp_receive(ptp_servo_t *servo, const ptp_message_t *message, int64_t local){
+    if(!ptp_master(servo, message)) return 0;
+    switch(message->type){
+        case PTP_SYNC:
+            servo->sync = message->sequence;
+            servo->t2 = local - message->correction;
+            if(message->flags & PTP_TWO_STEP) return 0;
+            servo->t1 = message->timestamp;
+            return PTP_REQUEST;
+        case PTP_FOLLOW_UP:
+            if(message->sequence != servo->sync) return 0;
+            servo->t1 = message->timestamp + message->correction;
+            return PTP_REQUEST;
+        case PTP_DELAY_RESP:
+            if(message->sequence != servo->request || !ptp_same(message->requesting, servo->identity)) return 0;
+            ptp_sample(servo, message->timestamp - message->correction);
+            return PTP_UPDATED;
+    }
+    return 0;
+}
+
+/**
+ * Prepare Delay_Req, `local` is our timestamp of its transmission
+ */
+inline void ptp_request(ptp_servo_t *servo, ptp_message_t *message, int64_t local){
+    message->type = PTP_DELAY_REQ;
+    message->domain = PTP_DOMAIN;
+    message->flags = 0;
+    message->correction = 0;
+    message->sequence = ++servo->request;
+    message->timestamp = 0;
+    for(unsigned int i=0; i<PTP_PORT_IDENTITY; i++) message->source[i] = servo->identity[i];
+    servo->t3 = local;
+}
+
+/**
+ * Oscillator error in ppb, positive means we run fast (same sign as pll_ppb())
+ */
+inline int32_t ptp_ppb(const ptp_servo_t *servo){
+    return (int32_t)servo->integrator;
+}
+
+#endif
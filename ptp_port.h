@@ -0,0 +1,237 @@
+#ifndef PTP_PORT_H
+#define PTP_PORT_H
+
+#include <string.h>
+#include "mbed.h"
+#include "fsl_enet.h"
+#include "fsl_phy.h"
+#include "ptp.h"
+
+/**
+ * PTP transport on K64F
+ *
+ * Messages are carried directly in ethernet frames (IEEE 1588 annex F), so we
+ * don't need IP stack. Timestamps come from ENET's 1588 timer, clocked from
+ * 50 MHz OSCERCLK (PHY clock on FRDM-K64F) and wrapping every second.
+ *
+ * MAC and PHY are brought up by fsl_enet and fsl_phy drivers. Both timestamps
+ * are taken by MAC itself and read from enhanced buffer descriptors: receive
+ * one when frame starts to come in, transmit one when Delay_Req leaves.
+ * fsl_enet object linked from mbed library is built with legacy descriptors,
+ * without ENET_Ptp1588Configure() and ENET_Get{Rx,Tx}FrameTime(), so we switch
+ * ENET to enhanced descriptors ourselves and walk both rings here.
+ */
+
+#define PTP_ETHERTYPE 0x88F7
+#define PTP_FRAME 64            /* Ethernet header + largest message, padded */
+#define PTP_PHY 0               /* PHY address on FRDM-K64F */
+#define PTP_RX_BDS 4            /* Receive descriptors, frames are polled every loop */
+#define PTP_TX_BDS 2            /* Transmit descriptors, only Delay_Req goes out */
+#define PTP_BUFFER 1536         /* Receive buffer, whole frame (multiple of ENET_BUFF_ALIGNMENT) */
+#define PTP_BD_TIMESTAMP 0x2000 /* Transmit descriptor, second control word: stamp this frame */
+#define PTP_BD_TX_ERROR 0x8000  /* Transmit descriptor, first status word: frame not sent */
+
+/**
+ * Enhanced buffer descriptor (K64F reference manual, 45.6.2), same layout for
+ * both directions in fields we use. Timestamp is 1588 timer value (ns within second).
+ */
+struct ptp_bd_t {
+    uint16_t length;
+    uint16_t control;       /* ENET_BUFFDESCRIPTOR_RX_* or ENET_BUFFDESCRIPTOR_TX_* */
+    uint8_t *buffer;
+    uint16_t status;        /* Receive: frame status, transmit: errors */
+    uint16_t extend;        /* Transmit: PTP_BD_TIMESTAMP */
+    uint16_t reserved0[3];
+    uint16_t done;          /* Descriptor updated by DMA */
+    uint32_t timestamp;
+    uint16_t reserved1[4];
+};
+static_assert(sizeof(ptp_bd_t) == 32, "ENET enhanced buffer descriptor is 32 bytes");
+
+static volatile ptp_bd_t ptp_rx_bds[PTP_RX_BDS] __attribute__((aligned(ENET_BUFF_ALIGNMENT)));
+static volatile ptp_bd_t ptp_tx_bds[PTP_TX_BDS] __attribute__((aligned(ENET_BUFF_ALIGNMENT)));
+static uint8_t ptp_rx_buffers[PTP_RX_BDS][PTP_BUFFER] __attribute__((aligned(ENET_BUFF_ALIGNMENT)));
+static uint8_t ptp_tx_buffers[PTP_TX_BDS][PTP_BUFFER] __attribute__((aligned(ENET_BUFF_ALIGNMENT)));
+static unsigned int ptp_rx_next = 0;        /* Receive descriptor to be picked up next */
+static unsigned int ptp_tx_next = 0;        /* Transmit descriptor to be filled next */
+static volatile ptp_bd_t *ptp_tx_sent = 0;  /* Delay_Req waiting for its timestamp */
+static enet_handle_t ptp_handle;            /* Only used by ENET_Init() */
+
+static volatile uint32_t ptp_seconds = 0;  /* Seconds counted by 1588 timer */
+static uint8_t ptp_mac[6];                  /* Our MAC address */
+static uint8_t ptp_identity[PTP_PORT_IDENTITY]; /* Our port identity */
+static uint8_t ptp_multicast[6] = {0x01, 0x1B, 0x19, 0x00, 0x00, 0x00};
+
+/**
+ * 1588 timer wrapped, one more second passed
+ */
+void ptp_timer_isr(){
+    ENET->EIR = ENET_EIR_TS_TIMER_MASK;
+    ptp_seconds++;
+}
+
+/**
+ * Bring up PHY and MAC with enhanced descriptors and start 1588 timer
+ * Blocks until PHY finishes autonegotiation
+ */
+inline void init_ptp(){
+    mbed_mac_address((char*)ptp_mac);
+    /* clockIdentity is EUI-64 made from MAC, port number is 1 */
+    ptp_identity[0] = ptp_mac[0]; ptp_identity[1] = ptp_mac[1]; ptp_identity[2] = ptp_mac[2];
+    ptp_identity[3] = 0xFF; ptp_identity[4] = 0xFE;
+    ptp_identity[5] = ptp_mac[3]; ptp_identity[6] = ptp_mac[4]; ptp_identity[7] = ptp_mac[5];
+    ptp_identity[8] = 0; ptp_identity[9] = 1;
+
+    /* RMII pins, as mbed's K64F ethernet driver sets them up */
+    CLOCK_EnableClock(kCLOCK_PortA);
+    CLOCK_EnableClock(kCLOCK_PortB);
+    PORTA->PCR[5] = PORT_PCR_MUX(4);    /* RMII0_RXER */
+    PORTA->PCR[12] = PORT_PCR_MUX(4);   /* RMII0_RXD1 */
+    PORTA->PCR[13] = PORT_PCR_MUX(4);   /* RMII0_RXD0 */
+    PORTA->PCR[14] = PORT_PCR_MUX(4);   /* RMII0_CRS_DV */
+    PORTA->PCR[15] = PORT_PCR_MUX(4);   /* RMII0_TXEN */
+    PORTA->PCR[16] = PORT_PCR_MUX(4);   /* RMII0_TXD0 */
+    PORTA->PCR[17] = PORT_PCR_MUX(4);   /* RMII0_TXD1 */
+    PORTB->PCR[0] = PORT_PCR_MUX(4) | PORT_PCR_ODE_MASK | PORT_PCR_PE_MASK | PORT_PCR_PS_MASK;  /* RMII0_MDIO */
+    PORTB->PCR[1] = PORT_PCR_MUX(4);    /* RMII0_MDC */
+
+    uint32_t clock = CLOCK_GetFreq(kCLOCK_CoreSysClk);
+    enet_config_t config;
+    ENET_GetDefaultConfig(&config);
+    phy_speed_t speed;
+    phy_duplex_t duplex;
+    PHY_Init(ENET, PTP_PHY, clock);
+    PHY_GetLinkSpeedDuplex(ENET, PTP_PHY, &speed, &duplex);
+    config.miiSpeed = (enet_mii_speed_t)speed;
+    config.miiDuplex = (enet_mii_duplex_t)duplex;
+
+    /* Driver sets up MAC and ring addresses, descriptors are written again below in enhanced layout */
+    enet_buffer_config_t buffers = {
+        PTP_RX_BDS, PTP_TX_BDS, PTP_BUFFER, PTP_BUFFER,
+        (volatile enet_rx_bd_struct_t*)ptp_rx_bds, (volatile enet_tx_bd_struct_t*)ptp_tx_bds,
+        ptp_rx_buffers[0], ptp_tx_buffers[0]
+    };
+    ENET_Init(ENET, &ptp_handle, &config, &buffers, ptp_mac, clock);
+    ENET_AddMulticastGroup(ENET, ptp_multicast);
+
+    ENET->ECR &= ~ENET_ECR_ETHEREN_MASK;    /* Also rewinds DMA to start of both rings */
+    memset((void*)ptp_rx_bds, 0, sizeof(ptp_rx_bds));
+    memset((void*)ptp_tx_bds, 0, sizeof(ptp_tx_bds));
+    for(int i=0; i<PTP_RX_BDS; i++){
+        ptp_rx_bds[i].buffer = ptp_rx_buffers[i];
+        ptp_rx_bds[i].control = ENET_BUFFDESCRIPTOR_RX_EMPTY_MASK;
+    }
+    ptp_rx_bds[PTP_RX_BDS - 1].control |= ENET_BUFFDESCRIPTOR_RX_WRAP_MASK;
+    for(int i=0; i<PTP_TX_BDS; i++){
+        ptp_tx_bds[i].buffer = ptp_tx_buffers[i];
+    }
+    ptp_tx_bds[PTP_TX_BDS - 1].control = ENET_BUFFDESCRIPTOR_TX_WRAP_MASK;
+    ptp_rx_next = ptp_tx_next = 0;
+    ptp_tx_sent = 0;
+
+    SIM->SOPT2 = (SIM->SOPT2 & ~SIM_SOPT2_TIMESRC_MASK) | SIM_SOPT2_TIMESRC(2);  /* OSCERCLK */
+    ENET->ATCR = 0;
+    ENET->ATINC = ENET_ATINC_INC(20);           /* 20 ns per tick at 50 MHz */
+    ENET->ATPER = 1000000000;                   /* Wrap every second */
+    ENET->ATCOR = 0;
+    ENET->ATVR = 0;
+    ENET->EIR = ENET_EIR_TS_TIMER_MASK;
+    ENET->EIMR |= ENET_EIMR_TS_TIMER_MASK;
+    NVIC_SetVector(ENET_1588_Timer_IRQn, (uintptr_t)ptp_timer_isr);
+    NVIC_EnableIRQ(ENET_1588_Timer_IRQn);
+    ENET->ATCR = ENET_ATCR_PEREN_MASK | ENET_ATCR_PINPER_MASK | ENET_ATCR_EN_MASK;
+
+    ENET->ECR |= ENET_ECR_EN1588_MASK | ENET_ECR_ETHEREN_MASK;
+    ENET_ActiveRead(ENET);
+}
+
+/**
+ * Read 1588 timer in ns
+ */
+inline int64_t ptp_now(){
+    __disable_irq();
+    ENET->ATCR |= ENET_ATCR_CAPTURE_MASK;
+    __NOP(); __NOP(); __NOP(); __NOP();         /* Capture takes few timer clocks */
+    uint32_t ns = ENET->ATVR;
+    uint32_t seconds = ptp_seconds;
+    /* Timer might have wrapped before we got to the interrupt */
+    if((ENET->EIR & ENET_EIR_TS_TIMER_MASK) && ns < 500000000) seconds++;
+    __enable_irq();
+    return (int64_t)seconds * PTP_NS + ns;
+}
+
+/**
+ * Extend descriptor timestamp (ns within second) to full local time
+ * Stamps are picked up well within a second, so it belongs to this or previous second
+ */
+inline int64_t ptp_stamp(uint32_t ns){
+    int64_t now = ptp_now();
+    int64_t stamp = now - now % PTP_NS + ns;
+    return stamp > now ? stamp - PTP_NS : stamp;
+}
+
+/**
+ * Poll for PTP frame and run servo on it
+ * Answers every sync with Delay_Req
+ * Returns true if servo was updated
+ */
+inline bool ptp_poll(ptp_servo_t *servo){
+    static uint8_t frame[PTP_FRAME];
+
+    /* Delay_Req went out before master could answer it, so its stamp is ready before Delay_Resp */
+    if(ptp_tx_sent && !(ptp_tx_sent->control & ENET_BUFFDESCRIPTOR_TX_READY_MASK)){
+        if(ptp_tx_sent->status & PTP_BD_TX_ERROR) servo->request++;    /* Answer can't be used */
+        else servo->t3 = ptp_stamp(ptp_tx_sent->timestamp);
+        ptp_tx_sent = 0;
+    }
+
+    volatile ptp_bd_t *rx = &ptp_rx_bds[ptp_rx_next];
+    uint16_t control = rx->control;
+    if(control & ENET_BUFFDESCRIPTOR_RX_EMPTY_MASK) return false;
+    unsigned int size = rx->length;
+    int64_t local = ptp_stamp(rx->timestamp);
+    bool good = (control & ENET_BUFFDESCRIPTOR_RX_LAST_MASK) && !(control & ENET_BUFFDESCRIPTOR_RX_ERR_MASK);
+    if(size > PTP_FRAME) size = PTP_FRAME;
+    if(good) memcpy(frame, rx->buffer, size);
+    rx->control = (control & ENET_BUFFDESCRIPTOR_RX_WRAP_MASK) | ENET_BUFFDESCRIPTOR_RX_EMPTY_MASK;
+    ptp_rx_next = (ptp_rx_next + 1) % PTP_RX_BDS;
+    ENET_ActiveRead(ENET);
+    if(!good || size < 14 || ptp_get(frame + 12, 2) != PTP_ETHERTYPE) return false;
+
+    ptp_message_t message;
+    if(!ptp_decode(frame + 14, size - 14, &message)) return false;
+    unsigned int result = ptp_receive(servo, &message, local);
+    if(result != PTP_REQUEST) return result == PTP_UPDATED;
+
+    /* Ask for path delay after each sync, unless previous request is still stuck in MAC */
+    volatile ptp_bd_t *tx = &ptp_tx_bds[ptp_tx_next];
+    if(ptp_tx_sent || (tx->control & ENET_BUFFDESCRIPTOR_TX_READY_MASK)) return false;
+    uint8_t *out = tx->buffer;
+    for(int i=0; i<6; i++){
+        out[i] = ptp_multicast[i];
+        out[6 + i] = ptp_mac[i];
+    }
+    ptp_put(out + 12, PTP_ETHERTYPE, 2);
+    ptp_request(servo, &message, 0);    /* t3 comes with transmit stamp */
+    unsigned int length = 14 + ptp_encode(&message, out + 14);
+    while(length < 60) out[length++] = 0;
+    tx->length = length;
+    tx->status = 0;
+    tx->extend = PTP_BD_TIMESTAMP;
+    tx->control = (tx->control & ENET_BUFFDESCRIPTOR_TX_WRAP_MASK) | ENET_BUFFDESCRIPTOR_TX_READY_MASK |
+        ENET_BUFFDESCRIPTOR_TX_LAST_MASK | ENET_BUFFDESCRIPTOR_TX_TRANMITCRC_MASK;
+    ENET->TDAR = ENET_TDAR_TDAR_MASK;
+    ptp_tx_sent = tx;
+    ptp_tx_next = (ptp_tx_next + 1) % PTP_TX_BDS;
+    return false;
+}
+
+/**
+ * Busy wait until next whole second of master's time
+ */
+inline void ptp_wait_second(const ptp_servo_t *servo){
+    int64_t next = (ptp_time(servo, ptp_now()) / PTP_NS + 1) * PTP_NS;
+    while(ptp_time(servo, ptp_now()) < next);
+}
+
+#endif
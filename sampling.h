@@ -0,0 +1,102 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include "mbed.h"
+#include "fsl_clock.h"
+#include "events.h"
+#include "profile.h"
+
+/**
+ * Hardware paced audio sampling
+ *
+ * PDB0 triggers ADC0 conversion of A0 at sample rate, conversion complete
+ * interrupt stores result into ring buffer and posts EVENT_SAMPLE.
+ * This replaces ADC polling state machine, which needed four main loop
+ * iterations per sample and kept core busy even when there was nothing to do.
+ *
+ * Bus clock isn't whole multiple of sample rate (60 MHz / 22050 is 2721.09
+ * ticks) and is off by crystal error, so PDB period is dithered: interrupt
+ * picks length of the period after next one by sigma-delta, so that average
+ * sample rate is exact, corrected by discipline (sampling_steer()) if any.
+ */
+
+#define SAMPLES 8                   /* Ring buffer length, has to be power of two */
+
+static volatile uint16_t samples[SAMPLES];  /* Most recent samples */
+static volatile uint32_t samples_head = 0;  /* Amount of samples taken so far */
+static volatile uint32_t sampling_step = 0; /* Bus ticks per sample in Q16 */
+static uint32_t sampling_accumulator = 0;   /* Fractional ticks in Q16 */
+static unsigned int sampling_hz = 0;        /* Nominal sample rate */
+static int32_t sampling_ppb = 0;            /* Oscillator error, positive when we run fast */
+
+/**
+ * ADC0 conversion complete
+ */
+void sampling_isr(){
+    PROFILE_START(stamp);
+    uint32_t head = samples_head;
+    samples[head & (SAMPLES - 1)] = ADC0->R[0];    /* Reading result clears COCO */
+    samples_head = head + 1;
+    uint32_t ticks = sampling_accumulator + sampling_step;
+    sampling_accumulator = ticks & 0xFFFF;
+    PDB0->MOD = (ticks >> 16) - 1;              /* Loaded once current period ends */
+    PDB0->SC |= PDB_SC_LDOK_MASK;
+    events_post(&events, EVENT_SAMPLE);
+    PROFILE_STOP(PROFILE_ADC, stamp);
+}
+
+/**
+ * Bus ticks per sample for nominal rate and oscillator error
+ * Fast oscillator has more ticks in one true sample period
+ */
+inline void sampling_update(){
+    uint64_t step = ((uint64_t)CLOCK_GetBusClkFreq() << 16) / sampling_hz;
+    sampling_step = (uint32_t)(step + (int64_t)step * sampling_ppb / 1000000000);
+}
+
+/**
+ * Set PDB period for given sample rate
+ */
+inline void sampling_rate(unsigned int sample_rate){
+    sampling_hz = sample_rate;
+    sampling_update();
+    PDB0->MOD = (sampling_step >> 16) - 1;
+    PDB0->SC |= PDB_SC_LDOK_MASK;
+}
+
+/**
+ * Correct sample clock by oscillator error in ppb (from PLL or PTP servo)
+ */
+inline void sampling_steer(int32_t ppb){
+    sampling_ppb = ppb;
+    sampling_update();
+}
+
+/**
+ * Start sampling A0 (ADC0 channel 12) at given rate
+ * ADC has to be initialized by init_adc() first
+ */
+inline void init_sampling(unsigned int sample_rate){
+    SIM->SCGC6 |= SIM_SCGC6_PDB_MASK;           /* Enable PDB clock */
+    ADC0->CFG1 |= ADC_CFG1_ADIV(2);             /* Bus clock / 4, keep ADC clock within limits */
+    ADC0->SC2 |= ADC_SC2_ADTRG_MASK;            /* Hardware trigger (PDB by default) */
+    ADC0->SC1[0] = ADC_SC1_AIEN_MASK | (0x0C & ADC_SC1_ADCH_MASK); /* A0 with interrupt */
+    NVIC_SetVector(ADC0_IRQn, (uintptr_t)sampling_isr);
+    NVIC_EnableIRQ(ADC0_IRQn);
+
+    PDB0->SC = PDB_SC_TRGSEL(15) | PDB_SC_CONT_MASK | PDB_SC_PDBEN_MASK | PDB_SC_LDMOD(1);   /* Software trigger, continuous, MOD loaded at end of period */
+    PDB0->IDLY = 0;
+    PDB0->CH[0].C1 = PDB_C1_EN(1) | PDB_C1_TOS(1);  /* Pre-trigger 0 fires after delay */
+    PDB0->CH[0].DLY[0] = 0;
+    sampling_rate(sample_rate);
+    PDB0->SC |= PDB_SC_SWTRIG_MASK;             /* Start */
+}
+
+/**
+ * Most recent sample
+ */
+inline uint16_t sampling_latest(){
+    return samples[(samples_head - 1) & (SAMPLES - 1)];
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+
+/**
+ * Channel scan
+ *
+ * Steps through all channels of tuning cache (see hop.h), dwelling on each
+ * one and broadcasting ID tone whose pitch tells which channel it is.
+ * Carrier frequency actually generated during dwell comes from frequency
+ * counter (carrier edges against bus clock, see counter.h) when it's enabled
+ * and measured something on this channel, record is flagged SCAN_COUNTED then.
+ * Otherwise it's only worked out from cycle counter and periods transmitted,
+ * which is what carrier loop meant to do rather than what came out.
+ * Each dwell is sent out as binary record:
+ *
+ *   offset  size  content
+ *   0       1     SCAN_SYNC
+ *   1       1     channel number
+ *   2       4     nominal frequency in Hz
+ *   6       4     measured frequency in Hz
+ *   10      4     carrier bursts transmitted during dwell (two per audio sample)
+ *   14      1     flags, SCAN_LAST on last channel of scan, SCAN_COUNTED
+ *   15      1     XOR of bytes 0-14
+ *
+ * Multi-byte fields are little endian. Records share serial port with text
+ * output and telemetry frames (all queued whole in telemetry ring, see
+ * telemetry.h), readers should look for sync byte and check XOR.
+ */
+
+#define SCAN_SYNC 0xA5
+#define SCAN_RECORD 16              /* Length of record */
+#define SCAN_LAST 0x01
+#define SCAN_COUNTED 0x02           /* Measured by frequency counter, not from cycle counter */
+#define SCAN_TONE 500               /* ID tone of channel 0 in Hz */
+#define SCAN_TONE_STEP 25           /* ID tone increment per channel in Hz */
+
+struct scan_t {
+    unsigned int channel;           /* Channel we are dwelling on */
+    uint64_t cycles;                /* Cycles spent transmitting */
+    uint64_t periods;               /* Periods transmitted */
+    unsigned int samples;           /* Bursts transmitted */
+};
+
+inline void scan_begin(scan_t *scan, unsigned int channel){
+    scan->channel = channel;
+    scan->cycles = 0;
+    scan->periods = 0;
+    scan->samples = 0;
+}
+
+/**
+ * Account one transmitted burst
+ */
+inline void scan_add(scan_t *scan, uint32_t cycles, unsigned int periods){
+    scan->cycles += cycles;
+    scan->periods += periods;
+    scan->samples++;
+}
+
+/**
+ * Carrier frequency generated during dwell in Hz
+ */
+inline uint32_t scan_frequency(const scan_t *scan, uint32_t clock){
+    return scan->cycles ? (uint32_t)((scan->periods * clock + scan->cycles / 2) / scan->cycles) : 0;
+}
+
+/**
+ * ID tone frequency of channel in Hz
+ */
+inline unsigned int scan_tone(unsigned int channel){
+    return SCAN_TONE + channel * SCAN_TONE_STEP;
+}
+
+/**
+ * Encode record into buffer of SCAN_RECORD bytes
+ */
+inline unsigned int scan_encode(const scan_t *scan, uint32_t nominal, uint32_t measured, uint8_t flags, uint8_t *buffer){
+    buffer[0] = SCAN_SYNC;
+    buffer[1] = scan->channel;
+    for(unsigned int i=0; i<4; i++){
+        buffer[2 + i] = nominal >> (8 * i);
+        buffer[6 + i] = measured >> (8 * i);
+        buffer[10 + i] = scan->samples >> (8 * i);
+    }
+    buffer[14] = flags;
+    buffer[15] = 0;
+    for(unsigned int i=0; i<SCAN_RECORD - 1; i++){
+        buffer[15] ^= buffer[i];
+    }
+    return SCAN_RECORD;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+/**
+ * Cooperative scheduler for control work
+ *
+ * Main loop calls sched_run() between samples with budget of cycles it can
+ * spare. Tasks are stackless coroutines: they return after each slice of
+ * work and continue where they left off next time (locals don't survive
+ * yield, keep state in statics).
+ *
+ *   unsigned int blink(task_t *task){
+ *       TASK_BEGIN(task);
+ *       TASK_WAIT(task, button);
+ *       led = 1;
+ *       TASK_YIELD(task);
+ *       led = 0;
+ *       TASK_END(task);
+ *   }
+ *
+ * Periodic task gets released every `period` (in units of `now` given to
+ * sched_run(), microseconds on target) and misses deadline if its job isn't
+ * done before next release. Task with period 0 runs whenever it has work.
+ * Tasks take turns, each slice is measured and task only gets to run if its
+ * longest slice so far fits into what is left of the budget. First task
+ * of each call always runs, so that no task can starve.
+ *
+ * Platform provides SCHED_CYCLES() before including this file, free running
+ * 32-bit cycle counter (DWT->CYCCNT on target, virtual one on host, see tools/sched_sim.cpp).
+ */
+
+#define SCHED_TASKS 8               /* Maximum amount of tasks */
+
+#define TASK_IDLE 0                 /* Task had nothing to do */
+#define TASK_BUSY 1                 /* Task did slice of work and has more */
+#define TASK_DONE 2                 /* Task finished its job */
+
+#define TASK_BEGIN(task) switch((task)->line){ case 0:
+#define TASK_YIELD(task) do { (task)->line = __LINE__; return TASK_BUSY; case __LINE__:; } while(0)
+#define TASK_WAIT(task, condition) do { (task)->line = __LINE__; [[fallthrough]]; case __LINE__: if(!(condition)) return TASK_IDLE; } while(0)
+#define TASK_END(task) } (task)->line = 0; return TASK_DONE
+
+struct task_t {
+    const char *name;
+    unsigned int (*run)(task_t *task);
+    unsigned int line;              /* Where coroutine continues */
+    uint32_t period;                /* Time between releases, 0 if task isn't periodic */
+    uint32_t release;               /* When current job was released */
+    uint32_t budget;                /* Cycles one slice is allowed to take */
+    uint32_t worst;                 /* Longest slice in cycles */
+    uint32_t slices;                /* Slices run */
+    uint32_t jobs;                  /* Jobs finished */
+    uint32_t overruns;              /* Slices that took longer than budget */
+    uint32_t misses;                /* Jobs finished after deadline */
+};
+
+struct sched_t {
+    task_t *tasks[SCHED_TASKS];
+    unsigned int count;
+    unsigned int next;              /* Task that gets the first chance next time */
+    uint32_t worst;                 /* Longest sched_run() in cycles */
+};
+
+inline void sched_init(sched_t *sched){
+    sched->count = 0;
+    sched->next = 0;
+    sched->worst = 0;
+}
+
+/**
+ * Add task, periodic one gets its first release at `now`
+ */
+inline void sched_add(sched_t *sched, task_t *task, const char *name, unsigned int (*run)(task_t*),
+        uint32_t period, uint32_t budget, uint32_t now){
+    task->name = name;
+    task->run = run;
+    task->line = 0;
+    task->period = period;
+    task->release = now;
+    task->budget = budget;
+    task->worst = task->slices = task->jobs = task->overruns = task->misses = 0;
+    if(sched->count < SCHED_TASKS) sched->tasks[sched->count++] = task;
+}
+
+/**
+ * Run slices of ready tasks until budget is used up
+ */
+inline void sched_run(sched_t *sched, uint32_t now, uint32_t budget){
+    uint32_t begin = SCHED_CYCLES(), used = 0;
+    unsigned int first = sched->next;
+    bool ran = false;
+    for(unsigned int i=0; i<sched->count && used < budget; i++){
+        unsigned int position = (first + i) % sched->count;
+        task_t *task = sched->tasks[position];
+        if(task->period && (int32_t)(now - task->release) < 0) continue;   /* Not released yet */
+        if(ran && task->worst > budget - used) continue;                    /* Wouldn't fit */
+
+        uint32_t start = SCHED_CYCLES();
+        unsigned int result = task->run(task);
+        uint32_t spent = SCHED_CYCLES() - start;
+        used += spent;
+        if(result == TASK_IDLE) continue;
+
+        ran = true;
+        sched->next = (position + 1) % sched->count;
+        task->slices++;
+        if(spent > task->worst) task->worst = spent;
+        if(spent > task->budget) task->overruns++;
+        if(result == TASK_DONE){
+            task->jobs++;
+            if(task->period){
+                if((int32_t)(now - (task->release + task->period)) > 0) task->misses++;
+                task->release += task->period;
+                if((int32_t)(now - task->release) >= (int32_t)task->period) task->release = now; /* Whole period behind, don't try to catch up */
+            }
+        }
+    }
+    uint32_t spent = SCHED_CYCLES() - begin;
+    if(spent > sched->worst) sched->worst = spent;
+}
+
+#endif
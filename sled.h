@@ -0,0 +1,86 @@
+#ifndef SLED_H
+#define SLED_H
+
+#include <stdint.h>
+
+/**
+ * Double buffered delay sleds
+ *
+ * Sled is an array of NOPs (BF00) with BR LX (4770) at `index`, executing it
+ * delays by `index` instructions. Together with amount of periods per sample
+ * this is all tuning there is.
+ *
+ * We keep two sleds. Carrier runs from the active one while new tuning is
+ * written into the other one, switch happens only when carrier loop asks
+ * for it at the start of sample (which is also period boundary), so no period is
+ * ever cut short or stretched and carrier phase stays continuous. Retune
+ * takes effect at most one sample after it was requested.
+ *
+ * sled_prepare() and sled_switch() are both called from main loop.
+ */
+
+#define MAX_OPCODES 80      /* Maximum length of instructions buffer */
+#define SLED_NOP 0xBF00
+#define SLED_RET 0x4770
+
+struct sled_t {
+    uint16_t opcodes[2][MAX_OPCODES];   /* Instructions buffers */
+    unsigned int index[2];              /* Where BR LX is located in each buffer */
+    unsigned int periods[2];            /* Periods per sample for each buffer */
+    unsigned int active;                /* Buffer carrier runs from */
+    bool pending;                       /* Other buffer holds new tuning */
+};
+
+inline void sled_init(sled_t *sled, unsigned int index, unsigned int periods){
+    for(unsigned int b=0; b<2; b++){
+        for(unsigned int i=0; i<MAX_OPCODES; i++){
+            sled->opcodes[b][i] = SLED_NOP;
+        }
+        sled->opcodes[b][index] = SLED_RET;
+        sled->index[b] = index;
+        sled->periods[b] = periods;
+    }
+    sled->active = 0;
+    sled->pending = false;
+}
+
+/**
+ * Write new tuning into inactive buffer
+ * Preparing again before switch simply replaces previous tuning
+ */
+inline void sled_prepare(sled_t *sled, unsigned int index, unsigned int periods){
+    unsigned int b = sled->active ^ 1;
+    sled->opcodes[b][sled->index[b]] = SLED_NOP;
+    sled->opcodes[b][index] = SLED_RET;
+    sled->index[b] = index;
+    sled->periods[b] = periods;
+    sled->pending = true;
+}
+
+/**
+ * Make prepared tuning active, to be called only at period boundary
+ * Returns true if tuning changed
+ */
+inline bool sled_switch(sled_t *sled){
+    if(!sled->pending) return false;
+    sled->active ^= 1;
+    sled->pending = false;
+    return true;
+}
+
+/**
+ * Active buffer and its tuning
+ */
+inline const uint16_t *sled_opcodes(const sled_t *sled){
+    return sled->opcodes[sled->active];
+}
+
+inline unsigned int sled_index(const sled_t *sled){
+    return sled->index[sled->active];
+}
+
+inline unsigned int sled_periods(const sled_t *sled){
+    return sled->periods[sled->active];
+}
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+/**
+ * Binary telemetry
+ *
+ * Frames of fixed layout are written into ring buffer and drained to serial
+ * port by control task, so that nothing formats text or waits for UART
+ * between samples. Frame is:
+ *
+ *   offset  size  content
+ *   0       1     TELEMETRY_SYNC
+ *   1       1     type
+ *   2       1     payload length
+ *   3       n     payload
+ *   3 + n   1     XOR of all previous bytes
+ *
+ * Multi-byte fields are little endian. Text output and scan records go through
+ * the same ring (telemetry_write()), so none of them ever lands in the middle of
+ * another, readers look for sync byte and check length and XOR
+ * (tools/telemetry_decode.cpp does that). Frame, line or record that doesn't fit
+ * into ring is dropped whole, never cut.
+ *
+ * Status payload (TELEMETRY_STATUS):
+ *
+ *   offset  size  content
+ *   0       4     sequence number of status frame (gap means status frame was dropped)
+ *   4       4     time in ms
+ *   8       1     state (BROADCASTING 0, TESTING 1, MEASURING 2, STANDBY 3)
+ *   9       1     audio source
+ *   10      1     modulation depth in percent
+ *   11      1     flags, TELEMETRY_*
+ *   12      4     channel frequency in Hz
+ *   16      4     carrier frequency measured by counter in Hz, 0 if not counting
+ *   20      4     samples broadcast
+ *   24      2     drift in samples per second (signed)
+ *   26      2     carrier load in per mille of sample period
+ *   28      2     total load in per mille of sample period
+ *   30      2     audio peak since previous frame (0-32768)
+ *   32      2     audio mean absolute level since previous frame
+ *   34      2     sample rate in Hz
+ *
+ * Headroom payload (TELEMETRY_HEADROOM), last complete window of headroom.h:
+ *
+ *   offset  size  content
+ *   0       4     window number
+ *   4       4     cycles per burst period (half of sample period)
+ *   8       4     worst burst in cycles
+ *   12      2     sample rate in Hz
+ *   14      2     source stage in per mille of burst period
+ *   16      2     control stage in per mille
+ *   18      2     carrier stage in per mille
+ *   20      2     other stage in per mille
+ *   22      2     padding in per mille (signed, negative when bursts were late)
+ *   24      1     flags, TELEMETRY_LIGHT
+ *   25      1     switches to light profile so far (saturates at 255)
+ *
+ * Monitor payload (TELEMETRY_MONITOR), window of monitor.h:
+ *
+ *   offset  size  content
+ *   0       4     window number
+ *   4       2     modulation depth in per mille
+ *   6       2     overmodulation events
+ *   8       2     envelope THD+N against audio in 0.1 dB (signed)
+ *   10      2     mean envelope (12-bit)
+ *   12      2     lowest envelope (12-bit)
+ *   14      2     highest envelope (12-bit)
+ *   16      1     envelope delay after audio in samples (signed)
+ *   17      1     flags, TELEMETRY_QUIET
+ */
+
+#define TELEMETRY_SYNC 0x5A
+#define TELEMETRY_RING 2048         /* Ring size, power of two */
+#define TELEMETRY_OVERHEAD 4        /* Sync, type, length and XOR */
+
+#define TELEMETRY_STATUS 1          /* Status frame type */
+#define TELEMETRY_STATUS_LENGTH 36
+#define TELEMETRY_TRACE 2           /* Event trace frame type, payload is described in trace.h */
+#define TELEMETRY_HEADROOM 3        /* Headroom frame type */
+#define TELEMETRY_HEADROOM_LENGTH 26
+#define TELEMETRY_MONITOR 4         /* Modulation monitor frame type */
+#define TELEMETRY_MONITOR_LENGTH 18
+
+#define TELEMETRY_HOPPING 0x01
+#define TELEMETRY_SCANNING 0x02
+#define TELEMETRY_REALTIME 0x04
+#define TELEMETRY_COUNTING 0x08
+
+#define TELEMETRY_LIGHT 0x01        /* Headroom flag, light profile is in use */
+#define TELEMETRY_QUIET 0x01        /* Monitor flag, audio was too quiet to measure distortion */
+
+struct telemetry_status_t {
+    uint32_t sequence;
+    uint32_t time;
+    uint8_t state;
+    uint8_t source;
+    uint8_t depth;
+    uint8_t flags;
+    uint32_t channel;
+    uint32_t measured;
+    uint32_t bursts;
+    int16_t drift;
+    uint16_t carrier_load;
+    uint16_t total_load;
+    uint16_t peak;
+    uint16_t level;
+    uint16_t sample_rate;
+};
+
+struct telemetry_headroom_t {
+    uint32_t window;
+    uint32_t period;
+    uint32_t worst;
+    uint16_t sample_rate;
+    uint16_t stages[4];             /* Source, control, carrier, other */
+    int16_t padding;
+    uint8_t flags;
+    uint8_t fallbacks;
+};
+
+struct telemetry_monitor_t {
+    uint32_t window;
+    uint16_t depth;
+    uint16_t events;
+    int16_t distortion;
+    uint16_t level;
+    uint16_t min;
+    uint16_t max;
+    int8_t lag;
+    uint8_t flags;
+};
+
+/**
+ * Ring has one writer and one reader, each only moves its own index
+ */
+struct telemetry_t {
+    uint8_t ring[TELEMETRY_RING];
+    volatile uint32_t head;         /* Written by producer */
+    volatile uint32_t tail;         /* Written by consumer */
+    uint32_t frames;                /* Frames written */
+    uint32_t dropped;               /* Frames, lines and records that didn't fit */
+};
+
+inline void telemetry_init(telemetry_t *telemetry){
+    telemetry->head = 0;
+    telemetry->tail = 0;
+    telemetry->frames = 0;
+    telemetry->dropped = 0;
+}
+
+/**
+ * Space left in ring
+ */
+inline unsigned int telemetry_free(const telemetry_t *telemetry){
+    return TELEMETRY_RING - (telemetry->head - telemetry->tail);
+}
+
+/**
+ * Write frame, returns false if it didn't fit
+ */
+inline bool telemetry_frame(telemetry_t *telemetry, uint8_t type, const uint8_t *payload, unsigned int length){
+    uint32_t head = telemetry->head;
+    if(telemetry_free(telemetry) < length + TELEMETRY_OVERHEAD){
+        telemetry->dropped++;
+        return false;
+    }
+    uint8_t check = TELEMETRY_SYNC ^ type ^ length;
+    telemetry->ring[head++ & (TELEMETRY_RING - 1)] = TELEMETRY_SYNC;
+    telemetry->ring[head++ & (TELEMETRY_RING - 1)] = type;
+    telemetry->ring[head++ & (TELEMETRY_RING - 1)] = length;
+    for(unsigned int i=0; i<length; i++){
+        check ^= payload[i];
+        telemetry->ring[head++ & (TELEMETRY_RING - 1)] = payload[i];
+    }
+    telemetry->ring[head++ & (TELEMETRY_RING - 1)] = check;
+    telemetry->head = head;         /* Publish whole frame at once */
+    telemetry->frames++;
+    return true;
+}
+
+/**
+ * Write line of text or record with framing of its own (see scan.h) as it is,
+ * returns false if it didn't fit
+ */
+inline bool telemetry_write(telemetry_t *telemetry, const void *data, unsigned int length){
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t head = telemetry->head;
+    if(telemetry_free(telemetry) < length){
+        telemetry->dropped++;
+        return false;
+    }
+    for(unsigned int i=0; i<length; i++){
+        telemetry->ring[head++ & (TELEMETRY_RING - 1)] = bytes[i];
+    }
+    telemetry->head = head;
+    return true;
+}
+
+/**
+ * Contiguous bytes waiting to be sent, up to end of ring
+ */
+inline unsigned int telemetry_peek(const telemetry_t *telemetry, const uint8_t **data){
+    uint32_t tail = telemetry->tail, used = telemetry->head - tail;
+    unsigned int offset = tail & (TELEMETRY_RING - 1);
+    *data = telemetry->ring + offset;
+    return used < TELEMETRY_RING - offset ? used : TELEMETRY_RING - offset;
+}
+
+/**
+ * Given amount of bytes was sent
+ */
+inline void telemetry_consume(telemetry_t *telemetry, unsigned int count){
+    telemetry->tail = telemetry->tail + count;
+}
+
+inline void telemetry_put(uint8_t *buffer, uint32_t value, unsigned int size){
+    for(unsigned int i=0; i<size; i++){
+        buffer[i] = value >> (8 * i);
+    }
+}
+
+inline uint32_t telemetry_get(const uint8_t *buffer, unsigned int size){
+    uint32_t value = 0;
+    for(unsigned int i=0; i<size; i++){
+        value |= (uint32_t)buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * Encode and write status frame
+ */
+inline bool telemetry_status(telemetry_t *telemetry, const telemetry_status_t *status){
+    uint8_t payload[TELEMETRY_STATUS_LENGTH];
+    telemetry_put(payload + 0, status->sequence, 4);
+    telemetry_put(payload + 4, status->time, 4);
+    payload[8] = status->state;
+    payload[9] = status->source;
+    payload[10] = status->depth;
+    payload[11] = status->flags;
+    telemetry_put(payload + 12, status->channel, 4);
+    telemetry_put(payload + 16, status->measured, 4);
+    telemetry_put(payload + 20, status->bursts, 4);
+    telemetry_put(payload + 24, (uint16_t)status->drift, 2);
+    telemetry_put(payload + 26, status->carrier_load, 2);
+    telemetry_put(payload + 28, status->total_load, 2);
+    telemetry_put(payload + 30, status->peak, 2);
+    telemetry_put(payload + 32, status->level, 2);
+    telemetry_put(payload + 34, status->sample_rate, 2);
+    return telemetry_frame(telemetry, TELEMETRY_STATUS, payload, TELEMETRY_STATUS_LENGTH);
+}
+
+/**
+ * Decode status payload, for readers
+ */
+inline void telemetry_unpack_status(const uint8_t *payload, telemetry_status_t *status){
+    status->sequence = telemetry_get(payload + 0, 4);
+    status->time = telemetry_get(payload + 4, 4);
+    status->state = payload[8];
+    status->source = payload[9];
+    status->depth = payload[10];
+    status->flags = payload[11];
+    status->channel = telemetry_get(payload + 12, 4);
+    status->measured = telemetry_get(payload + 16, 4);
+    status->bursts = telemetry_get(payload + 20, 4);
+    status->drift = (int16_t)telemetry_get(payload + 24, 2);
+    status->carrier_load = telemetry_get(payload + 26, 2);
+    status->total_load = telemetry_get(payload + 28, 2);
+    status->peak = telemetry_get(payload + 30, 2);
+    status->level = telemetry_get(payload + 32, 2);
+    status->sample_rate = telemetry_get(payload + 34, 2);
+}
+
+/**
+ * Encode and write headroom frame
+ */
+inline bool telemetry_headroom(telemetry_t *telemetry, const telemetry_headroom_t *headroom){
+    uint8_t payload[TELEMETRY_HEADROOM_LENGTH];
+    telemetry_put(payload + 0, headroom->window, 4);
+    telemetry_put(payload + 4, headroom->period, 4);
+    telemetry_put(payload + 8, headroom->worst, 4);
+    telemetry_put(payload + 12, headroom->sample_rate, 2);
+    for(unsigned int i=0; i<4; i++){
+        telemetry_put(payload + 14 + 2 * i, headroom->stages[i], 2);
+    }
+    telemetry_put(payload + 22, (uint16_t)headroom->padding, 2);
+    payload[24] = headroom->flags;
+    payload[25] = headroom->fallbacks;
+    return telemetry_frame(telemetry, TELEMETRY_HEADROOM, payload, TELEMETRY_HEADROOM_LENGTH);
+}
+
+/**
+ * Decode headroom payload, for readers
+ */
+inline void telemetry_unpack_headroom(const uint8_t *payload, telemetry_headroom_t *headroom){
+    headroom->window = telemetry_get(payload + 0, 4);
+    headroom->period = telemetry_get(payload + 4, 4);
+    headroom->worst = telemetry_get(payload + 8, 4);
+    headroom->sample_rate = telemetry_get(payload + 12, 2);
+    for(unsigned int i=0; i<4; i++){
+        headroom->stages[i] = telemetry_get(payload + 14 + 2 * i, 2);
+    }
+    headroom->padding = (int16_t)telemetry_get(payload + 22, 2);
+    headroom->flags = payload[24];
+    headroom->fallbacks = payload[25];
+}
+
+/**
+ * Encode and write monitor frame
+ */
+inline bool telemetry_monitor(telemetry_t *telemetry, const telemetry_monitor_t *monitor){
+    uint8_t payload[TELEMETRY_MONITOR_LENGTH];
+    telemetry_put(payload + 0, monitor->window, 4);
+    telemetry_put(payload + 4, monitor->depth, 2);
+    telemetry_put(payload + 6, monitor->events, 2);
+    telemetry_put(payload + 8, (uint16_t)monitor->distortion, 2);
+    telemetry_put(payload + 10, monitor->level, 2);
+    telemetry_put(payload + 12, monitor->min, 2);
+    telemetry_put(payload + 14, monitor->max, 2);
+    payload[16] = (uint8_t)monitor->lag;
+    payload[17] = monitor->flags;
+    return telemetry_frame(telemetry, TELEMETRY_MONITOR, payload, TELEMETRY_MONITOR_LENGTH);
+}
+
+/**
+ * Decode monitor payload, for readers
+ */
+inline void telemetry_unpack_monitor(const uint8_t *payload, telemetry_monitor_t *monitor){
+    monitor->window = telemetry_get(payload + 0, 4);
+    monitor->depth = telemetry_get(payload + 4, 2);
+    monitor->events = telemetry_get(payload + 6, 2);
+    monitor->distortion = (int16_t)telemetry_get(payload + 8, 2);
+    monitor->level = telemetry_get(payload + 10, 2);
+    monitor->min = telemetry_get(payload + 12, 2);
+    monitor->max = telemetry_get(payload + 14, 2);
+    monitor->lag = (int8_t)payload[16];
+    monitor->flags = payload[17];
+}
+
+#endif
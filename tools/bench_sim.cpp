@@ -0,0 +1,22 @@
+/**
+ * Benchmark firmware (bench.cpp) on host simulation
+ *
+ * Same benchmarks as on board, timed by cost model of sim/sim.h instead of
+ * silicon, records go to stdout and can be put next to board runs by
+ * bench_table. Numbers show how far cost model is from board; it only charges
+ * peripheral accesses, so kernels that just compute come out at about 0 cycles.
+ *
+ * Build: g++ -std=c++17 -O2 -fno-pie -no-pie -Isim -I.. bench_sim.cpp -o bench_sim
+ * Usage: ./bench_sim > sim.log
+ */
+#define exec(op) sim_exec(op)
+#define BENCH_HOST
+#define BENCH_BUILD sim
+#include "bench.cpp"
+
+int main(){
+    sim_start(120.0, stdout, 0, 0.0);   /* Limit is only a safety net */
+    bench_run();
+    sim_finish();
+    return 0;
+}
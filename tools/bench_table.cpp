@@ -0,0 +1,135 @@
+/**
+ * Comparison table of benchmark runs
+ *
+ * Each file is serial output of one run of benchmark firmware (bench.cpp) on
+ * a board, or output of bench_sim. "Bench:" records are picked out of it,
+ * anything else is ignored, so whole console logs can be given. Records are
+ * "Bench: test=<name>, <parameter>=<value>, ..., <result>=<value>", row of
+ * the table is test with its parameters and result name, column is run
+ * (build name and board ID from build record). Rows are kept in order they
+ * first appeared in.
+ *
+ * Build: g++ -std=c++17 -O2 bench_table.cpp -o bench_table
+ * Usage: ./bench_table [-c] run.log ...
+ *        -c prints CSV instead of aligned columns
+ */
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+struct run_t {
+    std::string name;
+    std::map<std::string, std::string> values;  /* By row */
+};
+
+/**
+ * Split record into row and result, false if it isn't record
+ */
+static bool parse(const char *line, std::string *row, std::string *result){
+    const char *text = strstr(line, "Bench: ");
+    if(!text) return false;
+    std::string record(text + 7);
+    while(!record.empty() && (record.back() == '\n' || record.back() == '\r')) record.pop_back();
+    size_t last = record.rfind(", ");
+    if(last == std::string::npos) return false;
+    size_t equals = record.find('=', last);
+    if(equals == std::string::npos) return false;
+    *row = record.substr(0, equals);
+    *result = record.substr(equals + 1);
+    return true;
+}
+
+/**
+ * Build record has several results, each becomes its own row
+ */
+static void build(const std::string &record, run_t *run, std::vector<std::string> *rows){
+    size_t start = 0;
+    while(start < record.size()){
+        size_t end = record.find(", ", start);
+        if(end == std::string::npos) end = record.size();
+        std::string field = record.substr(start, end - start);
+        size_t equals = field.find('=');
+        if(equals != std::string::npos && field.compare(0, 5, "test=")){
+            std::string row = "test=build, " + field.substr(0, equals);
+            if(!run->values.count(row) && std::find(rows->begin(), rows->end(), row) == rows->end()) rows->push_back(row);
+            run->values[row] = field.substr(equals + 1);
+        }
+        start = end + 2;
+    }
+}
+
+int main(int argc, char **argv){
+    bool csv = false;
+    int first = 1;
+    if(argc > 1 && !strcmp(argv[1], "-c")){
+        csv = true;
+        first = 2;
+    }
+    if(first >= argc){
+        fprintf(stderr, "Usage: %s [-c] run.log ...\n", argv[0]);
+        return 1;
+    }
+    std::vector<run_t> runs;
+    std::vector<std::string> rows;
+    for(int a=first; a<argc; a++){
+        FILE *file = fopen(argv[a], "r");
+        if(!file){
+            fprintf(stderr, "%s: can't read\n", argv[a]);
+            return 1;
+        }
+        run_t run;
+        char line[512];
+        while(fgets(line, sizeof(line), file)){
+            std::string row, result;
+            if(!parse(line, &row, &result)) continue;
+            if(!row.compare(0, 11, "test=build,")){
+                const char *text = strstr(line, "Bench: ") + 7;
+                build(std::string(text, strcspn(text, "\r\n")), &run, &rows);
+                continue;
+            }
+            if(std::find(rows.begin(), rows.end(), row) == rows.end()) rows.push_back(row);
+            run.values[row] = result;
+        }
+        fclose(file);
+        if(run.values.empty()){
+            fprintf(stderr, "%s: no records\n", argv[a]);
+            continue;
+        }
+        run.name = run.values.count("test=build, name") ? run.values["test=build, name"] : argv[a];
+        if(run.values.count("test=build, board")) run.name += "@" + run.values["test=build, board"].substr(8);
+        runs.push_back(run);
+    }
+
+    size_t width = 4;
+    for(const std::string &row : rows) width = std::max(width, row.size());
+    std::vector<size_t> widths;
+    for(const run_t &run : runs){
+        size_t w = run.name.size();
+        for(const auto &value : run.values) w = std::max(w, value.second.size());
+        widths.push_back(w);
+    }
+    if(csv){
+        printf("\"row\"");
+        for(const run_t &run : runs) printf(",\"%s\"", run.name.c_str());
+        printf("\n");
+    } else {
+        printf("%-*s", (int)width, "row");
+        for(size_t r=0; r<runs.size(); r++) printf("  %*s", (int)widths[r], runs[r].name.c_str());
+        printf("\n");
+    }
+    for(const std::string &row : rows){
+        if(csv) printf("\"%s\"", row.c_str());
+        else printf("%-*s", (int)width, row.c_str());
+        for(size_t r=0; r<runs.size(); r++){
+            auto found = runs[r].values.find(row);
+            const char *value = found == runs[r].values.end() ? "-" : found->second.c_str();
+            if(csv) printf(",\"%s\"", value);
+            else printf("  %*s", (int)widths[r], value);
+        }
+        printf("\n");
+    }
+    return 0;
+}
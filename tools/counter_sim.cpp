@@ -0,0 +1,152 @@
+/**
+ * Host test of carrier frequency counter
+ *
+ * Synthesizes edges of carrier as FTM1 would capture them: periods with
+ * gaussian jitter, stretch at every sample boundary, occasional longer pause
+ * for control work and carrier frequency slowly drifting. Batches of captures
+ * are fed to counter.h the same way counter task does. Halfway through carrier
+ * is retuned to neighbouring channel, to check counter finds new reference.
+ * Reports measured against true frequency, jitter histogram and drift log.
+ *
+ * Build: g++ -std=c++17 -O2 -I.. counter_sim.cpp -o counter_sim
+ * Usage: ./counter_sim [carrier Hz] [jitter ticks rms] [drift ppm/s] [seconds] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "counter.h"
+
+static const uint32_t clock_hz = 60000000;     /* Bus clock of K64F */
+static const unsigned int sample_rate = 22050;
+static const double batch_interval = 0.1;      /* Counter task period in seconds */
+
+static uint64_t rng = 88172645463325252ull;
+
+static double uniform(){
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double gaussian(){
+    double u = uniform(), v = uniform();
+    if(u < 1e-12) u = 1e-12;
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/**
+ * Carrier as seen by capture timer
+ */
+struct carrier_t {
+    double frequency;               /* Frequency within sample, without drift */
+    double ppm;                     /* Current drift */
+    double time;                    /* Time of last edge in ticks */
+    unsigned int periods;           /* Periods per sample */
+    unsigned int period;            /* Period within sample */
+};
+
+/**
+ * Time of next rising edge in ticks, `length` gets length of period within sample,
+ * 0 if period crossed sample boundary
+ */
+static double next_edge(carrier_t *carrier, double jitter, double *length){
+    double frequency = carrier->frequency * (1.0 + carrier->ppm * 1e-6);
+    *length = clock_hz / frequency + jitter * gaussian();
+    carrier->time += *length;
+    if(++carrier->period == carrier->periods){
+        carrier->period = 0;
+        carrier->time += 10 + 20 * uniform();                   /* Loop overhead between samples */
+        if(uniform() < 0.3) carrier->time += 50 + 250 * uniform();    /* Control task slice */
+        *length = 0.0;
+    }
+    return carrier->time;
+}
+
+static void print_stats(const counter_t *counter, double truth){
+    const counter_stats_t *total = &counter->total;
+    double measured = counter_frequency(counter, clock_hz) / 1000.0;
+    printf("  measured=%.3f Hz, true=%.3f Hz, error=%.3f ppm\n", measured, truth, (measured - truth) / truth * 1e6);
+    printf("  periods=%llu, gaps=%u, batches=%u, rejected=%u, period=%u-%u ticks\n", (unsigned long long)total->periods,
+        total->gaps, counter->batches, counter->rejected, total->min, total->max);
+    printf("  jitter bins (%d..%d ticks from mean):", -COUNTER_SPAN, COUNTER_SPAN);
+    for(unsigned int i=0; i<COUNTER_BINS; i++){
+        printf(" %u", total->bins[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv){
+    double frequency = argc > 1 ? atof(argv[1]) : 1008000.0;
+    double jitter = argc > 2 ? atof(argv[2]) : 0.5;
+    double drift = argc > 3 ? atof(argv[3]) : 0.5;
+    int seconds = argc > 4 ? atoi(argv[4]) : 20;
+    if(argc > 5) rng = strtoull(argv[5], 0, 10) | 1;
+
+    carrier_t carrier = {frequency, 0.0, 0.0, (unsigned int)(0.9 * frequency / sample_rate), 0};
+    counter_t counter;
+    counter_init(&counter);
+
+    /* True frequency is worked out from actual lengths of periods within samples */
+    double log_truth[COUNTER_LOG], truth_sum = 0.0, second_sum = 0.0;
+    uint64_t truth_n = 0, second_n = 0;
+    unsigned int logged = 0;
+    int batches = (int)(seconds / batch_interval), per_second = (int)(1.0 / batch_interval + 0.5);
+
+    printf("carrier=%.0f Hz, jitter=%.2f ticks rms, drift=%.2f ppm/s, %d s\n", frequency, jitter, drift, seconds);
+    for(int b=0; b<batches; b++){
+        if(b == batches / 2){
+            printf("before retune:\n");
+            print_stats(&counter, truth_n * (double)clock_hz / truth_sum);
+            carrier.frequency += 9000;
+            counter_rebase(&counter);       /* Drops statistics and drift log of old carrier */
+            truth_sum = second_sum = 0.0;
+            truth_n = second_n = 0;
+            logged = 0;
+        }
+
+        /* Batch is consecutive edges, carrier runs on between batches */
+        uint16_t captures[COUNTER_EDGES];
+        uint64_t sum_n = 0;
+        double sum = 0.0, length;
+        for(unsigned int i=0; i<COUNTER_EDGES; i++){
+            captures[i] = (uint16_t)(uint64_t)floor(next_edge(&carrier, jitter, &length));
+            if(i && length > 0.0){
+                sum += length;
+                sum_n++;
+            }
+        }
+        counter_begin(&counter);
+        for(unsigned int i=0; i<COUNTER_EDGES; i++){
+            counter_edge(&counter, captures[i]);
+        }
+        if(counter_end(&counter)){
+            truth_sum += sum;
+            truth_n += sum_n;
+            second_sum += sum;
+            second_n += sum_n;
+        }
+        carrier.time += batch_interval * clock_hz;
+        carrier.ppm += drift * batch_interval;
+
+        if(b % per_second == per_second - 1){
+            counter_log(&counter, clock_hz);
+            if(second_n) log_truth[logged++ % COUNTER_LOG] = second_n * (double)clock_hz / second_sum;
+            second_sum = 0.0;
+            second_n = 0;
+        }
+    }
+    printf("after retune:\n");
+    print_stats(&counter, truth_n * (double)clock_hz / truth_sum);
+
+    printf("drift log (measured - true, mHz):");
+    unsigned int kept = logged < COUNTER_LOG ? logged : COUNTER_LOG, first = logged - kept;
+    double worst = 0.0;
+    for(unsigned int i=0; i<kept; i++){
+        double error = counter_logged(&counter, i) - log_truth[(first + i) % COUNTER_LOG] * 1000.0;
+        if(fabs(error) > fabs(worst)) worst = error;
+        printf(" %.0f", error);
+    }
+    printf("\n  worst=%.0f mHz, drift over log=%.0f mHz\n", worst, (double)counter_logged(&counter, kept - 1) - counter_logged(&counter, 0));
+    return 0;
+}
@@ -0,0 +1,108 @@
+#ifndef DAC_TRACE_H
+#define DAC_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Reader of DAC traces written by transmitter_sim (see sim_start() in sim/sim.h)
+ *
+ * Trace is list of DAC writes stamped with core cycle. DAC holds value until
+ * next write, so output is piecewise constant and can be resampled exactly:
+ * each output sample is mean of DAC over its interval of `step` cycles, which
+ * is also a (weak) low pass against aliasing. Values are scaled to 0..1.
+ */
+
+#define DAC_TRACE_RECORD 6          /* Cycles since previous record (u32), value (u16) */
+#define DAC_TRACE_BUFFER 4096       /* Records read at once */
+#define DAC_TRACE_END UINT64_MAX
+
+struct dac_trace_t {
+    FILE *file;
+    uint32_t clock;                 /* Cycles per second */
+    uint64_t start;                 /* Cycle of first record */
+    double position;                /* Cycle next output sample starts at */
+    uint16_t value;                 /* Value at position */
+    uint64_t next;                  /* Cycle of next record, DAC_TRACE_END after last one */
+    uint16_t next_value;
+    uint8_t buffer[DAC_TRACE_BUFFER * DAC_TRACE_RECORD];
+    size_t length, offset;          /* Bytes in buffer and bytes used */
+};
+
+/**
+ * Move to next record, DAC_TRACE_END once there is none
+ */
+inline void dac_trace_advance(dac_trace_t *trace){
+    if(trace->offset + DAC_TRACE_RECORD > trace->length){
+        size_t left = trace->length - trace->offset;
+        memmove(trace->buffer, trace->buffer + trace->offset, left);
+        trace->length = left + fread(trace->buffer + left, 1, sizeof(trace->buffer) - left, trace->file);
+        trace->offset = 0;
+        if(trace->length < DAC_TRACE_RECORD){
+            trace->next = DAC_TRACE_END;
+            return;
+        }
+    }
+    const uint8_t *record = trace->buffer + trace->offset;
+    trace->next += record[0] | record[1] << 8 | record[2] << 16 | (uint32_t)record[3] << 24;
+    trace->next_value = record[4] | record[5] << 8;
+    trace->offset += DAC_TRACE_RECORD;
+}
+
+/**
+ * Open trace, output starts at its first record, false if it isn't trace
+ */
+inline bool dac_trace_open(dac_trace_t *trace, FILE *file){
+    uint8_t header[16];
+    if(!file || fread(header, 1, 16, file) != 16 || memcmp(header, "DACT", 4)) return false;
+    trace->file = file;
+    memcpy(&trace->clock, header + 4, 4);
+    memcpy(&trace->start, header + 8, 8);
+    trace->length = trace->offset = 0;
+    trace->next = trace->start;
+    dac_trace_advance(trace);
+    if(trace->next == DAC_TRACE_END) return false;
+    trace->position = trace->next;
+    trace->value = trace->next_value;
+    dac_trace_advance(trace);
+    return true;
+}
+
+/**
+ * Resample up to `count` samples of `step` cycles, returns how many there were
+ * before trace ended
+ */
+inline size_t dac_trace_read(dac_trace_t *trace, double step, float *output, size_t count){
+    size_t produced = 0;
+    while(produced < count){
+        double from = trace->position, end = from + step, area = 0;
+        while((double)trace->next <= end){
+            area += trace->value * ((double)trace->next - from);
+            from = (double)trace->next;
+            trace->value = trace->next_value;
+            dac_trace_advance(trace);
+        }
+        if(trace->next == DAC_TRACE_END) break;
+        area += trace->value * (end - from);
+        output[produced++] = (float)(area / (step * 65536.0));
+        trace->position = end;
+    }
+    return produced;
+}
+
+/**
+ * Write trace header, for tools that synthesize traces
+ */
+inline void dac_trace_header(FILE *file, uint32_t clock, uint64_t start){
+    fwrite("DACT", 1, 4, file);
+    fwrite(&clock, sizeof(clock), 1, file);
+    fwrite(&start, sizeof(start), 1, file);
+}
+
+inline void dac_trace_write(FILE *file, uint32_t delta, uint16_t value){
+    fwrite(&delta, sizeof(delta), 1, file);
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+#endif
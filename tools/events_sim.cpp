@@ -0,0 +1,118 @@
+/**
+ * Host simulation of event loop scheduling
+ *
+ * Runs main loop structure of main.cpp against simulated interrupt source:
+ * ADC completes at sample rate and PPS edge arrives every second. Time is virtual
+ * (core cycles), so WFI simply jumps to next interrupt.
+ * Reports idle percentage per state (from events.h accounting), worst latency
+ * between interrupt and main loop picking up its event, and lost samples.
+ *
+ * Build: g++ -std=c++17 -O2 -I.. events_sim.cpp -o events_sim
+ * Usage: ./events_sim [sample rate] [standby seconds] [broadcast seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+static uint64_t now = 0;        /* Virtual core cycle counter */
+static void sleep_until_interrupt();
+
+#define EVENTS_NOW() ((uint32_t)now)
+#define EVENTS_SLEEP() sleep_until_interrupt()
+#define EVENTS_LOCK()
+#define EVENTS_UNLOCK()
+#include "events.h"
+
+#define STANDBY 3
+#define MEASURING 2
+#define TESTING 1
+#define BROADCASTING 0
+
+static const uint64_t clock_hz = 120000000;    /* K64F core clock */
+static const uint64_t isr_cycles = 40;         /* Cost of ADC interrupt incl. entry and exit */
+
+static uint64_t sample_period, next_sample, next_pps;
+static uint64_t posted_at = 0;          /* When oldest untaken sample event was posted */
+static unsigned int lost = 0;           /* Samples overwritten before main loop took them */
+
+/**
+ * Fire all interrupts due until now
+ */
+static void interrupts(){
+    while(next_sample <= now || next_pps <= now){
+        if(next_sample <= next_pps){
+            if(events.pending & EVENT_SAMPLE) lost++;
+            else posted_at = next_sample;
+            events_post(&events, EVENT_SAMPLE);
+            next_sample += sample_period;
+        } else {
+            events_post(&events, EVENT_PPS);
+            next_pps += clock_hz;
+        }
+        now += isr_cycles;
+    }
+}
+
+/**
+ * Main loop does some work
+ */
+static void work(uint64_t cycles){
+    now += cycles;
+    interrupts();
+}
+
+static void sleep_until_interrupt(){
+    uint64_t next = next_sample < next_pps ? next_sample : next_pps;
+    if(next > now) now = next;
+    interrupts();
+}
+
+int main(int argc, char **argv){
+    uint64_t sample_rate = argc > 1 ? atoi(argv[1]) : 22050;
+    double standby = argc > 2 ? atof(argv[2]) : 3.0;
+    double broadcast = argc > 3 ? atof(argv[3]) : 2.0;
+
+    const uint64_t period_cycles = 214;            /* One carrier period around 558 kHz */
+    const uint64_t periods = clock_hz / period_cycles / sample_rate / 2; /* Same rule as TESTING in main.cpp */
+
+    sample_period = clock_hz / sample_rate;
+    next_sample = sample_period;
+    next_pps = clock_hz;
+
+    unsigned int ready_state = STANDBY;
+    uint64_t latency[EVENTS_STATES] = {0}, samples = 0;
+    events_init(&events, ready_state);
+
+    uint64_t end_standby = (uint64_t)(standby * clock_hz), end = end_standby + (uint64_t)(broadcast * clock_hz);
+    while(now < end){
+        uint32_t pending = events_take(&events);
+        if(pending & EVENT_SAMPLE){
+            if(now - posted_at > latency[ready_state]) latency[ready_state] = now - posted_at;
+            samples++;
+        }
+        work(30);   /* Loop overhead, discipline polling etc. */
+
+        if(ready_state == STANDBY && now >= end_standby){
+            ready_state = BROADCASTING;
+            events_state(&events, ready_state);
+        }
+
+        switch(ready_state){
+            case STANDBY:
+                events_wait(&events);
+                break;
+            case BROADCASTING:
+                work(periods * period_cycles);
+                break;
+        }
+    }
+    events_state(&events, ready_state);
+
+    printf("sample rate=%u Hz, periods per loop=%u\n", (unsigned int)sample_rate, (unsigned int)periods);
+    printf("standby: idle=%u.%u%%, worst latency=%u cycles\n", events_idle(&events, STANDBY) / 10,
+        events_idle(&events, STANDBY) % 10, (unsigned int)latency[STANDBY]);
+    printf("broadcasting: idle=%u.%u%%, worst latency=%u cycles\n", events_idle(&events, BROADCASTING) / 10,
+        events_idle(&events, BROADCASTING) % 10, (unsigned int)latency[BROADCASTING]);
+    printf("samples taken=%u, lost=%u\n", (unsigned int)samples, lost);
+    return 0;
+}
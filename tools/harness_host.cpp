@@ -0,0 +1,61 @@
+/**
+ * Bit-exact kernel harness on host (see harness.h)
+ *
+ * Runs every kernel on the same input as target does, checks output against
+ * golden hash and prints nanoseconds per input sample. Target prints the same
+ * from benchmark image (`Bench: test=kernel` records), in core cycles.
+ *   -g         print golden table with hashes of this build, to paste into harness.h
+ *   -d name    write output words of given kernel to stdout, one per line, for diffing
+ *              against another build when hashes differ
+ * Exits with 1 if any kernel doesn't match.
+ *
+ * Build: g++ -std=c++17 -O2 -I.. harness_host.cpp -o harness_host
+ * Usage: ./harness_host [-g] [-d kernel]
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+static inline uint32_t harness_nanoseconds(){
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000000000ull + now.tv_nsec);
+}
+#define HARNESS_NOW() harness_nanoseconds()
+#include "harness.h"
+
+static void print_word(uint32_t word){
+    printf("%08x\n", (unsigned int)word);
+}
+
+int main(int argc, char **argv){
+    bool golden = argc > 1 && !strcmp(argv[1], "-g");
+    const char *dump = argc > 2 && !strcmp(argv[1], "-d") ? argv[2] : 0;
+    if(argc > 1 && !golden && !dump){
+        fprintf(stderr, "Usage: %s [-g] [-d kernel]\n", argv[0]);
+        return 1;
+    }
+    static uint16_t input[HARNESS_LENGTH];
+    harness_input(input, HARNESS_LENGTH);
+    int failures = 0;
+    for(unsigned int k=0; k<HARNESS_KERNELS; k++){
+        const harness_kernel_t *kernel = &harness_kernels[k];
+        if(dump && strcmp(dump, kernel->name)) continue;
+        harness_result_t result = harness_check(kernel, input, HARNESS_LENGTH, dump ? print_word : 0);
+        if(dump) return 0;
+        if(golden){
+            printf("    {\"%s\", harness_%s, 0x%08x},\n", kernel->name, kernel->name, (unsigned int)result.hash);
+            continue;
+        }
+        printf("kernel=%s, words=%u, hash=%08x, golden=%08x, ns/sample=%.2f %s\n", kernel->name, (unsigned int)result.words,
+            (unsigned int)result.hash, (unsigned int)kernel->golden, (double)result.best / HARNESS_LENGTH, result.exact ? "ok" : "MISMATCH");
+        if(!result.exact) failures++;
+    }
+    if(dump){
+        fprintf(stderr, "%s: no such kernel\n", dump);
+        return 1;
+    }
+    if(!golden) printf("failures=%d\n", failures);
+    return failures ? 1 : 0;
+}
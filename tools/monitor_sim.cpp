@@ -0,0 +1,119 @@
+/**
+ * Host test of modulation monitor
+ *
+ * Synthesizes audio the way main loop sends it (tone with modulation depth)
+ * and envelope the way ADC1 would see it through RC filter: half of sample
+ * value, delayed by few samples, with gain and offset error, noise and
+ * optional soft compression of peaks. Windows are fed to monitor.h in slices
+ * the same way monitor task does and results are compared with floating point
+ * reference of the same quantities.
+ *
+ * Build: g++ -std=c++17 -O2 -I.. monitor_sim.cpp -o monitor_sim
+ * Usage: ./monitor_sim [depth %] [tone Hz] [noise LSB rms] [compression %] [delay samples, 0-4] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "monitor.h"
+
+static const unsigned int sample_rate = 22050;
+static const int windows = 8;
+
+static uint64_t rng = 88172645463325252ull;
+
+static double uniform(){
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double gaussian(){
+    double u = uniform(), v = uniform();
+    if(u < 1e-12) u = 1e-12;
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/**
+ * THD+N of envelope against audio at given delay, least squares in floating point
+ */
+static double reference_distortion(const uint16_t *envelope, const uint16_t *audio, int delay){
+    double n = 0, e = 0, r = 0, ee = 0, rr = 0, er = 0;
+    for(int i=MONITOR_LAG; i<MONITOR_BLOCK - MONITOR_LAG; i++){
+        double x = audio[i - delay] >> 4, y = envelope[i] >> 4;
+        n++;
+        e += y;
+        r += x;
+        ee += y * y;
+        rr += x * x;
+        er += x * y;
+    }
+    double sxx = rr - r * r / n, syy = ee - e * e / n, sxy = er - e * r / n;
+    double explained = sxy * sxy / sxx;
+    return 10.0 * log10((syy - explained) / explained);
+}
+
+int main(int argc, char **argv){
+    double depth = argc > 1 ? atof(argv[1]) / 100.0 : 0.8;
+    double tone = argc > 2 ? atof(argv[2]) : 1000.0;
+    double noise = argc > 3 ? atof(argv[3]) : 8.0;
+    double compression = argc > 4 ? atof(argv[4]) / 100.0 : 0.0;
+    int delay = argc > 5 ? atoi(argv[5]) : 2;
+    if(delay < 0 || delay > MONITOR_LAG) delay = 2;     /* Envelope can only follow audio */
+    if(argc > 6) rng = strtoull(argv[6], 0, 10) | 1;
+
+    printf("depth=%.0f%%, tone=%.0f Hz, noise=%.1f LSB rms, compression=%.0f%%, delay=%d samples\n",
+        depth * 100.0, tone, noise, compression * 100.0, delay);
+    monitor_t monitor;
+    monitor_init(&monitor);
+    uint16_t audio[MONITOR_BLOCK + MONITOR_LAG], envelope[MONITOR_BLOCK];
+    double phase = 0.0, worst = 0.0;
+    int failures = 0;
+    for(int w=0; w<windows; w++){
+        /* Audio starts MONITOR_LAG samples early, so that delayed envelope has history */
+        for(int i=0; i<MONITOR_BLOCK + MONITOR_LAG; i++){
+            double s = depth * sin(phase);
+            phase += 2.0 * M_PI * tone / sample_rate;
+            int value = (int)(32768 + 32767 * s);
+            audio[i] = value < 0 ? 0 : value > 65535 ? 65535 : value;
+        }
+        const uint16_t *sent = audio + MONITOR_LAG;
+        double emin = 1e9, emax = 0;
+        for(int i=0; i<MONITOR_BLOCK; i++){
+            double x = (sent[i - delay] - 32768) / 32768.0;
+            x = x - compression * x * x * x;              /* Soft compression of peaks */
+            double e = 0.97 * 0.5 * (32768 + 32768 * x) + 40 + noise * 16 * gaussian();
+            envelope[i] = e < 0 ? 0 : e > 65535 ? 65535 : (uint16_t)e;
+            if(envelope[i] >> 4 < emin) emin = envelope[i] >> 4;
+            if(envelope[i] >> 4 > emax) emax = envelope[i] >> 4;
+        }
+
+        monitor_begin(&monitor);
+        for(int i=0; i<MONITOR_BLOCK; i++){
+            monitor_record(&monitor, sent[i]);
+        }
+        for(int i=0; i<MONITOR_BLOCK; i+=MONITOR_SLICE){
+            monitor_block(&monitor, envelope, i, MONITOR_SLICE);
+        }
+        for(int lag=-MONITOR_LAG; lag<=MONITOR_LAG; lag++){
+            monitor_fit(&monitor, lag);
+        }
+        monitor_end(&monitor);
+
+        const monitor_result_t *r = &monitor.last;
+        double expected_depth = (emax - emin) / (emax + emin) * 1000.0;
+        double expected = reference_distortion(envelope, sent, delay);
+        bool quiet = !isfinite(expected) || depth < 0.02;
+        double error = quiet ? 0.0 : r->distortion / 10.0 - expected;
+        if(fabs(error) > fabs(worst)) worst = error;
+        if(fabs(r->depth - expected_depth) > 1.0) failures++;
+        if(quiet != !!(r->flags & MONITOR_QUIET_FLAG)) failures++;
+        /* Gain rounding shows near 12-bit quantization floor, which loopback never gets close to */
+        if(!quiet && (r->lag != delay || fabs(error) > (expected > -55.0 ? 0.2 : 2.0))) failures++;
+        printf("  window %d: depth=%u (%.0f) per mille, events=%u, distortion=%.1f (%.1f) dB, level=%u, min=%u, max=%u, lag=%d%s\n",
+            w, r->depth, expected_depth, r->events, r->distortion / 10.0, expected, r->level, r->min, r->max, r->lag,
+            r->flags & MONITOR_QUIET_FLAG ? " quiet" : "");
+    }
+    printf("worst distortion error=%.2f dB, failures=%d\n", worst, failures);
+    return failures ? 1 : 0;
+}
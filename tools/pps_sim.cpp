@@ -0,0 +1,120 @@
+/**
+ * Host simulation of PPS discipline loop
+ *
+ * Generates PPS edges as seen by FTM0 of a board whose crystal is off by given amount
+ * of ppm and slowly wanders, adds timestamp jitter and feeds them into pll.h.
+ * Reports time to lock and residual frequency error after lock. With final
+ * correction, it then works out sample clock (PDB period dithered like
+ * sampling.h does) and carrier steered to 1008 kHz channel at 22050 Hz (square
+ * waveform, measurements synthesized like tools/tuning_check.cpp does) and
+ * reports their error in true time, next to carrier at closest location alone.
+ *
+ * Build: g++ -std=c++17 -O2 -I.. pps_sim.cpp -o pps_sim
+ * Usage: ./pps_sim [offset ppm] [jitter ns rms] [seconds] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "pll.h"
+
+#define CLOCK 120000000.0
+#define MEASURE_PERIODS 100000      /* As in main.cpp */
+#define LOCATIONS 78
+#define STEER_BURSTS 1000000        /* Bursts carrier is averaged over */
+
+static uint64_t rng = 88172645463325252ull;
+
+/**
+ * xorshift64, so that runs are reproducible across platforms
+ */
+static double uniform(){
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double gaussian(){
+    double u = uniform(), v = uniform();
+    if(u < 1e-12) u = 1e-12;
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+int main(int argc, char **argv){
+    double offset = argc > 1 ? atof(argv[1]) : 23.4;        /* Crystal error in ppm */
+    double jitter = argc > 2 ? atof(argv[2]) : 50.0;        /* PPS jitter in ns rms */
+    int seconds = argc > 3 ? atoi(argv[3]) : 600;           /* Simulated time */
+    if(argc > 4) rng = strtoull(argv[4], 0, 10) | 1;
+
+    const uint32_t nominal = 60000000;  /* Bus clock of K64F */
+    const double wander = 0.002;        /* Random walk of crystal frequency, ppm per sqrt(s) */
+
+    pll_t pll;
+    pll_init(&pll, nominal);
+
+    double error = offset, local = 0.0;
+    int lock_time = -1;
+    double sum = 0.0, sum2 = 0.0, worst = 0.0, phase2 = 0.0;
+    int samples = 0;
+
+    for(int s = 0; s < seconds; s++){
+        /* Local timer counts one true second worth of ticks at its current rate */
+        local += nominal * (1.0 + error * 1e-6);
+        error += wander * gaussian();
+        double observed = local + jitter * 1e-9 * nominal * gaussian();
+        unsigned int state = pll_update(&pll, (uint32_t)(uint64_t)llround(observed));
+
+        if(state == PLL_LOCKED && lock_time < 0) lock_time = s;
+        if(lock_time >= 0 && s >= seconds / 2){
+            double residual = pll_ppb(&pll) * 1e-3 - error;     /* in ppm */
+            sum += residual;
+            sum2 += residual * residual;
+            phase2 += (double)pll.phase * pll.phase;
+            if(fabs(residual) > worst) worst = fabs(residual);
+            samples++;
+        }
+    }
+
+    printf("offset=%.3f ppm jitter=%.1f ns seconds=%d\n", offset, jitter, seconds);
+    if(lock_time < 0){
+        printf("lock: never\n");
+        return 1;
+    }
+    printf("lock: %d s\n", lock_time);
+    if(samples){
+        double mean = sum / samples;
+        printf("residual frequency error: mean=%.4f ppm rms=%.4f ppm worst=%.4f ppm\n",
+            mean, sqrt(sum2 / samples), worst);
+        printf("phase error: rms=%.1f ns\n", sqrt(phase2 / samples) * 1e9 / nominal);
+    }
+
+    /* Sample clock, average of dithered PDB period */
+    const unsigned int rate = 22050;
+    uint64_t step = ((uint64_t)nominal << 16) / rate;
+    step += (int64_t)step * pll_ppb(&pll) / 1000000000;
+    double true_rate = nominal * (1.0 + error * 1e-6) / (step / 65536.0);
+    printf("sample clock: %.4f Hz, error=%.4f ppm\n", true_rate, (true_rate / rate - 1.0) * 1e6);
+
+    /* Carrier: cycles per period is straight line in location (square), measured in local microseconds */
+    unsigned int measurements[LOCATIONS];
+    double cycles[LOCATIONS];
+    for(unsigned int i=0; i<LOCATIONS; i++){
+        cycles[i] = 111.06 + 2.034 * i;
+        measurements[i] = (unsigned int)lround(MEASURE_PERIODS * cycles[i] / (CLOCK / 1000000));
+    }
+    const tune_t target = TUNE_HZ(1008000) - TUNE_HZ(rate) / 2;
+    const double wanted = target / (double)(1 << TUNE_Q);
+    const double clock = CLOCK * (1.0 + error * 1e-6);
+    unsigned int closest = tune_closest(measurements, LOCATIONS, MEASURE_PERIODS, target);
+    unsigned int periods = tune_periods(tune_frequency(MEASURE_PERIODS, measurements[closest]), rate);
+    steer_t steer = {0, 0, 0, 0};
+    steer_set(&steer, measurements, LOCATIONS, MEASURE_PERIODS, target, pll_ppb(&pll));
+    double time = 0;
+    for(unsigned int b=0; b<STEER_BURSTS; b++){
+        time += periods * cycles[steer_next(&steer)] / clock;
+    }
+    double steered = (double)periods * STEER_BURSTS / time, alone = clock / cycles[closest];
+    printf("carrier: target=%.3f Hz, steered=%.3f Hz (%+.3f ppm, locations %u/%u, share %.4f), closest alone=%.3f Hz (%+.1f ppm)\n",
+        wanted, steered, (steered / wanted - 1.0) * 1e6, steer.slow, steer.fast, steer.share / 65536.0, alone, (alone / wanted - 1.0) * 1e6);
+    return 0;
+}
@@ -0,0 +1,204 @@
+/**
+ * Host simulation of PTP discipline
+ *
+ * Software grandmaster and our slave (ptp.h) talk over loopback UDP,
+ * exactly same messages as on ethernet. Time itself is simulated: grandmaster
+ * stamps with true time, slave stamps with its own drifting oscillator plus
+ * receive latency, so that minutes of operation take only a moment.
+ * Segment is shared with another master in our domain, one in other domain
+ * (both 0.3 s off) and another slave, whose Delay_Resp carries the same
+ * sequence as ours, so none of them may disturb the servo.
+ * Reports time to lock, residual offset and frequency error.
+ *
+ * Build: g++ -std=c++17 -O2 -I.. ptp_sim.cpp -o ptp_sim
+ * Usage: ./ptp_sim [offset ppm] [latency us] [syncs] [port]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "ptp.h"
+
+static uint64_t rng = 88172645463325252ull;
+
+static double uniform(){
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double gaussian(){
+    double u = uniform(), v = uniform();
+    if(u < 1e-12) u = 1e-12;
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/**
+ * Slave's free running oscillator, counts local ns as function of true time
+ */
+struct oscillator_t {
+    double error;       /* Current frequency error in ppm */
+    double last;        /* True time of last update */
+    double local;       /* Local time at last update */
+};
+
+static int64_t oscillator_read(oscillator_t *osc, double now){
+    osc->local += (now - osc->last) * 1e9 * (1.0 + osc->error * 1e-6);
+    osc->last = now;
+    return (int64_t)osc->local;
+}
+
+static int open_socket(int port){
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) < 0){
+        perror("bind");
+        exit(1);
+    }
+    return fd;
+}
+
+static void send_message(int fd, int port, const ptp_message_t *message){
+    uint8_t buffer[64];
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    unsigned int length = ptp_encode(message, buffer);
+    sendto(fd, buffer, length, 0, (sockaddr*)&address, sizeof(address));
+}
+
+static bool receive_message(int fd, ptp_message_t *message){
+    uint8_t buffer[64];
+    ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+    return length > 0 && ptp_decode(buffer, (unsigned int)length, message);
+}
+
+int main(int argc, char **argv){
+    double offset = argc > 1 ? atof(argv[1]) : -31.7;       /* Crystal error in ppm */
+    double latency = argc > 2 ? atof(argv[2]) : 20.0;       /* Worst receive latency in us */
+    int syncs = argc > 3 ? atoi(argv[3]) : 300;             /* Amount of sync intervals */
+    int port = argc > 4 ? atoi(argv[4]) : 31900;            /* Grandmaster port, slave uses next one */
+
+    const double interval = 1.0;        /* Sync interval in s */
+    const double path = 4e-6;           /* One way path delay in s */
+    const double wander = 0.002;        /* Oscillator random walk, ppm per sqrt(s) */
+
+    int master = open_socket(port), slave = open_socket(port + 1);
+    uint8_t master_identity[PTP_PORT_IDENTITY] = {0x00, 0x1B, 0x19, 0xFF, 0xFE, 0x00, 0x00, 0x01, 0x00, 0x01};
+    uint8_t slave_identity[PTP_PORT_IDENTITY] = {0x02, 0x00, 0x00, 0xFF, 0xFE, 0x00, 0x00, 0x02, 0x00, 0x01};
+    uint8_t other_identity[PTP_PORT_IDENTITY] = {0x02, 0x00, 0x00, 0xFF, 0xFE, 0x00, 0x00, 0x03, 0x00, 0x01};
+    uint8_t rogue_identity[PTP_PORT_IDENTITY] = {0x00, 0x1B, 0x19, 0xFF, 0xFE, 0x00, 0x00, 0x04, 0x00, 0x01};
+
+    double now = 1000.0;
+    oscillator_t osc = {offset, now, 5e8};  /* Slave boots with its timer at half a second */
+    ptp_servo_t servo;
+    ptp_init(&servo, slave_identity);
+
+    int lock = -1, samples = 0;
+    double offset2 = 0.0, worst = 0.0, frequency2 = 0.0;
+    ptp_message_t message, received;
+
+    for(int k = 0; k < syncs; k++){
+        now += interval;
+        osc.error += wander * gaussian() * sqrt(interval);
+
+        /* Grandmaster: two-step sync */
+        memset(&message, 0, sizeof(message));
+        memcpy(message.source, master_identity, PTP_PORT_IDENTITY);
+        message.type = PTP_SYNC;
+        message.flags = PTP_TWO_STEP;
+        message.sequence = (uint16_t)k;
+        send_message(master, port + 1, &message);
+        message.type = PTP_FOLLOW_UP;
+        message.flags = 0;
+        message.timestamp = (int64_t)(now * 1e9);
+        send_message(master, port + 1, &message);
+
+        /* Other masters, in our domain and in domain 1 */
+        for(int domain = 0; domain < 2; domain++){
+            memcpy(message.source, rogue_identity, PTP_PORT_IDENTITY);
+            message.domain = (uint8_t)(PTP_DOMAIN + domain);
+            message.type = PTP_SYNC;
+            message.flags = PTP_TWO_STEP;
+            message.timestamp = 0;
+            send_message(master, port + 1, &message);
+            message.type = PTP_FOLLOW_UP;
+            message.flags = 0;
+            message.timestamp = (int64_t)((now + 0.3) * 1e9);
+            send_message(master, port + 1, &message);
+        }
+
+        /* Slave: sync arrives after path delay, picked up with random latency */
+        double arrival = now + path + uniform() * latency * 1e-6;
+        bool request = false;
+        for(int i = 0; i < 6; i++){
+            if(receive_message(slave, &received)){
+                request |= ptp_receive(&servo, &received, oscillator_read(&osc, arrival)) == PTP_REQUEST;
+            }
+        }
+        if(!request) continue;
+
+        /* Slave: delay request, sent shortly after */
+        double sent = arrival + 50e-6;
+        ptp_request(&servo, &message, oscillator_read(&osc, sent));
+        send_message(slave, port, &message);
+
+        /* Grandmaster: hardware stamps request and responds */
+        if(receive_message(master, &received) && received.type == PTP_DELAY_REQ){
+            ptp_message_t response;
+            memset(&response, 0, sizeof(response));
+            memcpy(response.source, master_identity, PTP_PORT_IDENTITY);
+            response.type = PTP_DELAY_RESP;
+            response.sequence = received.sequence;
+            /* Other slave's request with the same sequence is answered first */
+            memcpy(response.requesting, other_identity, PTP_PORT_IDENTITY);
+            response.timestamp = (int64_t)((sent + 0.3) * 1e9);
+            send_message(master, port + 1, &response);
+            memcpy(response.requesting, received.source, PTP_PORT_IDENTITY);
+            response.timestamp = (int64_t)((sent + path) * 1e9 + 20.0 * gaussian());
+            send_message(master, port + 1, &response);
+        }
+        for(int i = 0; i < 2; i++){
+            if(receive_message(slave, &received)){
+                ptp_receive(&servo, &received, oscillator_read(&osc, sent + 2 * path));
+            }
+        }
+
+        if(servo.state == PTP_LOCKED && lock < 0) lock = k;
+        if(lock >= 0 && k >= syncs / 2){
+            /* True error of slave's notion of time and of its frequency estimate */
+            double error = ptp_time(&servo, oscillator_read(&osc, now)) - now * 1e9;
+            double frequency = ptp_ppb(&servo) * 1e-3 - osc.error;
+            offset2 += error * error;
+            frequency2 += frequency * frequency;
+            if(fabs(error) > worst) worst = fabs(error);
+            samples++;
+        }
+    }
+
+    close(master);
+    close(slave);
+
+    printf("offset=%.3f ppm latency=%.1f us syncs=%d\n", offset, latency, syncs);
+    if(lock < 0){
+        printf("lock: never\n");
+        return 1;
+    }
+    printf("lock: %d s, path delay estimate=%d ns (true %d ns)\n", (int)(lock * interval), (int)servo.delay, (int)(path * 1e9));
+    if(samples){
+        printf("time error: rms=%.0f ns worst=%.0f ns\n", sqrt(offset2 / samples), worst);
+        printf("residual frequency error: rms=%.4f ppm\n", sqrt(frequency2 / samples));
+    }
+    return 0;
+}
@@ -0,0 +1,571 @@
+/**
+ * Virtual AM receiver of DAC traces
+ *
+ * Listens to trace (from transmitter_sim, see dac_trace.h) like a radio would:
+ * - trace is resampled to clock / step and mixed down with local oscillator
+ *   at tuned frequency (by default carrier frequency found from zero crossings)
+ * - CIC decimator (order CIC_ORDER, integer, exact) brings it to about IF_RATE
+ * - IF filter: windowed sinc FIR of +-bandwidth, decimating by 2 to audio rate
+ * - detector: envelope (magnitude) or product (synchronous, carrier phase
+ *   tracked by PLL of PLL_BANDWIDTH)
+ * - AGC: detected signal is divided by its slowly tracked mean (carrier level),
+ *   so that output is modulation itself, 100% depth is full scale; mean is
+ *   plain average until AGC time has passed, so it doesn't start from zero
+ *
+ * Received audio can be saved as WAV. Reported:
+ * - THD+N: power left after best single sine fit (meaningful for tone input)
+ * - with source audio the transmitter was fed (-r): delay is found by cross
+ *   correlation, source is band limited to the same bandwidth and resampled
+ *   at that delay, then SNR is power of best scaled source against what's left
+ *   (SINAD, so distortion and response errors count too) and frequency response
+ *   is source to output gain per octave band, relative to 1 kHz
+ * Score is SNR with source, -THD+N without.
+ *
+ * Without trace, it receives synthesized carrier with 1 kHz tone, with 3 kHz
+ * tone and with three tones and checks THD+N and SNR of single tones and SNR
+ * and response of three tones, with both detectors (self check). THD+N of three
+ * tones isn't checked: fit of strongest one leaves other two as residual, so it
+ * is about +3 dB however clean reception is.
+ *
+ * Build: g++ -std=c++17 -O3 -march=native receiver.cpp -o receiver
+ * Usage: ./receiver [-f tuned Hz] [-b bandwidth Hz] [-d envelope|product] [-s step cycles]
+ *                   [-a AGC seconds] [-k skip seconds] [-r source.wav] [-o received.wav] [trace]
+ *        step has to divide clock into rate that is multiple of 2 * IF_RATE decimation to give
+ *        round audio rate, default 25 gives 48000 Hz out of 120 MHz
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <complex>
+#include <vector>
+#include <unistd.h>
+#include "dac_trace.h"
+#include "wav.h"
+
+#define CIC_ORDER 4
+#define CIC_SCALE 16777216.0        /* Mixed samples are quantized to 2^24 per unit */
+#define IF_RATE 96000               /* Rate CIC decimates to, about */
+#define FIR_TAPS 255
+#define PLL_BANDWIDTH 20.0          /* Hz */
+#define CHUNK 65536                 /* RF samples resampled at once */
+#define INTERPOLATION 32            /* Source samples either side of band limited interpolation */
+#define PHASES 1024                 /* Fractional positions kernel is tabulated at */
+#define LAG_MAX 0.04                /* Longest delay of received audio after source, seconds */
+#define RESPONSE_FFT 4096
+#define BANDS 7                     /* Octave bands from 125 Hz */
+
+typedef std::complex<double> complex_t;
+
+enum { ENVELOPE, PRODUCT };
+
+struct receiver_t {
+    double rate;                    /* RF sample rate */
+    unsigned int decimation;        /* CIC */
+    double lo_re, lo_im;            /* Local oscillator */
+    double rotation_re, rotation_im;    /* Its step */
+    uint64_t integrators[2][CIC_ORDER], combs[2][CIC_ORDER];   /* Modular, so that overflow doesn't matter */
+    unsigned int count;             /* RF samples since last CIC output */
+    float fir[FIR_TAPS];
+    complex_t history[2 * FIR_TAPS];    /* IF samples, twice so that taps read them in one run */
+    unsigned int head;
+    bool odd;                       /* IF sample that is decimated away */
+    int detector;
+    double phase, frequency;        /* PLL, radians and radians per audio sample */
+    double level;                   /* AGC, carrier level */
+    double agc;                     /* Its coefficient */
+    uint32_t detected;              /* Audio samples since filters settled */
+    std::vector<float> audio;
+    double audio_rate;
+};
+
+static double sinc(double x){
+    return x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+}
+
+static double blackman(double x){     /* x in -1..1 */
+    return 0.42 + 0.5 * cos(M_PI * x) + 0.08 * cos(2.0 * M_PI * x);
+}
+
+static void receiver_init(receiver_t *rx, double rate, double tuned, double bandwidth, int detector, double agc){
+    *rx = receiver_t();
+    rx->rate = rate;
+    rx->decimation = (unsigned int)(rate / IF_RATE + 0.5);
+    rx->rotation_re = cos(2.0 * M_PI * tuned / rate);
+    rx->rotation_im = -sin(2.0 * M_PI * tuned / rate);
+    rx->lo_re = 1.0;
+    double if_rate = rate / rx->decimation;
+    rx->audio_rate = if_rate / 2;
+    double sum = 0;
+    for(int i=0; i<FIR_TAPS; i++){
+        double x = i - (FIR_TAPS - 1) / 2.0;
+        rx->fir[i] = (float)(sinc(2.0 * bandwidth / if_rate * x) * blackman(x / ((FIR_TAPS + 1) / 2.0)));
+        sum += rx->fir[i];
+    }
+    for(int i=0; i<FIR_TAPS; i++) rx->fir[i] /= sum;
+    rx->detector = detector;
+    rx->agc = 1.0 / (agc * rx->audio_rate);
+}
+
+/**
+ * Baseband sample at audio rate
+ */
+static void receiver_detect(receiver_t *rx, complex_t z){
+    if(rx->audio.size() < FIR_TAPS){
+        rx->audio.push_back(0.0f);  /* Filters haven't settled yet */
+        return;
+    }
+    double a;
+    if(rx->detector == PRODUCT){
+        if(!rx->detected) rx->phase = arg(z);
+        complex_t y = z * std::polar(1.0, -rx->phase);
+        double error = atan2(y.imag(), y.real());
+        double wn = 2.0 * M_PI * PLL_BANDWIDTH / rx->audio_rate;
+        rx->frequency += wn * wn * error;
+        rx->phase += rx->frequency + 2.0 * 0.707 * wn * error;
+        a = y.real();
+    } else a = abs(z);
+    rx->detected++;
+    rx->level += (a - rx->level) * (rx->detected * rx->agc < 1.0 ? 1.0 / rx->detected : rx->agc);
+    rx->audio.push_back(rx->level > 0 ? (float)(a / rx->level - 1.0) : 0.0f);
+}
+
+/**
+ * IF sample, FIR decimates by 2
+ */
+static void receiver_if(receiver_t *rx, complex_t z){
+    rx->head = rx->head ? rx->head - 1 : FIR_TAPS - 1;
+    rx->history[rx->head] = rx->history[rx->head + FIR_TAPS] = z;
+    rx->odd = !rx->odd;
+    if(rx->odd) return;
+    const complex_t *h = rx->history + rx->head;
+    double re = 0, im = 0;
+    for(int i=0; i<FIR_TAPS; i++){
+        re += rx->fir[i] * h[i].real();
+        im += rx->fir[i] * h[i].imag();
+    }
+    receiver_detect(rx, complex_t(re, im));
+}
+
+static void receiver_rf(receiver_t *rx, const float *samples, size_t count){
+    double scale = 1.0 / (CIC_SCALE * pow((double)rx->decimation, CIC_ORDER));
+    for(size_t n=0; n<count; n++){
+        uint64_t q[2] = {(uint64_t)(int64_t)(samples[n] * rx->lo_re * CIC_SCALE), (uint64_t)(int64_t)(samples[n] * rx->lo_im * CIC_SCALE)};
+        double re = rx->lo_re * rx->rotation_re - rx->lo_im * rx->rotation_im;
+        rx->lo_im = rx->lo_re * rx->rotation_im + rx->lo_im * rx->rotation_re;
+        rx->lo_re = re;
+        for(int p=0; p<2; p++){
+            uint64_t *integrator = rx->integrators[p];
+            integrator[0] += q[p];
+            for(int s=1; s<CIC_ORDER; s++) integrator[s] += integrator[s - 1];
+        }
+        if(++rx->count < rx->decimation) continue;
+        rx->count = 0;
+        double magnitude = hypot(rx->lo_re, rx->lo_im);   /* Keep oscillator from drifting in amplitude */
+        rx->lo_re /= magnitude;
+        rx->lo_im /= magnitude;
+        double out[2];
+        for(int p=0; p<2; p++){
+            uint64_t c = rx->integrators[p][CIC_ORDER - 1];
+            for(int s=0; s<CIC_ORDER; s++){
+                uint64_t t = c - rx->combs[p][s];
+                rx->combs[p][s] = c;
+                c = t;
+            }
+            out[p] = (int64_t)c * scale;
+        }
+        receiver_if(rx, complex_t(out[0], out[1]));
+    }
+}
+
+/**
+ * Carrier frequency from rising zero crossings of first `seconds` of trace
+ */
+static double carrier(FILE *file, double step, double seconds){
+    dac_trace_t trace;
+    if(!dac_trace_open(&trace, file)) return 0;
+    double rate = trace.clock / step;
+    std::vector<float> x((size_t)(seconds * rate));
+    x.resize(dac_trace_read(&trace, step, x.data(), x.size()));
+    double mean = 0;
+    for(float v : x) mean += v;
+    mean /= x.size();
+    double first = -1, last = -1;
+    unsigned int crossings = 0;
+    for(size_t i=1; i<x.size(); i++){
+        if(x[i - 1] < mean && x[i] >= mean){
+            double t = i - 1 + (mean - x[i - 1]) / (x[i] - x[i - 1]);
+            if(first < 0) first = t;
+            else crossings++;
+            last = t;
+        }
+    }
+    return crossings ? crossings * rate / (last - first) : 0;
+}
+
+static bool receive(receiver_t *rx, FILE *file, double step, double *start){
+    dac_trace_t trace;
+    if(!dac_trace_open(&trace, file)) return false;
+    *start = trace.position / trace.clock;
+    std::vector<float> samples(CHUNK);
+    size_t count;
+    while((count = dac_trace_read(&trace, step, samples.data(), CHUNK))){
+        receiver_rf(rx, samples.data(), count);
+    }
+    return true;
+}
+
+/**
+ * Radix-2 FFT in place
+ */
+static void fft(complex_t *x, unsigned int n){
+    for(unsigned int i=1, j=0; i<n; i++){
+        unsigned int bit = n >> 1;
+        for(; j & bit; bit >>= 1) j ^= bit;
+        j |= bit;
+        if(i < j) std::swap(x[i], x[j]);
+    }
+    for(unsigned int h=1; h<n; h<<=1){
+        complex_t step = std::polar(1.0, -M_PI / h);
+        for(unsigned int b=0; b<n; b+=2*h){
+            complex_t w = 1.0;
+            for(unsigned int j=0; j<h; j++, w*=step){
+                complex_t t = x[b + j + h] * w;
+                x[b + j + h] = x[b + j] - t;
+                x[b + j] += t;
+            }
+        }
+    }
+}
+
+/**
+ * Least squares fit of a cos + b sin + c at frequency f (cycles per sample),
+ * returns residual power, fit power in `fitted`
+ */
+static double sine_fit(const float *y, size_t n, double f, double *fitted){
+    double cc = 0, ss = 0, cs = 0, c1 = 0, s1 = 0, yc = 0, ys = 0, y1 = 0, yy = 0;
+    /* Rotation is written out, complex multiply checks for infinities and doesn't vectorize */
+    double c = 1.0, s = 0.0, rc = cos(2.0 * M_PI * f), rs = sin(2.0 * M_PI * f);
+    for(size_t i=0; i<n; i++){
+        cc += c * c; ss += s * s; cs += c * s; c1 += c; s1 += s;
+        yc += y[i] * c; ys += y[i] * s; y1 += y[i]; yy += (double)y[i] * y[i];
+        double t = c * rc - s * rs;
+        s = c * rs + s * rc;
+        c = t;
+    }
+    /* Normal equations, 3x3, by Cramer's rule */
+    double m[3][3] = {{cc, cs, c1}, {cs, ss, s1}, {c1, s1, (double)n}}, v[3] = {yc, ys, y1};
+    auto det = [](double a[3][3]){
+        return a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+            + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+    };
+    double d = det(m), p[3];
+    for(int k=0; k<3; k++){
+        double t[3][3];
+        for(int i=0; i<3; i++) for(int j=0; j<3; j++) t[i][j] = j == k ? v[i] : m[i][j];
+        p[k] = det(t) / d;
+    }
+    double explained = p[0] * yc + p[1] * ys + p[2] * y1;
+    double power = p[0] * p[0] * cc + p[1] * p[1] * ss + 2 * p[0] * p[1] * cs;
+    *fitted = power / n;
+    return (yy - explained) / n;
+}
+
+/**
+ * THD+N in dB and frequency of the tone in Hz
+ */
+static double thd_n(const float *y, size_t n, double rate, double *frequency){
+    unsigned int size = 1;
+    while(size * 2 <= n && size < 65536) size *= 2;
+    std::vector<complex_t> x(size);
+    for(unsigned int i=0; i<size; i++) x[i] = y[i] * (0.5 - 0.5 * cos(2.0 * M_PI * i / size));
+    fft(x.data(), size);
+    unsigned int best = 1;
+    for(unsigned int k=1; k<size/2; k++){
+        if(norm(x[k]) > norm(x[best])) best = k;
+    }
+    /* Golden section on residual around the peak */
+    double a = (best - 1.0) / size, b = (best + 1.0) / size, fitted;
+    const double g = 0.5 * (sqrt(5.0) - 1.0);
+    for(int i=0; i<60; i++){
+        double c = b - g * (b - a), d = a + g * (b - a);
+        if(sine_fit(y, n, c, &fitted) < sine_fit(y, n, d, &fitted)) b = d;
+        else a = c;
+    }
+    double f = (a + b) / 2, residual = sine_fit(y, n, f, &fitted);
+    *frequency = f * rate;
+    return 10 * log10(residual / fitted);
+}
+
+/**
+ * Band limiting interpolation kernel, tabulated at PHASES fractional positions
+ */
+struct kernel_t {
+    float taps[PHASES + 1][2 * INTERPOLATION];
+};
+
+static void kernel_init(kernel_t *kernel, double cutoff){
+    if(cutoff > 1.0) cutoff = 1.0;
+    for(int p=0; p<=PHASES; p++){
+        for(int j=0; j<2 * INTERPOLATION; j++){
+            double d = (double)p / PHASES + INTERPOLATION - 1 - j;
+            kernel->taps[p][j] = (float)(cutoff * sinc(cutoff * d) * blackman(d / (INTERPOLATION + 1)));
+        }
+    }
+}
+
+/**
+ * Source (first channel, -1..1) through kernel at time t seconds
+ */
+static double source_at(const wav_t *source, const kernel_t *kernel, double t){
+    double position = t * source->rate, phase = (position - floor(position)) * PHASES;
+    long first = (long)floor(position) - INTERPOLATION + 1;
+    int p = (int)phase;
+    double f = phase - p, sum = 0;
+    const float *a = kernel->taps[p], *b = kernel->taps[p + 1];
+    for(int j=0; j<2 * INTERPOLATION; j++){
+        long k = first + j;
+        if(k < 0 || k >= (long)source->length) continue;
+        sum += source->samples[k * source->channels] * (a[j] + f * (b[j] - a[j]));
+    }
+    return sum / 32768.0;
+}
+
+struct comparison_t {
+    double delay;                   /* Seconds */
+    double snr;                     /* dB */
+    double response[BANDS];         /* dB against 1 kHz, NAN where source has nothing */
+};
+
+static comparison_t compare(const float *y, size_t n, double rate, double start, const wav_t *source, double bandwidth){
+    comparison_t result;
+    kernel_t *kernel = new kernel_t;
+    kernel_init(kernel, 2.0 * bandwidth / source->rate);
+    /* Whole samples of delay by cross correlation over up to a second */
+    size_t lags = (size_t)(LAG_MAX * rate), window = n < (size_t)rate ? n : (size_t)rate;
+    std::vector<double> reference(window + lags);
+    for(size_t i=0; i<window + lags; i++){
+        reference[i] = source_at(source, kernel, start + ((double)i - lags) / rate);
+    }
+    std::vector<double> correlation(lags + 1);
+    size_t lag = 0;
+    for(size_t l=0; l<=lags; l++){
+        double sum = 0;
+        for(size_t i=0; i<window; i++) sum += y[i] * reference[i + lags - l];
+        correlation[l] = sum;
+        if(sum > correlation[lag]) lag = l;
+    }
+    double shift = 0;
+    if(lag > 0 && lag < lags){
+        double a = correlation[lag - 1], b = correlation[lag], c = correlation[lag + 1];
+        if(a - 2 * b + c < 0) shift = 0.5 * (a - c) / (a - 2 * b + c);
+    }
+    result.delay = (lag + shift) / rate;
+
+    /* Best gain and offset of source at that delay */
+    std::vector<float> r(n);
+    double rr = 0, ry = 0, r1 = 0, y1 = 0, yy = 0;
+    for(size_t i=0; i<n; i++){
+        r[i] = (float)source_at(source, kernel, start + i / rate - result.delay);
+        rr += (double)r[i] * r[i]; ry += (double)r[i] * y[i]; r1 += r[i]; y1 += y[i]; yy += (double)y[i] * y[i];
+    }
+    double sxx = rr - r1 * r1 / n, sxy = ry - r1 * y1 / n, syy = yy - y1 * y1 / n;
+    double explained = sxy * sxy / sxx;
+    result.snr = 10 * log10(explained / (syy - explained));
+
+    /* Welch cross spectrum, gain per octave band */
+    std::vector<double> sxx_k(RESPONSE_FFT / 2), sxy_re(RESPONSE_FFT / 2), sxy_im(RESPONSE_FFT / 2);
+    std::vector<complex_t> a(RESPONSE_FFT), b(RESPONSE_FFT);
+    for(size_t s=0; s + RESPONSE_FFT <= n; s+=RESPONSE_FFT/2){
+        for(int i=0; i<RESPONSE_FFT; i++){
+            double w = 0.5 - 0.5 * cos(2.0 * M_PI * i / RESPONSE_FFT);
+            a[i] = r[s + i] * w;
+            b[i] = y[s + i] * w;
+        }
+        fft(a.data(), RESPONSE_FFT);
+        fft(b.data(), RESPONSE_FFT);
+        for(int k=1; k<RESPONSE_FFT/2; k++){
+            complex_t cross = conj(a[k]) * b[k];
+            sxx_k[k] += norm(a[k]);
+            sxy_re[k] += cross.real();
+            sxy_im[k] += cross.imag();
+        }
+    }
+    double gains[BANDS], energies[BANDS], most = 0;
+    for(int band=0; band<BANDS; band++){
+        double center = 125.0 * (1 << band), re = 0, im = 0, energy = 0;
+        for(int k=1; k<RESPONSE_FFT/2; k++){
+            double f = k * rate / RESPONSE_FFT;
+            if(f < center / M_SQRT2 || f >= center * M_SQRT2) continue;
+            re += sxy_re[k];
+            im += sxy_im[k];
+            energy += sxx_k[k];
+        }
+        energies[band] = energy;
+        gains[band] = energy > 0 ? hypot(re, im) / energy : 0;
+        if(energy > most) most = energy;
+    }
+    double reference_gain = gains[3] > 0 ? gains[3] : gains[0];
+    for(int band=0; band<BANDS; band++){
+        bool present = energies[band] > most * 1e-4 && gains[band] > 0 && reference_gain > 0 && 125.0 * (1 << band) < bandwidth;
+        result.response[band] = present ? 20 * log10(gains[band] / reference_gain) : NAN;
+    }
+    delete kernel;
+    return result;
+}
+
+struct settings_t {
+    double tuned, bandwidth, step, agc, skip;
+    int detector;
+    const wav_t *source;
+    const char *output;
+};
+
+struct result_t {
+    double tuned, thd_n, tone, score;
+    bool compared;
+    comparison_t comparison;
+};
+
+static bool listen(FILE *file, const settings_t *settings, result_t *result, bool quiet){
+    double tuned = settings->tuned ? settings->tuned : carrier(file, settings->step, 0.2);
+    rewind(file);
+    if(!tuned) return false;
+    dac_trace_t header;
+    if(!dac_trace_open(&header, file)) return false;
+    rewind(file);
+    receiver_t *rx = new receiver_t;
+    receiver_init(rx, header.clock / settings->step, tuned, settings->bandwidth, settings->detector, settings->agc);
+    double start = 0;
+    receive(rx, file, settings->step, &start);
+    size_t skip = (size_t)(settings->skip * rx->audio_rate);
+    if(rx->audio.size() < skip + (size_t)(0.1 * rx->audio_rate)){
+        fprintf(stderr, "trace is too short\n");
+        delete rx;
+        return false;
+    }
+    if(settings->output && !wav_write(settings->output, rx->audio.data(), rx->audio.size(), (uint32_t)(rx->audio_rate + 0.5))){
+        fprintf(stderr, "%s: can't write\n", settings->output);
+    }
+    const float *y = rx->audio.data() + skip;
+    size_t n = rx->audio.size() - skip;
+    result->tuned = tuned;
+    result->thd_n = thd_n(y, n, rx->audio_rate, &result->tone);
+    result->score = -result->thd_n;
+    result->compared = settings->source != 0;
+    if(result->compared){
+        result->comparison = compare(y, n, rx->audio_rate, start + skip / rx->audio_rate, settings->source, settings->bandwidth);
+        result->score = result->comparison.snr;
+    }
+    if(!quiet){
+        printf("tuned=%.1f Hz, detector=%s, bandwidth=%.0f Hz, audio=%.0f Hz, %.2f s\n", tuned,
+            settings->detector == PRODUCT ? "product" : "envelope", settings->bandwidth, rx->audio_rate, n / rx->audio_rate);
+        printf("THD+N=%.1f dB (tone %.1f Hz)\n", result->thd_n, result->tone);
+        if(result->compared){
+            const comparison_t *c = &result->comparison;
+            printf("delay=%.3f ms, SNR=%.1f dB\nresponse:", c->delay * 1000, c->snr);
+            for(int band=0; band<BANDS; band++){
+                if(!isnan(c->response[band])) printf(" %d=%+.1f", 125 << band, c->response[band]);
+            }
+            printf(" dB\n");
+        }
+        printf("score=%.1f dB\n", result->score);
+    }
+    delete rx;
+    return true;
+}
+
+/**
+ * Square carrier of 222 cycles at 120 MHz, audio at 22050 Hz held by DAC like on board
+ */
+static FILE *synthesize(const wav_t *audio, double depth){
+    FILE *file = tmpfile();
+    dac_trace_header(file, 120000000, 0);
+    uint64_t cycle = 0;
+    while(true){
+        uint64_t index = cycle * audio->rate / 120000000;
+        if(index >= audio->length) break;
+        double s = audio->samples[index] / 32768.0 * depth;
+        uint16_t value = (uint16_t)(32768 + 32767 * s) & 0xFFF0;
+        dac_trace_write(file, 111, value);
+        dac_trace_write(file, 111, 0);
+        cycle += 222;
+    }
+    rewind(file);
+    return file;
+}
+
+static wav_t tones(const double *frequencies, int count, double seconds){
+    wav_t wav = {(int16_t*)malloc((size_t)(seconds * 22050) * 2), (uint32_t)(seconds * 22050), 22050, 1};
+    for(uint32_t i=0; i<wav.length; i++){
+        double s = 0;
+        for(int t=0; t<count; t++) s += sin(2.0 * M_PI * frequencies[t] * i / 22050 + t) / count;
+        wav.samples[i] = (int16_t)lrint(32767 * 0.9 * s);
+    }
+    return wav;
+}
+
+static int self_check(settings_t settings){
+    int failures = 0;
+    const double single[] = {1000, 3000}, multi[] = {300, 1000, 3000};
+    wav_t singles[2] = {tones(single, 1, 2.0), tones(single + 1, 1, 2.0)}, several = tones(multi, 3, 2.0);
+    for(int detector=ENVELOPE; detector<=PRODUCT; detector++){
+        settings.detector = detector;
+        result_t r;
+        for(int t=0; t<2; t++){
+            settings.source = &singles[t];
+            FILE *file = synthesize(&singles[t], 0.5);
+            bool ok = listen(file, &settings, &r, false);
+            fclose(file);
+            if(!ok || r.thd_n > -40 || fabs(r.tone - single[t]) > 0.5 || r.comparison.snr < 35) failures++;
+        }
+        settings.source = &several;
+        FILE *file = synthesize(&several, 0.5);
+        bool ok = listen(file, &settings, &r, false);
+        fclose(file);
+        /* Bands with 300 Hz, 1 kHz and 3 kHz tone */
+        if(!ok || r.comparison.snr < 30) failures++;
+        else for(int band : {1, 3, 5}){
+            if(isnan(r.comparison.response[band]) || fabs(r.comparison.response[band]) > 1.0) failures++;
+        }
+    }
+    printf("failures=%d\n", failures);
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv){
+    settings_t settings = {0, 5000, 25, 0.2, 0.3, ENVELOPE, 0, 0};
+    wav_t source;
+    int option;
+    while((option = getopt(argc, argv, "f:b:d:s:a:k:r:o:")) != -1){
+        switch(option){
+            case 'f': settings.tuned = atof(optarg); break;
+            case 'b': settings.bandwidth = atof(optarg); break;
+            case 'd': settings.detector = !strcmp(optarg, "product") ? PRODUCT : ENVELOPE; break;
+            case 's': settings.step = atof(optarg); break;
+            case 'a': settings.agc = atof(optarg); break;
+            case 'k': settings.skip = atof(optarg); break;
+            case 'r':
+                if(!wav_read(&source, optarg)){
+                    fprintf(stderr, "%s: not 16-bit PCM WAV\n", optarg);
+                    return 1;
+                }
+                settings.source = &source;
+                break;
+            case 'o': settings.output = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-f tuned Hz] [-b bandwidth Hz] [-d envelope|product] [-s step cycles]"
+                    " [-a AGC seconds] [-k skip seconds] [-r source.wav] [-o received.wav] [trace]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc) return self_check(settings);
+    FILE *file = fopen(argv[optind], "rb");
+    result_t result;
+    if(!file || !listen(file, &settings, &result, false)){
+        fprintf(stderr, "can't receive %s\n", argv[optind]);
+        return 1;
+    }
+    fclose(file);
+    return 0;
+}
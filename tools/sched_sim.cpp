@@ -0,0 +1,137 @@
+/**
+ * Host test of cooperative scheduler
+ *
+ * Runs sched.h between simulated carrier samples, in virtual core cycles.
+ * Tasks mimic control work of the transmitter: console parsing bytes as they
+ * arrive, periodic AGC, telemetry and drift check, and two background tasks
+ * that always have work (to check they get equal share).
+ * Reports per task slices, jobs, worst slice against budget and missed
+ * deadlines, first with gap budget that fits the load and then overloaded.
+ *
+ * Build: g++ -std=c++17 -O2 -I.. sched_sim.cpp -o sched_sim
+ * Usage: ./sched_sim [sample rate] [gap budget in cycles] [seconds] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+static uint64_t cycles = 0;     /* Virtual core cycle counter */
+
+#define SCHED_CYCLES() ((uint32_t)cycles)
+#include "sched.h"
+
+static const uint64_t clock_hz = 120000000;    /* K64F core clock */
+static uint64_t seed = 1;
+
+static uint64_t xorshift(){
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+/**
+ * Spend between `low` and `high` cycles
+ */
+static void work(unsigned int low, unsigned int high){
+    cycles += low + xorshift() % (high - low + 1);
+}
+
+static unsigned int received = 0;   /* Bytes waiting for console */
+
+static unsigned int console(task_t *task){
+    TASK_BEGIN(task);
+    while(true){
+        TASK_WAIT(task, received);
+        work(40, 140);                      /* Up to 4 characters */
+        received = received > 4 ? received - 4 : 0;
+        TASK_YIELD(task);
+    }
+    TASK_END(task);
+}
+
+static unsigned int agc(task_t *task){
+    TASK_BEGIN(task);
+    work(80, 160);                          /* Level estimate */
+    TASK_YIELD(task);
+    work(60, 120);                          /* Gain update */
+    TASK_END(task);
+}
+
+static unsigned int telemetry(task_t *task){
+    static unsigned int i;
+    TASK_BEGIN(task);
+    for(i=0; i<3; i++){
+        work(120, 220);                     /* Encode one record */
+        TASK_YIELD(task);
+    }
+    TASK_END(task);
+}
+
+static unsigned int drift(task_t*){
+    work(200, 320);
+    return TASK_DONE;
+}
+
+static unsigned int background(task_t*){
+    work(90, 110);
+    return TASK_BUSY;
+}
+
+/**
+ * Run scheduler for given time, print report
+ */
+static void run(unsigned int sample_rate, uint32_t budget, double seconds){
+    static task_t tasks[6];
+    sched_t sched;
+    cycles = 0;
+    received = 0;
+    sched_init(&sched);
+    sched_add(&sched, &tasks[0], "console", console, 0, 200, 0);
+    sched_add(&sched, &tasks[1], "agc", agc, 1000, 200, 0);
+    sched_add(&sched, &tasks[2], "telemetry", telemetry, 10000, 250, 0);
+    sched_add(&sched, &tasks[3], "drift", drift, 1000000, 400, 0);
+    sched_add(&sched, &tasks[4], "bg1", background, 0, 150, 0);
+    sched_add(&sched, &tasks[5], "bg2", background, 0, 150, 0);
+
+    uint64_t sample_cycles = clock_hz / sample_rate, end = (uint64_t)(seconds * clock_hz);
+    uint64_t byte_cycles = clock_hz / 11520, next_byte = byte_cycles;  /* 115200 baud */
+    uint64_t overruns = 0, samples = 0;
+    while(cycles < end){
+        uint64_t sample_start = cycles;
+        cycles += sample_cycles - budget;       /* Carrier burst */
+        while(next_byte <= cycles){
+            received++;
+            next_byte += byte_cycles;
+        }
+        uint64_t gap = cycles;
+        sched_run(&sched, (uint32_t)(cycles * 1000000 / clock_hz), budget);
+        if(cycles - gap > budget) overruns++;
+        samples++;
+        /* Carrier waits for next sample only if there's time left */
+        if(cycles < sample_start + sample_cycles) cycles = sample_start + sample_cycles;
+    }
+
+    printf("gap budget=%u of %u cycles per sample, worst gap=%u, gaps over budget=%llu of %llu\n", budget,
+        (unsigned int)sample_cycles, (unsigned int)sched.worst, (unsigned long long)overruns, (unsigned long long)samples);
+    for(unsigned int i=0; i<sched.count; i++){
+        task_t *task = sched.tasks[i];
+        printf("  %-10s slices=%-8u jobs=%-8u worst=%-4u budget=%-4u overruns=%-4u misses=%u\n", task->name,
+            (unsigned int)task->slices, (unsigned int)task->jobs, (unsigned int)task->worst,
+            (unsigned int)task->budget, (unsigned int)task->overruns, (unsigned int)task->misses);
+    }
+    double fairness = (double)tasks[4].slices / (tasks[5].slices ? tasks[5].slices : 1);
+    printf("  background share bg1/bg2=%.3f, console backlog=%u bytes\n", fairness, received);
+}
+
+int main(int argc, char **argv){
+    unsigned int sample_rate = argc > 1 ? atoi(argv[1]) : 22050;
+    uint32_t budget = argc > 2 ? atoi(argv[2]) : 600;
+    double seconds = argc > 3 ? atof(argv[3]) : 5.0;
+    seed = argc > 4 ? strtoull(argv[4], 0, 10) : 1;
+    if(!seed) seed = 1;
+
+    run(sample_rate, budget, seconds);
+    run(sample_rate, budget / 4, seconds);
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef SIM_FSL_CLOCK_H
+#define SIM_FSL_CLOCK_H
+
+#include "mbed.h"
+
+inline uint32_t CLOCK_GetBusClkFreq(){
+    return SIM_CORE_CLOCK / 2;
+}
+
+#endif
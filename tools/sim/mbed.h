@@ -0,0 +1,250 @@
+#ifndef SIM_MBED_H
+#define SIM_MBED_H
+
+/**
+ * Mock of mbed and K64F registers for host build of main.cpp
+ *
+ * Only what transmitter uses is here. Registers are plain structs, engine
+ * in sim.h looks at the bits it cares about (PDB and ADC triggers, DMA,
+ * comparator) and everything runs on virtual cycle counter. Mask values
+ * are the ones of K64F.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Registers */
+
+struct ADC_Type { uint32_t SC1[2], CFG1, CFG2, R[2], SC2, SC3; };
+struct SIM_Type { uint32_t SOPT2, SOPT4, SCGC2, SCGC3, SCGC4, SCGC5, SCGC6, SCGC7, UIDML, UIDL; };
+struct FTM_Type { uint32_t SC, CNT, MOD; struct { uint32_t CnSC, CnV; } CONTROLS[8]; uint32_t CNTIN, STATUS, MODE; };
+struct PDB_Type { uint32_t SC, MOD, CNT, IDLY; struct { uint32_t C1, S, DLY[2]; } CH[2]; };
+struct CMP_Type { uint8_t CR0, CR1, FPR, SCR, DACCR, MUXCR; };
+struct DMAMUX_Type { uint8_t CHCFG[16]; };
+struct RCM_Type { uint8_t SRS0, SRS1; };
+struct CoreDebug_Type { uint32_t DEMCR; };
+
+/**
+ * Write-only DMA control registers act on write
+ */
+struct sim_dma_control_t {
+    int kind;
+    void operator=(uint32_t channel);
+};
+#define SIM_SERQ 0
+#define SIM_CERQ 1
+#define SIM_CDNE 2
+
+struct DMA_Type {
+    uint32_t ERQ;
+    sim_dma_control_t SERQ, CERQ, CDNE;
+    struct {
+        uint32_t SADDR;
+        int16_t SOFF;
+        uint16_t ATTR;
+        uint32_t NBYTES_MLNO;
+        int32_t SLAST;
+        uint32_t DADDR;
+        int16_t DOFF;
+        uint16_t CITER_ELINKNO;
+        int32_t DLAST_SGA;
+        uint16_t CSR;
+        uint16_t BITER_ELINKNO;
+    } TCD[16];
+};
+
+/**
+ * Reading cycle counter reads virtual clock (and takes a cycle)
+ */
+struct sim_cyccnt_t {
+    operator uint32_t() const;
+    sim_cyccnt_t &operator=(uint32_t value);
+};
+struct DWT_Type { uint32_t CTRL; sim_cyccnt_t CYCCNT; };
+
+static ADC_Type ADC0_, ADC1_;
+static SIM_Type SIM_;
+static FTM_Type FTM1_;
+static PDB_Type PDB0_;
+static CMP_Type CMP1_;
+static DMA_Type DMA0_ = {0, {SIM_SERQ}, {SIM_CERQ}, {SIM_CDNE}, {}};
+static DMAMUX_Type DMAMUX_;
+static RCM_Type RCM_ = {0x80, 0};  /* Power on reset */
+static DWT_Type DWT_;
+static CoreDebug_Type CoreDebug_;
+
+#define ADC0 (&ADC0_)
+#define ADC1 (&ADC1_)
+#define SIM (&SIM_)
+#define FTM1 (&FTM1_)
+#define PDB0 (&PDB0_)
+#define CMP1 (&CMP1_)
+#define DMA0 (&DMA0_)
+#define DMAMUX (&DMAMUX_)
+#define RCM (&RCM_)
+#define DWT (&DWT_)
+#define CoreDebug (&CoreDebug_)
+
+#define SIM_SCGC3_ADC1_MASK 0x8000000u
+#define SIM_SCGC4_CMP_MASK 0x80000u
+#define SIM_SCGC6_ADC0_MASK 0x8000000u
+#define SIM_SCGC6_PDB_MASK 0x400000u
+#define SIM_SCGC6_FTM1_MASK 0x2000000u
+#define SIM_SCGC6_DMAMUX_MASK 0x2u
+#define SIM_SCGC7_DMA_MASK 0x2u
+#define SIM_SOPT4_FTM1CH0SRC_MASK 0xC0000u
+#define SIM_SOPT4_FTM1CH0SRC(x) (((x) << 18) & SIM_SOPT4_FTM1CH0SRC_MASK)
+
+#define ADC_SC1_ADCH_MASK 0x1Fu
+#define ADC_SC1_ADCH(x) ((x) & ADC_SC1_ADCH_MASK)
+#define ADC_SC1_AIEN_MASK 0x40u
+#define ADC_SC1_COCO_MASK 0x80u
+#define ADC_CFG1_ADIV(x) (((x) & 3) << 5)
+#define ADC_CFG1_ADLSMP_MASK 0x10u
+#define ADC_CFG1_MODE(x) (((x) & 3) << 2)
+#define ADC_SC2_ADTRG_MASK 0x40u
+#define ADC_SC2_ADACT_MASK 0x80u
+#define ADC_SC2_DMAEN_MASK 0x4u
+#define ADC_SC3_AVGE_MASK 0x4u
+#define ADC_SC3_AVGS(x) ((x) & 3)
+
+#define PDB_SC_LDOK_MASK 0x1u
+#define PDB_SC_CONT_MASK 0x2u
+#define PDB_SC_PDBEN_MASK 0x80u
+#define PDB_SC_TRGSEL(x) (((x) & 15) << 8)
+#define PDB_SC_SWTRIG_MASK 0x10000u
+#define PDB_SC_LDMOD(x) (((x) & 3) << 18)
+#define PDB_C1_EN(x) ((x) & 0xFF)
+#define PDB_C1_TOS(x) (((x) & 0xFF) << 8)
+
+#define FTM_SC_PS(x) ((x) & 7)
+#define FTM_SC_CLKS(x) (((x) & 3) << 3)
+#define FTM_CnSC_DMA_MASK 0x1u
+#define FTM_CnSC_ELSA_MASK 0x4u
+#define FTM_CnSC_CHIE_MASK 0x40u
+#define FTM_CnSC_CHF_MASK 0x80u
+#define FTM_MODE_WPDIS_MASK 0x4u
+
+#define CMP_CR0_HYSTCTR(x) ((x) & 3)
+#define CMP_CR1_EN_MASK 0x1u
+#define CMP_CR1_PMODE_MASK 0x10u
+#define CMP_DACCR_VOSEL(x) ((x) & 0x3F)
+#define CMP_DACCR_VRSEL_MASK 0x40u
+#define CMP_DACCR_DACEN_MASK 0x80u
+#define CMP_MUXCR_MSEL(x) ((x) & 7)
+#define CMP_MUXCR_PSEL(x) (((x) & 7) << 3)
+
+#define DMA_ATTR_DSIZE(x) ((x) & 7)
+#define DMA_ATTR_SSIZE(x) (((x) & 7) << 8)
+#define DMA_CSR_DREQ_MASK 0x8u
+#define DMA_CSR_DONE_MASK 0x80u
+#define DMAMUX_CHCFG_SOURCE(x) ((x) & 0x3F)
+#define DMAMUX_CHCFG_ENBL_MASK 0x80u
+enum { kDmaRequestMux0FTM1Channel0 = 28 | 0x100u, kDmaRequestMux0ADC1 = 41 | 0x100u };
+
+#define CoreDebug_DEMCR_TRCENA_Msk (1u << 24)
+#define DWT_CTRL_CYCCNTENA_Msk 1u
+
+enum IRQn_Type { UART0_RX_TX_IRQn = 31, ADC0_IRQn = 39, SWI_IRQn = 64, ADC1_IRQn = 73 };
+
+#include "sim.h"
+
+/* Core */
+
+static uint32_t SystemCoreClock = SIM_CORE_CLOCK;
+
+inline void NVIC_SetVector(IRQn_Type irq, uintptr_t vector){
+    sim.vectors[irq] = (void (*)())vector;
+}
+
+inline void NVIC_EnableIRQ(IRQn_Type irq){
+    sim.enabled[irq] = true;
+}
+
+inline void NVIC_SetPendingIRQ(IRQn_Type irq){
+    sim_irq(irq);
+}
+
+inline void __disable_irq(){
+    sim.masked = true;
+}
+
+inline void __enable_irq(){
+    sim_unmask();
+}
+
+inline void __WFI(){
+    sim_sleep();
+}
+
+inline void __NOP(){
+    sim_advance(1);
+}
+
+inline sim_cyccnt_t::operator uint32_t() const {
+    sim_advance(SIM_READ_CYCLES);
+    return (uint32_t)(sim.cycles - sim.cyccnt_base);
+}
+
+inline sim_cyccnt_t &sim_cyccnt_t::operator=(uint32_t value){
+    sim.cyccnt_base = sim.cycles - value;
+    return *this;
+}
+
+inline void sim_dma_control_t::operator=(uint32_t channel){
+    if(kind == SIM_SERQ) DMA0_.ERQ |= 1u << channel;
+    else if(kind == SIM_CERQ) DMA0_.ERQ &= ~(1u << channel);
+    else DMA0_.TCD[channel].CSR &= ~DMA_CSR_DONE_MASK;
+}
+
+/* mbed API */
+
+enum PinName { USBTX, USBRX, LED_RED, LED_GREEN, LED_BLUE, DAC0_OUT };
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin) : value(1) { (void)pin; }
+    DigitalOut &operator=(int v){ value = v; return *this; }
+    operator int() const { return value; }
+private:
+    int value;
+};
+
+class AnalogOut {
+public:
+    AnalogOut(PinName pin){ (void)pin; }
+    void write_u16(uint16_t value){ sim_dac(value); }
+};
+
+class Timer {
+public:
+    Timer() : base(0) {}
+    void start(){ base = sim.cycles; }
+    void reset(){ base = sim.cycles; }
+    int read_us(){
+        sim_advance(SIM_TICKER_CYCLES);
+        return (int)((sim.cycles - base) / (SIM_CORE_CLOCK / 1000000));
+    }
+private:
+    uint64_t base;
+};
+
+/**
+ * Buffered serial port, transmit buffer drains at baud rate of virtual time
+ */
+class UARTSerial {
+public:
+    UARTSerial(PinName tx, PinName rx, int baud){ (void)tx; (void)rx; sim.baud = baud; }
+    void set_blocking(bool blocking){ (void)blocking; }
+    void sigio(void (*callback)()){ sim.vectors[UART0_RX_TX_IRQn] = callback; sim.enabled[UART0_RX_TX_IRQn] = true; }
+    ssize_t write(const void *data, size_t length){ return sim_uart_write((const uint8_t*)data, length); }
+    ssize_t read(void *data, size_t length){ return sim_uart_read((uint8_t*)data, length); }
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef SIM_US_TICKER_API_H
+#define SIM_US_TICKER_API_H
+
+#include "mbed.h"
+
+/**
+ * Microsecond ticker on virtual clock
+ */
+inline uint32_t us_ticker_read(){
+    sim_advance(SIM_TICKER_CYCLES);
+    return (uint32_t)(sim.cycles / (SIM_CORE_CLOCK / 1000000));
+}
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * Host simulation of retuning while carrier is running
+ *
+ * Executes square carrier instruction by instruction in virtual core cycles:
+ * DAC write, then NOPs until BR LX is found, twice per period. Retune requests
+ * arrive at random times and are applied either
+ *   in place  - BR LX is moved in the buffer being executed right away,
+ *               as if retune came from interrupt
+ *   buffered  - request is picked up by main loop and handed over through
+ *               sled.h at the start of next sample
+ * Every half period is checked to be exactly as long as the tuning it started with
+ * or the one that replaced it, and both halves of period must be equal.
+ * Reports malformed periods, runs off the end of sled and retune latency.
+ *
+ * Build: g++ -std=c++17 -O2 -I.. sled_sim.cpp -o sled_sim
+ * Usage: ./sled_sim [sample rate] [retunes] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "sled.h"
+
+static const uint64_t clock_hz = 120000000;    /* K64F core clock */
+static const uint64_t write_cycles = 12;       /* dac.write_u16() */
+static const uint64_t ret_cycles = 3;          /* BR LX incl. pipeline refill */
+
+static uint64_t seed = 1;
+
+static uint64_t xorshift(){
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+/**
+ * Cycles of half period with BR LX at given index
+ */
+static uint64_t half_cycles(unsigned int index){
+    return write_cycles + index + ret_cycles;
+}
+
+/**
+ * Periods per sample for given BR LX location
+ */
+static unsigned int periods_for(unsigned int index, unsigned int sample_rate){
+    return (unsigned int)(clock_hz / (2 * half_cycles(index)) / sample_rate);
+}
+
+struct request_t {
+    uint64_t at;            /* When request arrived */
+    unsigned int index;     /* Requested BR LX location */
+};
+
+struct result_t {
+    uint64_t periods, malformed, overruns, worst_latency, total_latency;
+    unsigned int applied;
+};
+
+/**
+ * Run carrier through all requests
+ */
+static result_t run(bool buffered, const request_t *requests, unsigned int count, unsigned int sample_rate){
+    result_t result = {0, 0, 0, 0, 0, 0};
+    static sled_t sled;
+    sled_init(&sled, 40, periods_for(40, sample_rate));
+    uint16_t *live = sled.opcodes[0];  /* Buffer rewritten in place */
+    unsigned int live_index = 40, live_periods = sled_periods(&sled);
+
+    uint64_t now = 0;
+    unsigned int next = 0;          /* Next request to arrive */
+    bool waiting = false;           /* Buffered: request arrived, main loop hasn't picked it up yet */
+    request_t latest = {0, 0};
+
+    /* Apply requests that arrived until now, in place mode does so in the middle of sled */
+    auto arrive = [&](){
+        while(next < count && requests[next].at <= now){
+            latest = requests[next++];
+            if(buffered){
+                waiting = true;
+                continue;
+            }
+            live[live_index] = SLED_NOP;
+            live[live_index = latest.index] = SLED_RET;
+            live_periods = periods_for(latest.index, sample_rate);
+            uint64_t latency = now - latest.at;
+            result.total_latency += latency;
+            if(latency > result.worst_latency) result.worst_latency = latency;
+            result.applied++;
+        }
+    };
+
+    /* Execute half period, returns its length */
+    auto half = [&](const uint16_t *opcodes) -> uint64_t {
+        uint64_t begin = now;
+        now += write_cycles;
+        arrive();
+        for(unsigned int p=0;; p++){
+            if(p == MAX_OPCODES){
+                result.overruns++;      /* On target we would execute whatever follows the buffer */
+                break;
+            }
+            if(opcodes[p] == SLED_RET){
+                now += ret_cycles;
+                break;
+            }
+            now++;
+            arrive();
+        }
+        return now - begin;
+    };
+
+    while(next < count || waiting){
+        /* Main loop between samples */
+        arrive();
+        if(buffered && waiting){
+            sled_prepare(&sled, latest.index, periods_for(latest.index, sample_rate));
+            waiting = false;
+        }
+        const uint16_t *opcodes = live;
+        unsigned int periods = live_periods, index = live_index;
+        if(buffered){
+            if(sled_switch(&sled)){
+                uint64_t latency = now - latest.at;
+                result.total_latency += latency;
+                if(latency > result.worst_latency) result.worst_latency = latency;
+                result.applied++;
+            }
+            opcodes = sled_opcodes(&sled);
+            periods = sled_periods(&sled);
+            index = sled_index(&sled);
+        }
+
+        /* Carrier loop of one sample */
+        for(unsigned int i=periods; i; i--){
+            unsigned int started = buffered ? index : live_index;
+            uint64_t high = half(opcodes);
+            uint64_t low = half(opcodes);
+            unsigned int finished = buffered ? index : live_index;
+            bool valid = high == low && (high == half_cycles(started) || high == half_cycles(finished));
+            if(!valid) result.malformed++;
+            result.periods++;
+        }
+        now += 20;  /* Loop overhead */
+    }
+    return result;
+}
+
+int main(int argc, char **argv){
+    unsigned int sample_rate = argc > 1 ? atoi(argv[1]) : 22050;
+    unsigned int count = argc > 2 ? atoi(argv[2]) : 1000;
+    seed = argc > 3 ? strtoull(argv[3], 0, 10) : 1;
+    if(!seed) seed = 1;
+
+    /* Requests spaced few samples apart, to random BR LX locations */
+    request_t *requests = new request_t[count];
+    uint64_t sample_cycles = clock_hz / sample_rate, at = 0;
+    for(unsigned int i=0; i<count; i++){
+        at += sample_cycles + xorshift() % (4 * sample_cycles);
+        requests[i].at = at;
+        requests[i].index = 8 + xorshift() % (MAX_OPCODES - 9);
+    }
+
+    printf("sample rate=%u Hz (%u cycles per sample), retunes=%u\n", sample_rate, (unsigned int)sample_cycles, count);
+    for(int buffered=0; buffered<2; buffered++){
+        result_t r = run(buffered, requests, count, sample_rate);
+        printf("%-9s periods=%llu, malformed=%llu, overruns=%llu, latency avg=%llu worst=%llu cycles (%.3f samples)\n",
+            buffered ? "buffered:" : "in place:", (unsigned long long)r.periods, (unsigned long long)r.malformed,
+            (unsigned long long)r.overruns, (unsigned long long)(r.applied ? r.total_latency / r.applied : 0),
+            (unsigned long long)r.worst_latency, (double)r.worst_latency / sample_cycles);
+    }
+    delete[] requests;
+    return 0;
+}
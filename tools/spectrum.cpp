@@ -0,0 +1,396 @@
+/**
+ * Spectrum and channel mask analyzer of DAC traces
+ *
+ * Trace (from transmitter_sim, see dac_trace.h) is resampled to clock / step
+ * and its power spectrum is estimated by Welch method: Hann windowed segments
+ * of n samples with 50% overlap, averaged. Trace is streamed, so memory doesn't
+ * grow with its length. Two real segments go through one complex FFT (one as
+ * real part, other as imaginary part) and butterflies work on separate real
+ * and imaginary arrays, so that compiler vectorizes them (-O3 -march=native).
+ *
+ * Reported, relative to carrier (dBc):
+ * - carrier frequency (interpolated peak) and its error against expected one
+ * - harmonics up to Nyquist
+ * - strongest spurs within span of carrier (modulation sidebands included)
+ * - bandwidth holding 99% of power within span
+ * - mask: every bin within span against limit at its offset from carrier,
+ *   default is FCC 73.44 AM mask (measured in about 300 Hz, which is equivalent
+ *   noise bandwidth of Hann window with default n and step)
+ *
+ * Resampling averages over step, harmonics far above Nyquist still alias and
+ * may show up as spurs, use smaller step to tell them apart.
+ * Without trace, it analyzes synthesized square carrier with known AM tone (self check):
+ * once with audio updated every period, which has to pass the mask, and once
+ * held for 12 periods like bursts on board, whose hold images around twice the
+ * update rate have to fail it.
+ *
+ * Build: g++ -std=c++17 -O3 -march=native spectrum.cpp -o spectrum
+ * Usage: ./spectrum [-c expected carrier Hz] [-n FFT size] [-s step cycles] [-w span Hz] [-m mask] [trace]
+ *        mask file has lines of "<offset Hz> <limit dBc>", limit is linear between points,
+ *        two points at the same offset make a step, offsets under first point aren't limited
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include "dac_trace.h"
+
+#define MASK_POINTS 64
+#define SPURS 8
+#define LOBE 3                      /* Bins either side that belong to a tone */
+
+struct mask_point_t {
+    double offset;                  /* Hz from carrier */
+    double limit;                   /* dBc */
+};
+
+/* FCC 73.44 */
+static mask_point_t mask[MASK_POINTS] = {
+    {10200, -25}, {20000, -25}, {20000, -35}, {30000, -35},
+    {60000, -65}, {75000, -65}, {75000, -80}, {1e12, -80},
+};
+static unsigned int mask_n = 8;
+
+static unsigned int n = 131072;     /* FFT size */
+static float *re, *im, *twiddle_re, *twiddle_im, *window;
+static double *power;               /* Sum of |X|^2 over segments, n / 2 + 1 bins */
+static unsigned int segments = 0;
+static double window_power = 0;     /* Sum of squared window */
+
+static void fft_init(){
+    re = (float*)malloc(n * sizeof(float));
+    im = (float*)malloc(n * sizeof(float));
+    twiddle_re = (float*)malloc(n * sizeof(float));
+    twiddle_im = (float*)malloc(n * sizeof(float));
+    window = (float*)malloc(n * sizeof(float));
+    power = (double*)calloc(n / 2 + 1, sizeof(double));
+    /* Twiddles of stage with half size h are at h..2h-1, so that butterflies read them in order */
+    for(unsigned int h=1; h<n; h<<=1){
+        for(unsigned int j=0; j<h; j++){
+            twiddle_re[h + j] = (float)cos(M_PI * j / h);
+            twiddle_im[h + j] = (float)-sin(M_PI * j / h);
+        }
+    }
+    for(unsigned int i=0; i<n; i++){
+        window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / n));
+        window_power += (double)window[i] * window[i];
+    }
+}
+
+/**
+ * In place radix-2 FFT of re + i im
+ */
+static void fft(){
+    for(unsigned int i=1, j=0; i<n; i++){
+        unsigned int bit = n >> 1;
+        for(; j & bit; bit >>= 1) j ^= bit;
+        j |= bit;
+        if(i < j){
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for(unsigned int h=1; h<n; h<<=1){
+        const float *wr = twiddle_re + h, *wi = twiddle_im + h;
+        for(unsigned int b=0; b<n; b+=2*h){
+            float *xr = re + b, *xi = im + b, *yr = re + b + h, *yi = im + b + h;
+            for(unsigned int j=0; j<h; j++){
+                float tr = yr[j] * wr[j] - yi[j] * wi[j];
+                float ti = yr[j] * wi[j] + yi[j] * wr[j];
+                yr[j] = xr[j] - tr;
+                yi[j] = xi[j] - ti;
+                xr[j] += tr;
+                xi[j] += ti;
+            }
+        }
+    }
+}
+
+/**
+ * Window segment (without its mean) into re or im
+ */
+static void load(const float *segment, float *into){
+    double mean = 0;
+    for(unsigned int i=0; i<n; i++) mean += segment[i];
+    float m = (float)(mean / n);
+    for(unsigned int i=0; i<n; i++) into[i] = (segment[i] - m) * window[i];
+}
+
+/**
+ * Transform `count` (1 or 2) loaded segments and add their power
+ */
+static void accumulate(unsigned int count){
+    if(count == 1){
+        for(unsigned int i=0; i<n; i++) im[i] = 0;
+    }
+    fft();
+    /* Spectra of real and imaginary part are (Z[k] + conj Z[n-k]) / 2 and (Z[k] - conj Z[n-k]) / 2i */
+    for(unsigned int k=0; k<=n/2; k++){
+        unsigned int m = (n - k) & (n - 1);
+        double ar = re[k] + re[m], ai = im[k] - im[m];
+        double br = re[k] - re[m], bi = im[k] + im[m];
+        power[k] += count == 1 ? re[k] * (double)re[k] + im[k] * (double)im[k] : (ar * ar + ai * ai + br * br + bi * bi) / 4;
+    }
+    segments += count;
+}
+
+/**
+ * Forget segments analyzed so far
+ */
+static void reset(){
+    for(unsigned int k=0; k<=n/2; k++) power[k] = 0;
+    segments = 0;
+}
+
+/**
+ * Welch estimate over whole trace
+ */
+static bool analyze(FILE *file, double step){
+    dac_trace_t trace;
+    if(!dac_trace_open(&trace, file)) return false;
+    float *samples = (float*)malloc(n * sizeof(float));
+    size_t filled = dac_trace_read(&trace, step, samples, n);
+    bool paired = false;
+    while(filled == n){
+        load(samples, paired ? im : re);
+        if(paired) accumulate(2);
+        paired = !paired;
+        memmove(samples, samples + n / 2, n / 2 * sizeof(float));
+        filled = n / 2 + dac_trace_read(&trace, step, samples + n / 2, n / 2);
+    }
+    if(paired) accumulate(1);
+    free(samples);
+    return segments > 0;
+}
+
+/**
+ * One sided power of bin, as mean square of signal in it
+ */
+static double bin_power(unsigned int k){
+    return 2.0 * power[k] / ((double)segments * n * window_power);
+}
+
+/**
+ * Power of bins within `half` of `center`, except those within `half` of `excluded`
+ */
+static double band_power(int center, int half, int excluded = -1){
+    double sum = 0;
+    for(int k=center - half; k<=center + half; k++){
+        if(k > 0 && k <= (int)n / 2 && (excluded < 0 || abs(k - excluded) > half)) sum += bin_power(k);
+    }
+    return sum;
+}
+
+/**
+ * Strongest bin within `half` bins of `center`
+ */
+static int peak(int center, int half){
+    int best = center;
+    for(int k=center - half; k<=center + half; k++){
+        if(k > 0 && k <= (int)n / 2 && power[k] > power[best]) best = k;
+    }
+    return best;
+}
+
+static double mask_limit(double offset){
+    if(offset < mask[0].offset) return INFINITY;
+    for(unsigned int i=mask_n - 1; i; i--){
+        if(offset >= mask[i - 1].offset && offset < mask[i].offset){
+            double t = (offset - mask[i - 1].offset) / (mask[i].offset - mask[i - 1].offset);
+            return mask[i - 1].limit + t * (mask[i].limit - mask[i - 1].limit);
+        }
+    }
+    return mask[mask_n - 1].limit;
+}
+
+static bool load_mask(const char *path){
+    FILE *file = fopen(path, "r");
+    if(!file) return false;
+    char line[128];
+    mask_n = 0;
+    while(fgets(line, sizeof(line), file) && mask_n < MASK_POINTS){
+        double offset, limit;
+        if(sscanf(line, "%lf %lf", &offset, &limit) == 2) mask[mask_n++] = {offset, limit};
+    }
+    fclose(file);
+    return mask_n > 0;
+}
+
+struct report_t {
+    double carrier;                 /* Hz */
+    double level;                   /* dBFS, full scale sine is 0 */
+    double harmonics[16];           /* dBc, index is harmonic number, 0 if above Nyquist */
+    double spur_offsets[SPURS], spur_levels[SPURS];
+    unsigned int spurs;
+    double occupied;                /* Hz */
+    double margin;                  /* Worst distance under mask, dB */
+    double margin_offset;           /* Where it was */
+};
+
+static report_t report(double rate, double expected, double span){
+    report_t r = {};
+    double bin = rate / n;
+    int low = (int)(100000 / bin), high = n / 2 - LOBE;
+    if(expected > 0){
+        low = (int)((expected - span) / bin);
+        high = (int)((expected + span) / bin);
+    }
+    if(low < LOBE + 1) low = LOBE + 1;
+    if(high > (int)n / 2 - LOBE) high = n / 2 - LOBE;
+    int c = low;
+    for(int k=low; k<=high; k++){
+        if(power[k] > power[c]) c = k;
+    }
+    /* Parabola through log power of peak and its neighbours */
+    double a = log(power[c - 1]), b = log(power[c]), g = log(power[c + 1]);
+    double shift = a - 2 * b + g < 0 ? 0.5 * (a - g) / (a - 2 * b + g) : 0;
+    r.carrier = (c + shift) * bin;
+    double carrier = band_power(c, LOBE);
+    r.level = 10 * log10(carrier / 0.125);
+
+    for(int h=2; h<16; h++){
+        int k = (int)(h * r.carrier / bin + 0.5);
+        if(k > (int)n / 2 - LOBE) break;
+        r.harmonics[h] = 10 * log10(band_power(peak(k, LOBE), LOBE) / carrier + 1e-30);
+    }
+
+    int reach = (int)(span / bin);
+    double total = 0;
+    for(int k=c - reach; k<=c + reach; k++){
+        if(k > 0 && k <= (int)n / 2) total += bin_power(k);
+    }
+    double sum = 0, lower = 0, upper = 0;
+    r.margin = INFINITY;
+    for(int k=c - reach; k<=c + reach; k++){
+        if(k <= 0 || k > (int)n / 2) continue;
+        double p = bin_power(k);
+        if(sum < 0.005 * total && sum + p >= 0.005 * total) lower = k;
+        if(sum < 0.995 * total && sum + p >= 0.995 * total) upper = k;
+        sum += p;
+        double offset = fabs(k - c) * bin;
+        double margin = mask_limit(offset) - 10 * log10(p / carrier + 1e-30);
+        if(margin < r.margin){
+            r.margin = margin;
+            r.margin_offset = (k - c) * bin;
+        }
+
+        /* Spur is local maximum outside of carrier lobe */
+        if(abs(k - c) <= LOBE || power[k] <= power[k - 1] || power[k] < power[k + 1]) continue;
+        double level = 10 * log10(band_power(k, LOBE, c) / carrier + 1e-30);
+        unsigned int i = r.spurs < SPURS ? r.spurs++ : SPURS;
+        while(i && r.spur_levels[i - 1] < level){
+            if(i < SPURS){
+                r.spur_levels[i] = r.spur_levels[i - 1];
+                r.spur_offsets[i] = r.spur_offsets[i - 1];
+            }
+            i--;
+        }
+        if(i < SPURS){
+            r.spur_levels[i] = level;
+            r.spur_offsets[i] = (k - c) * bin;
+        }
+    }
+    r.occupied = (upper - lower + 1) * bin;
+    return r;
+}
+
+static void print(const report_t *r, double rate, double expected){
+    printf("segments=%u, rate=%.0f Hz, bin=%.1f Hz, noise bandwidth=%.1f Hz\n",
+        segments, rate, rate / n, 1.5 * rate / n);
+    printf("carrier=%.1f Hz", r->carrier);
+    if(expected > 0) printf(", error=%.1f Hz (%.1f ppm)", r->carrier - expected, (r->carrier - expected) / expected * 1e6);
+    printf(", level=%.1f dBFS\n", r->level);
+    printf("harmonics:");
+    for(int h=2; h<16 && r->harmonics[h] != 0; h++) printf(" %d=%.1f", h, r->harmonics[h]);
+    printf(" dBc\nspurs:");
+    for(unsigned int i=0; i<r->spurs; i++) printf(" %+.0f Hz=%.1f", r->spur_offsets[i], r->spur_levels[i]);
+    printf(" dBc\noccupied bandwidth (99%%)=%.0f Hz\n", r->occupied);
+    printf("mask: %s, margin=%.1f dB at %+.0f Hz\n", r->margin >= 0 ? "pass" : "FAIL", r->margin, r->margin_offset);
+}
+
+/**
+ * Square carrier of 222 cycles at 120 MHz (540.54 kHz) without gaps, 5 kHz tone
+ * with 50% depth, new audio sample every `hold` periods
+ */
+static FILE *synthesize(double seconds, unsigned int hold){
+    FILE *file = tmpfile();
+    dac_trace_header(file, 120000000, 0);
+    for(uint64_t s=0; s<(uint64_t)(seconds * 120000000 / (hold * 222)); s++){
+        double audio = 0.5 * sin(2.0 * M_PI * 5000.0 * s * hold * 222 / 120000000);
+        uint16_t value = (uint16_t)(32768 + 32767 * audio) & 0xFFF0;
+        for(unsigned int p=0; p<hold; p++){
+            dac_trace_write(file, 111, value);
+            dac_trace_write(file, 111, 0);
+        }
+    }
+    rewind(file);
+    return file;
+}
+
+int main(int argc, char **argv){
+    double expected = 0, step = 4, span = 100000;
+    int option;
+    while((option = getopt(argc, argv, "c:n:s:w:m:")) != -1){
+        switch(option){
+            case 'c': expected = atof(optarg); break;
+            case 'n': n = atoi(optarg); break;
+            case 's': step = atof(optarg); break;
+            case 'w': span = atof(optarg); break;
+            case 'm':
+                if(!load_mask(optarg)){
+                    fprintf(stderr, "%s: no mask points\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c expected carrier Hz] [-n FFT size] [-s step cycles] [-w span Hz] [-m mask] [trace]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(n < 256 || n & (n - 1)){
+        fprintf(stderr, "FFT size has to be power of two\n");
+        return 1;
+    }
+    fft_init();
+    bool check = optind >= argc;
+    FILE *file = check ? synthesize(0.5, 1) : fopen(argv[optind], "rb");
+    if(check) expected = 120000000.0 / 222;
+    dac_trace_t header;
+    if(!file || !dac_trace_open(&header, file)){
+        fprintf(stderr, "not a DAC trace\n");
+        return 1;
+    }
+    rewind(file);
+    double rate = header.clock / step;
+    if(!analyze(file, step)){
+        fprintf(stderr, "trace is shorter than one segment\n");
+        return 1;
+    }
+    fclose(file);
+    report_t r = report(rate, expected, span);
+    print(&r, rate, expected);
+    if(!check) return 0;
+
+    /* Square: odd harmonics at 1/h, none even; AM sidebands at m/2 */
+    int failures = 0;
+    if(fabs(r.carrier - expected) > 0.1 * rate / n) failures++;
+    if(fabs(r.harmonics[3] - 20 * log10(1.0 / 3)) > 0.5) failures++;
+    if(r.harmonics[2] > -60) failures++;
+    if(r.spurs < 2 || fabs(fabs(r.spur_offsets[0]) - 5000) > rate / n || fabs(r.spur_levels[0] - 20 * log10(0.25)) > 0.5) failures++;
+    if(r.margin < 0) failures++;
+
+    /* Held for 12 periods (45 kHz): images at 90 kHz +-5 kHz are about -36 dBc, far above -80 dBc limit past 75 kHz */
+    reset();
+    file = synthesize(0.5, 12);
+    if(!analyze(file, step)){
+        fprintf(stderr, "trace is shorter than one segment\n");
+        return 1;
+    }
+    fclose(file);
+    r = report(rate, expected, span);
+    print(&r, rate, expected);
+    if(r.margin > -20 || fabs(fabs(r.margin_offset) - 90090) > 5000 + 2 * rate / n) failures++;
+    printf("failures=%d\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * Decoder of serial output
+ *
+ * Serial port carries text, telemetry frames (telemetry.h) and scan records
+ * (scan.h) one after another (all are queued whole into telemetry ring, so
+ * none is cut by another). This splits them again: binary is recognized by
+ * sync byte, length and XOR, everything else is passed through as text.
+ * Works on live port as well as on capture, reads until end of file.
+ * Without port argument, it decodes built-in sample of mixed output (self check).
+ *
+ * Build: g++ -std=c++17 -O2 -I.. telemetry_decode.cpp -o telemetry_decode
+ * Usage: ./telemetry_decode [port or capture file]
+ *        (set port to 115200 raw first, e.g. stty -F /dev/ttyACM0 115200 raw)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "telemetry.h"
+#include "scan.h"
+
+static const char *states[] = {"broadcasting", "testing", "measuring", "standby"};
+static const char *sources[] = {"adc", "tone", "silence"};
+
+static char line[256];
+static unsigned int line_length = 0;
+static unsigned int frames = 0, records = 0;
+
+static void text(uint8_t c){
+    if(c == '\r') return;
+    if(c == '\n' || line_length == sizeof(line) - 1){
+        line[line_length] = 0;
+        printf("text: %s\n", line);
+        line_length = 0;
+        if(c == '\n') return;
+    }
+    line[line_length++] = c >= 32 && c < 127 ? c : '.';
+}
+
+static void status(const uint8_t *payload){
+    telemetry_status_t s;
+    telemetry_unpack_status(payload, &s);
+    printf("status #%u t=%u.%03u s: %s, channel=%u Hz, measured=%u Hz, rate=%u Hz, source=%s, depth=%u%%,%s%s%s%s "
+        "samples=%u, drift=%d/s, load carrier=%u.%u%% total=%u.%u%%, audio peak=%u mean=%u\n",
+        s.sequence, s.time / 1000, s.time % 1000, s.state < 4 ? states[s.state] : "?", s.channel, s.measured, s.sample_rate,
+        s.source < 3 ? sources[s.source] : "?", s.depth,
+        s.flags & TELEMETRY_HOPPING ? " hopping," : "", s.flags & TELEMETRY_SCANNING ? " scanning," : "",
+        s.flags & TELEMETRY_REALTIME ? " realtime," : "", s.flags & TELEMETRY_COUNTING ? " counting," : "",
+        s.bursts, s.drift, s.carrier_load / 10, s.carrier_load % 10, s.total_load / 10, s.total_load % 10, s.peak, s.level);
+}
+
+static void headroom(const uint8_t *payload){
+    telemetry_headroom_t h;
+    telemetry_unpack_headroom(payload, &h);
+    printf("headroom #%u: rate=%u Hz, source=%u.%u%% control=%u.%u%% carrier=%u.%u%% other=%u.%u%% padding=%s%d.%d%%, "
+        "worst=%u cycles of %u, profile=%s, fallbacks=%u\n", h.window, h.sample_rate,
+        h.stages[0] / 10, h.stages[0] % 10, h.stages[1] / 10, h.stages[1] % 10, h.stages[2] / 10, h.stages[2] % 10,
+        h.stages[3] / 10, h.stages[3] % 10, h.padding < 0 ? "-" : "", abs(h.padding) / 10, abs(h.padding) % 10,
+        h.worst, h.period, h.flags & TELEMETRY_LIGHT ? "light" : "full", h.fallbacks);
+}
+
+static void monitor(const uint8_t *payload){
+    telemetry_monitor_t m;
+    telemetry_unpack_monitor(payload, &m);
+    char distortion[16] = "quiet";
+    if(!(m.flags & TELEMETRY_QUIET)) snprintf(distortion, sizeof(distortion), "%.1f dB", m.distortion / 10.0);
+    printf("monitor #%u: depth=%u.%u%%, overmodulation=%u, distortion=%s, envelope=%u-%u mean=%u, lag=%d\n", m.window,
+        m.depth / 10, m.depth % 10, m.events, distortion, m.min, m.max, m.level, m.lag);
+}
+
+static void record(const uint8_t *r){
+    printf("scan channel=%u nominal=%u Hz measured=%u Hz (%s) bursts=%u%s\n", r[1],
+        telemetry_get(r + 2, 4), telemetry_get(r + 6, 4), r[14] & SCAN_COUNTED ? "counter" : "cycles",
+        telemetry_get(r + 10, 4), r[14] & SCAN_LAST ? " last" : "");
+}
+
+static uint8_t checksum(const uint8_t *data, unsigned int length){
+    uint8_t check = 0;
+    for(unsigned int i=0; i<length; i++){
+        check ^= data[i];
+    }
+    return check;
+}
+
+/**
+ * Decode what's in buffer, returns how many bytes were used up
+ * Incomplete binary at the end is left for next time, unless `flush` is set
+ */
+static unsigned int decode(const uint8_t *buffer, unsigned int length, bool flush){
+    unsigned int i = 0;
+    while(i < length){
+        const uint8_t *p = buffer + i;
+        unsigned int left = length - i;
+        if(p[0] == TELEMETRY_SYNC){
+            if(left < 3 || left < (unsigned int)p[2] + TELEMETRY_OVERHEAD){
+                if(!flush) break;
+            } else if(checksum(p, p[2] + 3) == p[p[2] + 3]){
+                if(p[1] == TELEMETRY_STATUS && p[2] == TELEMETRY_STATUS_LENGTH) status(p + 3);
+                else if(p[1] == TELEMETRY_HEADROOM && p[2] == TELEMETRY_HEADROOM_LENGTH) headroom(p + 3);
+                else if(p[1] == TELEMETRY_MONITOR && p[2] == TELEMETRY_MONITOR_LENGTH) monitor(p + 3);
+                else if(p[1] == TELEMETRY_TRACE && p[2] >= 4) printf("trace entries %u+ of %u (tools/trace_view renders them)\n",
+                    telemetry_get(p + 3, 2), telemetry_get(p + 5, 2));
+                else printf("frame type=%u length=%u\n", p[1], p[2]);
+                frames++;
+                i += p[2] + TELEMETRY_OVERHEAD;
+                continue;
+            }
+        } else if(p[0] == SCAN_SYNC){
+            if(left < SCAN_RECORD){
+                if(!flush) break;
+            } else if(checksum(p, SCAN_RECORD - 1) == p[SCAN_RECORD - 1]){
+                record(p);
+                records++;
+                i += SCAN_RECORD;
+                continue;
+            }
+        }
+        text(p[0]);
+        i++;
+    }
+    return i;
+}
+
+/**
+ * Mixed output as transmitter would send it
+ */
+static unsigned int sample(uint8_t *buffer){
+    telemetry_t telemetry;
+    telemetry_init(&telemetry);
+    telemetry_status_t s = {7, 123456, 0, 1, 80, TELEMETRY_HOPPING | TELEMETRY_COUNTING,
+        1008000, 1008012, 2722000, -1, 612, 947, 23170, 14751, 22050};
+    telemetry_status(&telemetry, &s);
+    telemetry_headroom_t h = {42, 2721, 2695, 22050, {31, 48, 893, 12}, 16, TELEMETRY_LIGHT, 1};
+    telemetry_headroom(&telemetry, &h);
+    telemetry_monitor_t m = {17, 812, 0, -371, 1011, 190, 1803, 2, 0};
+    telemetry_monitor(&telemetry, &m);
+    const uint8_t *data;
+    unsigned int length = 0, count;
+
+    const char *hello = "Hop: dwell=2205 samples over 80 channels\n";
+    memcpy(buffer, hello, strlen(hello));
+    length += strlen(hello);
+    while((count = telemetry_peek(&telemetry, &data))){
+        memcpy(buffer + length, data, count);
+        telemetry_consume(&telemetry, count);
+        length += count;
+    }
+    scan_t scan = {12, 0, 0, 88200};    /* 2 s dwell, doesn't fit 16 bits */
+    length += scan_encode(&scan, 639000, 638993, SCAN_COUNTED, buffer + length);
+    const char *bye = "Tasks: worst=512 cycles of 600\n";
+    memcpy(buffer + length, bye, strlen(bye));
+    return length + strlen(bye);
+}
+
+int main(int argc, char **argv){
+    uint8_t buffer[1024];
+    unsigned int length = 0;
+    if(argc < 2){
+        length = sample(buffer);
+        decode(buffer, length, true);
+        printf("frames=%u, records=%u\n", frames, records);
+        return frames == 3 && records == 1 ? 0 : 1;
+    }
+
+    /* Plain read(), so that we get whatever port has instead of waiting for full buffer */
+    int input = open(argv[1], O_RDONLY);
+    if(input < 0){
+        perror(argv[1]);
+        return 1;
+    }
+    ssize_t got;
+    while((got = read(input, buffer + length, sizeof(buffer) - length)) > 0){
+        length += got;
+        unsigned int used = decode(buffer, length, false);
+        memmove(buffer, buffer + used, length - used);
+        length -= used;
+        fflush(stdout);
+    }
+    decode(buffer, length, true);
+    if(line_length) text('\n');
+    printf("frames=%u, records=%u\n", frames, records);
+    close(input);
+    return 0;
+}
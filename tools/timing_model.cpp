@@ -0,0 +1,363 @@
+/**
+ * Cortex-M4 timing model of carrier loop
+ *
+ * MEASURING sweep exists because cycle cost of transmit() with BR LX at given
+ * sled location isn't known in advance. This model predicts it, so that
+ * frequency table can be planned before deploying. Carrier period is made of
+ * DAC writes (two for square, four for sine), each followed by the sled:
+ *   write   dac.write_u16(): call path instructions and branches from flash,
+ *           stores to DAC data registers (DATL, DATH) through peripheral bridge
+ *   enter   BLX into sled, pipeline refill from memory sled lives in
+ *   sled    `index` NOPs, 16 bits each, fetched 32 bits at a time, so memory
+ *           with wait states slows them down once fetch can't keep up
+ *   return  BX LR, pipeline refill from flash
+ * plus loop counter and branch once per period. Flash runs at 24 MHz, so
+ * fetch that misses flash cache and prefetch buffer waits FLASH_WAIT cycles;
+ * hot loop fits into cache, `-x` sets share of fetches that still miss.
+ * Sled is in .bss, which linker script puts into SRAM_U, that is fetched over
+ * system bus (SRAM_WAIT), SRAM_L would be fetched over code bus without wait.
+ * ADC interrupt at sample rate steals its cycles during measurement too.
+ *
+ * Measurements from board (`measured <index>` console command, lines starting
+ * with "Measured:" are picked from any console log) are fitted with straight
+ * line period = base + slope * index, which shows how far model is off and
+ * whether anything isn't linear. Channel table is predicted from model, or
+ * from fit with -c, and compared with what measurements would give, the same
+ * way main.cpp picks BR LX location for each channel.
+ *
+ * Fit is also made from every HOLD_STEP-th location only and checked against
+ * locations it didn't see (held out residual), residual of fit on its own
+ * points only says how straight they are.
+ *
+ * Without measurements, it fits measurements synthesized by perturbed model
+ * (rounded to microseconds like on board) and checks that fit recovers them on
+ * held out locations and predicts the same table (self check). That only checks
+ * fitting, synthesized data comes from the model itself; logs of transmitter_sim
+ * (own cost model) or board are what tells how good the model is.
+ *
+ * Build: g++ -std=c++17 -O2 timing_model.cpp -o timing_model
+ * Usage: ./timing_model [-w square|sine] [-m flash|sram_l|sram_u] [-r sample rate] [-l interrupt cycles]
+ *                       [-x flash miss share] [-c] [console.log ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "../channels.h"     /* Channels main.cpp tries to match */
+
+#define CLOCK 120000000.0           /* Core clock */
+#define MAX_OPCODES 80              /* Same as sled.h */
+#define MEASURE_LIMIT (MAX_OPCODES - 1) /* BR LX locations measured, as in main.cpp */
+#define MEASURE_PERIODS 100000      /* Periods per measurement, as in main.cpp */
+#define FLASH_WAIT 4                /* Wait states of flash fetch at 120 MHz core, 24 MHz flash */
+#define SRAM_WAIT 1                 /* Wait states of instruction fetch over system bus */
+#define WRITE_INSTRUCTIONS 14       /* write_u16() path, besides branches and stores */
+#define WRITE_BRANCHES 6            /* Calls and returns of write_u16() path (lock, HAL, driver, unlock) */
+#define DAC_STORES 2                /* DATL and DATH */
+#define BRIDGE_CYCLES 4             /* Core cycles of store through peripheral bridge (60 MHz bus) */
+#define LOOP_INSTRUCTIONS 2         /* Loop counter, besides branch */
+#define IRQ_CYCLES 70               /* ADC interrupt entry, handler and exit */
+#define HOLD_STEP 2                 /* Fit sees every HOLD_STEP-th location, rest is held out to check it */
+
+#define SQUARE 0
+#define SINE 1
+#define FLASH 0
+#define SRAM_L 1
+#define SRAM_U 2
+
+struct model_t {
+    int waveform;
+    int sled_memory;                /* Where sled lives, FLASH, SRAM_L or SRAM_U */
+    double flash_miss;              /* Share of flash fetches missing cache */
+    double bridge;                  /* Core cycles per DAC store */
+    double irq;                     /* Cycles per ADC interrupt */
+    unsigned int sample_rate;
+};
+
+struct line_t {
+    double base, slope;             /* Period in cycles is base + slope * index */
+    double worst;                   /* Worst residual of fit in cycles */
+};
+
+/**
+ * Wait states of instruction fetch from given memory
+ */
+static double fetch_wait(const model_t *model, int memory){
+    if(memory == FLASH) return model->flash_miss * FLASH_WAIT;
+    return memory == SRAM_U ? SRAM_WAIT : 0;
+}
+
+/**
+ * Taken branch, executes in one cycle and refills pipeline from target memory
+ */
+static double branch(const model_t *model, int memory){
+    return 1 + 2 + fetch_wait(model, memory);
+}
+
+/**
+ * Cycles of carrier period with BR LX at given index, without interrupts
+ */
+static double period_cycles(const model_t *model, unsigned int index){
+    double write = WRITE_INSTRUCTIONS * (1 + fetch_wait(model, FLASH) / 2) + WRITE_BRANCHES * branch(model, FLASH)
+        + DAC_STORES * model->bridge;
+    /* Two NOPs per fetch, fetch slower than two cycles holds them up */
+    double nop = fmax(1.0, (1 + fetch_wait(model, model->sled_memory)) / 2);
+    double half = write + branch(model, model->sled_memory) + index * nop + branch(model, FLASH);
+    double loop = LOOP_INSTRUCTIONS + branch(model, FLASH);
+    return (model->waveform == SINE ? 4 : 2) * half + loop;
+}
+
+/**
+ * Share of core taken by ADC interrupt
+ */
+static double irq_load(const model_t *model){
+    return model->irq * model->sample_rate / CLOCK;
+}
+
+/**
+ * Measurement board would make, in microseconds of MEASURE_PERIODS periods
+ */
+static unsigned int predict(const model_t *model, unsigned int index){
+    double cycles = MEASURE_PERIODS * period_cycles(model, index) / (1 - irq_load(model));
+    return (unsigned int)(cycles / CLOCK * 1000000.0);
+}
+
+/**
+ * Measurement in cycles per period
+ */
+static double cycles(unsigned int measurement){
+    return measurement * CLOCK / 1000000.0 / MEASURE_PERIODS;
+}
+
+/**
+ * Least squares line through every `step`-th measurement (from index 0), in cycles per period
+ * Residual is of the same measurements, see held_out() for the others
+ */
+static line_t fit(const unsigned int *measurements, unsigned int count, unsigned int step = 1){
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    unsigned int n = 0;
+    for(unsigned int i=0; i<count; i+=step){
+        double y = cycles(measurements[i]);
+        sx += i;
+        sy += y;
+        sxx += (double)i * i;
+        sxy += i * y;
+        n++;
+    }
+    line_t line;
+    line.slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    line.base = (sy - line.slope * sx) / n;
+    line.worst = 0;
+    for(unsigned int i=0; i<count; i+=step){
+        double residual = cycles(measurements[i]) - (line.base + line.slope * i);
+        if(fabs(residual) > fabs(line.worst)) line.worst = residual;
+    }
+    return line;
+}
+
+/**
+ * Worst residual of line fitted with fit(..., step) on measurements it didn't see
+ */
+static double held_out(const line_t *line, const unsigned int *measurements, unsigned int count, unsigned int step){
+    double worst = 0;
+    for(unsigned int i=0; i<count; i++){
+        if(i % step == 0) continue;
+        double residual = cycles(measurements[i]) - (line->base + line->slope * i);
+        if(fabs(residual) > fabs(worst)) worst = residual;
+    }
+    return worst;
+}
+
+/**
+ * Carrier frequency of measurement
+ */
+static double frequency(unsigned int measurement){
+    return MEASURE_PERIODS * 1000000.0 / measurement;
+}
+
+/**
+ * BR LX location whose frequency is closest to given one, as closest() in main.cpp
+ */
+static unsigned int closest(const unsigned int *measurements, unsigned int count, double target){
+    unsigned int best = 0;
+    double best_diff = target;
+    for(unsigned int i=0; i<count; i++){
+        double diff = fabs(frequency(measurements[i]) - target);
+        if(diff < best_diff){
+            best_diff = diff;
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+struct table_t {
+    double worst;                   /* Worst channel error in Hz */
+    unsigned int mismatches;        /* Channels where prediction picks other location than measurements */
+};
+
+/**
+ * Channel table from predicted measurements, compared with real ones if there are any
+ * Carrier is sample_rate / 2 below channel, as broadcast is upper sideband
+ */
+static table_t table(const unsigned int *predicted, const unsigned int *measured, unsigned int sample_rate, bool quiet){
+    table_t result = {0, 0};
+    double worst_measured = 0;
+    for(unsigned int c=0; c<CHANNELS; c++){
+        double target = channel_rasters[c] - sample_rate / 2.0;
+        unsigned int i = closest(predicted, MEASURE_LIMIT - 1, target);
+        double carrier = frequency(predicted[i]);
+        if(fabs(carrier - target) > result.worst) result.worst = fabs(carrier - target);
+        if(!quiet) printf("%7u Hz: index=%2u, periods=%3d, predicted=%7.0f Hz (%+5.0f)", channel_rasters[c], i,
+            (int)(0.5 * carrier / sample_rate), carrier + sample_rate / 2.0, carrier - target);
+        if(measured){
+            unsigned int j = closest(measured, MEASURE_LIMIT - 1, target);
+            double real = frequency(measured[j]);
+            if(j != i) result.mismatches++;
+            if(fabs(real - target) > worst_measured) worst_measured = fabs(real - target);
+            if(!quiet) printf(", measured index=%2u, %7.0f Hz (%+5.0f)%s", j, real + sample_rate / 2.0, real - target, j != i ? " *" : "");
+        }
+        if(!quiet) printf("\n");
+    }
+    if(!quiet){
+        printf("channels=%u, worst predicted error=%.0f Hz", (unsigned int)CHANNELS, result.worst);
+        if(measured) printf(", worst measured error=%.0f Hz, different locations=%u", worst_measured, result.mismatches);
+        printf("\n");
+    }
+    return result;
+}
+
+/**
+ * Pick measurements out of console log, returns how many locations were found
+ */
+static unsigned int load(const char *path, unsigned int *measurements, int *waveform){
+    FILE *file = fopen(path, "r");
+    if(!file) return 0;
+    char line[512], name[16];
+    unsigned int found = 0, periods, from;
+    int offset;
+    while(fgets(line, sizeof(line), file)){
+        const char *text = strstr(line, "Measured: waveform=");
+        if(!text || sscanf(text, "Measured: waveform=%15[a-z], periods=%u, from=%u, us=%n", name, &periods, &from, &offset) != 3) continue;
+        if(periods != MEASURE_PERIODS) continue;
+        *waveform = strcmp(name, "sine") ? SQUARE : SINE;
+        const char *p = text + offset;
+        for(unsigned int i=from; i<MEASURE_LIMIT; i++){
+            char *end;
+            unsigned long value = strtoul(p, &end, 10);
+            if(end == p) break;
+            measurements[i] = (unsigned int)value;
+            if(i + 1 > found) found = i + 1;
+            if(*end != ',') break;
+            p = end + 1;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+/**
+ * Print period line, in cycles as they pass on board (interrupts included)
+ */
+static void describe(const char *name, double base, double slope){
+    printf("%s: period=%.2f + %.3f * index cycles, index 0 at %.0f Hz, index %d at %.0f Hz\n", name, base, slope,
+        CLOCK / base, MEASURE_LIMIT - 1, CLOCK / (base + slope * (MEASURE_LIMIT - 1)));
+}
+
+/**
+ * Fit measurements synthesized by perturbed model and predict table from it
+ */
+static int self_check(){
+    int failures = 0;
+    const char *memories[] = {"flash", "sram_l", "sram_u"};
+    for(int waveform=SQUARE; waveform<=SINE; waveform++){
+        for(int memory=FLASH; memory<=SRAM_U; memory++){
+            model_t model = {waveform, SRAM_U, 0.0, BRIDGE_CYCLES, IRQ_CYCLES, 22050};
+            model_t board = {waveform, memory, 0.05, BRIDGE_CYCLES + 1.5, IRQ_CYCLES * 1.3, 22050};
+            unsigned int predicted[MEASURE_LIMIT], measured[MEASURE_LIMIT];
+            for(unsigned int i=0; i<MEASURE_LIMIT; i++){
+                predicted[i] = predict(&model, i);
+                measured[i] = predict(&board, i);
+            }
+            line_t line = fit(measured, MEASURE_LIMIT, HOLD_STEP);
+            double held = held_out(&line, measured, MEASURE_LIMIT, HOLD_STEP);
+            double load = 1 - irq_load(&board);
+            double base = period_cycles(&board, 0) / load, slope = (period_cycles(&board, 1) - period_cycles(&board, 0)) / load;
+            bool recovered = fabs(line.base - base) < 0.2 && fabs(line.slope - slope) < 0.01 && fabs(held) < 0.1;
+            /* Calibrated model has to pick the same locations as measurements */
+            for(unsigned int i=0; i<MEASURE_LIMIT; i++){
+                predicted[i] = (unsigned int)lrint((line.base + line.slope * i) * MEASURE_PERIODS / CLOCK * 1000000.0);
+            }
+            table_t result = table(predicted, measured, board.sample_rate, true);
+            bool ok = recovered && result.mismatches <= 2;
+            printf("%s, sled in %s: fit=%.2f + %.3f * index (board %.2f + %.3f), held out residual=%.3f cycles, different locations=%u %s\n",
+                waveform == SINE ? "sine" : "square", memories[memory], line.base, line.slope, base, slope, fabs(held),
+                result.mismatches, ok ? "ok" : "FAIL");
+            if(!ok) failures++;
+        }
+    }
+    printf("failures=%d\n", failures);
+    return failures;
+}
+
+int main(int argc, char **argv){
+    model_t model = {SQUARE, SRAM_U, 0.0, BRIDGE_CYCLES, IRQ_CYCLES, 22050};
+    bool calibrate = false, waveform_given = false;
+    int option;
+    while((option = getopt(argc, argv, "w:m:r:l:x:c")) != -1){
+        switch(option){
+            case 'w': model.waveform = strcmp(optarg, "sine") ? SQUARE : SINE; waveform_given = true; break;
+            case 'm': model.sled_memory = !strcmp(optarg, "flash") ? FLASH : !strcmp(optarg, "sram_l") ? SRAM_L : SRAM_U; break;
+            case 'r': model.sample_rate = atoi(optarg); break;
+            case 'l': model.irq = atof(optarg); break;
+            case 'x': model.flash_miss = atof(optarg); break;
+            case 'c': calibrate = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-w square|sine] [-m flash|sram_l|sram_u] [-r sample rate] [-l interrupt cycles] [-x flash miss share] [-c] [console.log ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(argc == 1) return self_check() ? 1 : 0;
+
+    unsigned int measured[MEASURE_LIMIT] = {0}, found = 0;
+    int waveform = model.waveform;
+    for(int a=optind; a<argc; a++){
+        unsigned int n = load(argv[a], measured, &waveform);
+        if(!n) fprintf(stderr, "%s: no measurements\n", argv[a]);
+        if(n > found) found = n;
+    }
+    if(found && !waveform_given) model.waveform = waveform;
+    for(unsigned int i=0; i<found; i++){
+        if(!measured[i]){
+            fprintf(stderr, "measurement of index %u is missing\n", i);
+            return 1;
+        }
+    }
+
+    unsigned int predicted[MEASURE_LIMIT];
+    double load = 1 - irq_load(&model);
+    for(unsigned int i=0; i<MEASURE_LIMIT; i++) predicted[i] = predict(&model, i);
+    describe("model", period_cycles(&model, 0) / load, (period_cycles(&model, 1) - period_cycles(&model, 0)) / load);
+    if(found){
+        line_t line = fit(measured, found);
+        describe("fit", line.base, line.slope);
+        double worst = 0;
+        for(unsigned int i=0; i<found; i++){
+            double error = frequency(predicted[i]) - frequency(measured[i]);
+            if(fabs(error) > fabs(worst)) worst = error;
+        }
+        /* Residual of fit on its own points only says line is straight, locations it didn't see say whether it predicts */
+        line_t half = fit(measured, found, HOLD_STEP);
+        printf("locations=%u, fit residual=%.2f cycles, held out residual=%.2f cycles (fit on every %d. location), worst model error=%.0f Hz\n",
+            found, line.worst, held_out(&half, measured, found, HOLD_STEP), HOLD_STEP, worst);
+        if(calibrate){
+            for(unsigned int i=0; i<MEASURE_LIMIT; i++){
+                predicted[i] = (unsigned int)lrint((line.base + line.slope * i) * MEASURE_PERIODS / CLOCK * 1000000.0);
+            }
+        }
+    }
+    table(predicted, found >= MEASURE_LIMIT ? measured : 0, model.sample_rate, false);
+    return 0;
+}
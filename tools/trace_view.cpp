@@ -0,0 +1,202 @@
+/**
+ * Event trace viewer
+ *
+ * Picks trace frames (see trace.h) out of serial output after `trace` command
+ * and renders timeline: one line per event, grouped by boot, with time since
+ * boot, time since previous event and state transmitter was in.
+ * Without port argument, it renders trace of simulated run with warm reset (self check).
+ *
+ * Build: g++ -std=c++17 -O2 -I.. trace_view.cpp -o trace_view
+ * Usage: ./trace_view [port or capture file]
+ *        (set port to 115200 raw first, e.g. stty -F /dev/ttyACM0 115200 raw,
+ *        start viewer and then send `trace`)
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static uint32_t now = 0;        /* Simulated time for self check */
+#define TRACE_NOW() now
+#include "trace.h"
+#include "telemetry.h"
+
+static const char *states[] = {"broadcasting", "testing", "measuring", "standby"};
+static const char *events[TRACE_EVENTS] = {"?", "boot", "state", "retune", "underrun", "overrun", "clip", "trim", "profile"};
+
+static trace_entry_t entries[TRACE_ENTRIES];
+static bool received[TRACE_ENTRIES];
+static unsigned int kept = 0;
+
+/**
+ * Reset cause from RCM status registers
+ */
+static void cause(uint32_t value, char *text, size_t size){
+    static const char *srs0[8] = {"wakeup", "low voltage", "clock loss", "PLL loss", 0, "watchdog", "pin", "power on"};
+    static const char *srs1[8] = {"JTAG", "lockup", "software", "debugger", 0, "stop ack", 0, 0};
+    text[0] = 0;
+    for(unsigned int i=0; i<16; i++){
+        const char *name = i < 8 ? srs0[i] : srs1[i - 8];
+        if(!(value >> i & 1) || !name) continue;
+        if(text[0]) strncat(text, ", ", size - strlen(text) - 1);
+        strncat(text, name, size - strlen(text) - 1);
+    }
+    if(!text[0]) strncpy(text, "unknown", size);
+}
+
+static void render(){
+    unsigned int missing = 0;
+    for(unsigned int i=0; i<kept; i++){
+        if(!received[i]) missing++;
+    }
+    printf("%u entries, %u missing\n", kept, missing);
+
+    int boot = -1;
+    uint32_t last = 0;
+    const char *state = "-";
+    for(unsigned int i=0; i<kept; i++){
+        if(!received[i]) continue;
+        const trace_entry_t *e = &entries[i];
+        char text[64];
+        if(e->event == TRACE_BOOT || e->boot != boot){
+            cause(e->event == TRACE_BOOT ? e->value : 0, text, sizeof(text));
+            printf("\nboot %u, reset cause: %s\n", e->boot, e->event == TRACE_BOOT ? text : "not in trace");
+            boot = e->boot;
+            last = e->time;
+            state = "-";
+        }
+        switch(e->event){
+            case TRACE_STATE:
+                state = e->value >= 0 && e->value < 4 ? states[e->value] : "?";
+                snprintf(text, sizeof(text), "-> %s", state);
+                break;
+            case TRACE_RETUNE: snprintf(text, sizeof(text), "%d Hz", (int)e->value); break;
+            case TRACE_UNDERRUN:
+            case TRACE_OVERRUN: snprintf(text, sizeof(text), "drift %+d samples/s", (int)e->value); break;
+            case TRACE_CLIP: snprintf(text, sizeof(text), "%d samples", (int)e->value); break;
+            case TRACE_TRIM: snprintf(text, sizeof(text), "%+d ppb", (int)e->value); break;
+            case TRACE_PROFILE: snprintf(text, sizeof(text), "%s", e->value ? "light" : "full"); break;
+            case TRACE_BOOT: text[0] = 0; break;
+            default: snprintf(text, sizeof(text), "%d", (int)e->value); break;
+        }
+        printf("  %10.6f s  %+10.6f s  %-12s  %-8s %s\n", e->time * 1e-6, (int32_t)(e->time - last) * 1e-6, state,
+            e->event < TRACE_EVENTS ? events[e->event] : "?", text);
+        last = e->time;
+    }
+}
+
+/**
+ * Pick trace frames out of buffer, returns how many bytes were used up
+ */
+static unsigned int decode(const uint8_t *buffer, unsigned int length){
+    unsigned int i = 0;
+    while(i < length){
+        const uint8_t *p = buffer + i;
+        unsigned int left = length - i;
+        if(p[0] != TELEMETRY_SYNC){
+            i++;
+            continue;
+        }
+        if(left < 3 || left < (unsigned int)p[2] + TELEMETRY_OVERHEAD) break;
+        uint8_t check = 0;
+        for(unsigned int j=0; j<(unsigned int)p[2] + 3; j++){
+            check ^= p[j];
+        }
+        if(check != p[p[2] + 3] || p[1] != TELEMETRY_TRACE || p[2] < TRACE_HEADER){
+            i++;
+            continue;
+        }
+        const uint8_t *payload = p + 3;
+        unsigned int first = telemetry_get(payload, 2), count = (p[2] - TRACE_HEADER) / TRACE_ENTRY;
+        kept = telemetry_get(payload + 2, 2);
+        for(unsigned int j=0; j<count && first + j < TRACE_ENTRIES; j++){
+            const uint8_t *e = payload + TRACE_HEADER + j * TRACE_ENTRY;
+            trace_entry_t *entry = &entries[first + j];
+            entry->time = telemetry_get(e, 4);
+            entry->event = telemetry_get(e + 4, 2);
+            entry->boot = telemetry_get(e + 6, 2);
+            entry->value = (int32_t)telemetry_get(e + 8, 4);
+            received[first + j] = true;
+        }
+        i += p[2] + TELEMETRY_OVERHEAD;
+    }
+    return i;
+}
+
+/**
+ * Trace of simulated run: measurement, broadcast, hiccups, watchdog reset and second run
+ */
+static unsigned int simulate(uint8_t *buffer){
+    static trace_t trace;           /* Zeroed, like RAM after power on might be */
+    trace_init(&trace, 0x80);
+    for(int boot=0; boot<2; boot++){
+        now = 1200;
+        trace_log(&trace, TRACE_STATE, 2);
+        now = 8300000;
+        trace_log(&trace, TRACE_STATE, 1);
+        now = 8450000;
+        trace_log(&trace, TRACE_STATE, 0);
+        now = 15000000;
+        trace_log(&trace, TRACE_RETUNE, 1008000);
+        now = 31000000;
+        trace_log(&trace, TRACE_CLIP, 37);
+        now = 42000000;
+        trace_log(&trace, TRACE_UNDERRUN, 3);
+        if(!boot){
+            now = 0;                    /* Timer starts over after reset */
+            trace_init(&trace, 0x20);   /* Watchdog */
+        }
+    }
+
+    telemetry_t telemetry;
+    telemetry_init(&telemetry);
+    unsigned int total = trace_kept(&trace), sent = 0, length = 0, count;
+    uint32_t from = trace.head - total;
+    while(sent < total){
+        uint8_t payload[TRACE_HEADER + TRACE_FRAME_ENTRIES * TRACE_ENTRY];
+        unsigned int size = trace_encode(&trace, from, sent, total, payload);
+        telemetry_frame(&telemetry, TELEMETRY_TRACE, payload, size);
+        sent += (size - TRACE_HEADER) / TRACE_ENTRY;
+        const uint8_t *data;
+        while((count = telemetry_peek(&telemetry, &data))){
+            memcpy(buffer + length, data, count);
+            telemetry_consume(&telemetry, count);
+            length += count;
+        }
+    }
+    return length;
+}
+
+int main(int argc, char **argv){
+    uint8_t buffer[1024];
+    unsigned int length = 0;
+    if(argc < 2){
+        decode(buffer, simulate(buffer));
+        render();
+        return kept == 14 ? 0 : 1;
+    }
+
+    /* Plain read(), so that we get whatever port has instead of waiting for full buffer */
+    int input = open(argv[1], O_RDONLY);
+    if(input < 0){
+        perror(argv[1]);
+        return 1;
+    }
+    ssize_t got;
+    while((got = read(input, buffer + length, sizeof(buffer) - length)) > 0){
+        length += got;
+        unsigned int used = decode(buffer, length);
+        memmove(buffer, buffer + used, length - used);
+        length -= used;
+        bool done = kept > 0;
+        for(unsigned int i=0; i<kept; i++){
+            if(!received[i]) done = false;
+        }
+        if(done) break;
+    }
+    close(input);
+    render();
+    return 0;
+}
@@ -0,0 +1,66 @@
+/**
+ * Host simulation of the whole transmitter
+ *
+ * main.cpp is built unchanged against mocked mbed layer in sim/, which runs
+ * it on virtual clock (cost model and peripherals are described in sim/sim.h).
+ * Board goes through measurement, testing and broadcast as it would, audio
+ * input comes from recording and console from command script, so that runs
+ * can be repeated exactly. Virtual time runs several times faster than real
+ * time, measurement alone takes about 11 s of it.
+ *
+ * What board sends over serial port goes to stdout (or file), so that it can
+ * be piped into telemetry_decode. DAC output can be written as trace of
+ * timestamped samples (format in sim_start()), from given time on, as it gets
+ * large quickly. Summary with hashes of DAC output and console output goes to
+ * stderr at the end, they stay the same as long as firmware behaves the same,
+ * which is what golden output comparisons are built on.
+ *
+ * Only FREE_RUNNING discipline, PPS and PTP ports are not mocked.
+ *
+ * Build: g++ -std=c++17 -O2 -fno-pie -no-pie -Isim -I.. transmitter_sim.cpp -o transmitter_sim
+ *        (no PIE, so that static buffers have 32-bit addresses for DMA like on board)
+ * Usage: ./transmitter_sim [-s seconds] [-a audio.wav] [-c commands] [-o console] [-d dac.trace] [-f trace from seconds]
+ *        command script has lines of "<ms> <command>", e.g. "12000 telemetry 500"
+ */
+#define exec(op) sim_exec(op)
+#define main transmitter_main
+#include "main.cpp"
+#undef main
+
+#include <unistd.h>
+
+int main(int argc, char **argv){
+    double seconds = 15.0, from = 0.0;
+    const char *audio = 0, *commands = 0, *console = 0, *trace = 0;
+    int option;
+    while((option = getopt(argc, argv, "s:a:c:o:d:f:")) != -1){
+        switch(option){
+            case 's': seconds = atof(optarg); break;
+            case 'a': audio = optarg; break;
+            case 'c': commands = optarg; break;
+            case 'o': console = optarg; break;
+            case 'd': trace = optarg; break;
+            case 'f': from = atof(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-s seconds] [-a audio.wav] [-c commands] [-o console] [-d dac.trace] [-f trace from seconds]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(audio && !wav_read(&sim.audio, audio)){
+        fprintf(stderr, "%s: not 16-bit PCM WAV\n", audio);
+        return 1;
+    }
+    if(commands && !sim_load_commands(commands)){
+        fprintf(stderr, "%s: can't read\n", commands);
+        return 1;
+    }
+    FILE *output = console ? fopen(console, "wb") : stdout;
+    FILE *dac = trace ? fopen(trace, "wb") : 0;
+    if(!output || (trace && !dac)){
+        fprintf(stderr, "can't open output\n");
+        return 1;
+    }
+    sim_start(seconds, output, dac, from);
+    transmitter_main();     /* Never returns, run ends in sim_finish() */
+    return 0;
+}
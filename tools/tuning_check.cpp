@@ -0,0 +1,253 @@
+/**
+ * Fixed point tuning against float reference
+ *
+ * Synthesizes measurements like MEASURING state takes them (carrier period
+ * is straight line in BR LX location, square and sine, plus noise of a few
+ * microseconds) and runs tuning of main.cpp in fixed point (tuning.h) and in
+ * float as it was done before, for every channel at every sample rate.
+ * Tolerances:
+ *   frequency      1/8 Hz (Q28.4 rounding plus float resolution around 1 MHz)
+ *   location       the same one, or one whose error is within 1/8 Hz of it
+ *   periods        the same, or one off where float is within 1/8 Hz of boundary
+ *   cycles         within 1 cycle
+ *   evaluation     channel and location with error within 1/8 Hz of float pick
+ * Prints worst differences and failures, exit status is 1 if there are any.
+ * Then times fixed point and float side by side on host (best of TIMING_REPEATS
+ * calls, nanoseconds): closest location, cache rebuild (location, frequency,
+ * periods and cycles of every channel at one rate) and evaluation. Board
+ * cycles come from benchmark image (`Bench: test=stage` records tune_*).
+ *
+ * Build: g++ -std=c++17 -O2 -I.. tuning_check.cpp -o tuning_check
+ * Usage: ./tuning_check [-v]
+ *        -v prints every mismatch, even within tolerance
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "sled.h"
+#include "channels.h"
+
+#define MEASURE_PERIODS 100000      /* As in main.cpp */
+#define CLOCK 120000000.0
+#define COUNT (MAX_OPCODES - 2)
+#define TOLERANCE 0.125             /* Hz */
+#define SETS 64                     /* Measurement sets per waveform */
+#define TIMING_REPEATS 200          /* Calls per timing, best one counts */
+
+struct stats_t {
+    double frequency;               /* Worst frequency difference in Hz */
+    unsigned int locations;         /* Other location picked, within tolerance */
+    unsigned int periods;           /* Periods one off at boundary */
+    double cycles;                  /* Worst cycles difference */
+    unsigned int evaluations;       /* Other pair picked by evaluation, within tolerance */
+    unsigned int failures;
+};
+
+static bool verbose = false;
+
+/**
+ * Exact error of location in Hz
+ */
+static double error(const unsigned int *measurements, unsigned int i, double frequency){
+    return fabs(MEASURE_PERIODS * 1000000.0 / measurements[i] - frequency);
+}
+
+/**
+ * Evaluation as MEASURING state does it, float
+ */
+static void evaluate_float(const unsigned int *measurements, unsigned int rate, unsigned int *index, unsigned int *channel){
+    float best_diff = 558000.0f;
+    for(unsigned int i=0; i<COUNT; i++){
+        float freq = MEASURE_PERIODS * 1000000.0f / measurements[i];
+        for(unsigned int j=0; j<CHANNELS; j++){
+            float diff = fabsf(freq - (channel_rasters[j] - rates[rate] / 2.0f));
+            if(diff < best_diff){
+                best_diff = diff;
+                *channel = j;
+                *index = i;
+            }
+        }
+    }
+}
+
+/**
+ * Evaluation as MEASURING state does it, fixed point
+ */
+static void evaluate_fixed(const unsigned int *measurements, unsigned int rate, unsigned int *index, unsigned int *channel){
+    tune_t best_diff = TUNE_HZ(558000);
+    for(unsigned int i=0; i<COUNT; i++){
+        tune_t freq = tune_frequency(MEASURE_PERIODS, measurements[i]);
+        for(unsigned int j=0; j<CHANNELS; j++){
+            tune_t carrier = channel_carrier(rate, j);
+            tune_t diff = freq > carrier ? freq - carrier : carrier - freq;
+            if(diff < best_diff){
+                best_diff = diff;
+                *channel = j;
+                *index = i;
+            }
+        }
+    }
+}
+
+static void check(const unsigned int *measurements, stats_t *stats){
+    for(unsigned int i=0; i<COUNT; i++){
+        double exact = MEASURE_PERIODS * 1000000.0 / measurements[i];
+        double fixed = tune_frequency(MEASURE_PERIODS, measurements[i]) / (double)(1 << TUNE_Q);
+        double reference = MEASURE_PERIODS * 1000000.0f / measurements[i];
+        double difference = fabs(fixed - reference);
+        if(difference > stats->frequency) stats->frequency = difference;
+        if(difference > TOLERANCE){
+            printf("frequency: measurement=%u, fixed=%.4f, float=%.4f, exact=%.4f FAIL\n", measurements[i], fixed, reference, exact);
+            stats->failures++;
+        }
+    }
+    for(unsigned int r=0; r<RATES; r++){
+        for(unsigned int c=0; c<CHANNELS; c++){
+            float carrier = channel_rasters[c] - rates[r] / 2.0f;
+            unsigned int fixed = tune_closest(measurements, COUNT, MEASURE_PERIODS, channel_carrier(r, c));
+            unsigned int reference = tune_closest_float(measurements, COUNT, MEASURE_PERIODS, carrier);
+            if(fixed != reference){
+                double difference = error(measurements, fixed, carrier) - error(measurements, reference, carrier);
+                bool fail = difference > TOLERANCE;
+                if(fail) stats->failures++;
+                else stats->locations++;
+                if(fail || verbose) printf("location: rate=%u, channel=%u, fixed=%u, float=%u, worse by %.4f Hz%s\n",
+                    rates[r], channel_rasters[c], fixed, reference, difference, fail ? " FAIL" : "");
+            }
+
+            /* Periods and cycles as retune computes them */
+            float freq = MEASURE_PERIODS * 1000000.0f / measurements[reference];
+            unsigned int periods = (int)(0.5f * freq / rates[r]);
+            tune_t tuned = tune_frequency(MEASURE_PERIODS, measurements[reference]);
+            unsigned int fixed_periods = tune_periods(tuned, rates[r]);
+            if(fixed_periods != periods){
+                double boundary = fabs(0.5 * freq / rates[r] - (periods > fixed_periods ? periods : fixed_periods)) * 2 * rates[r];
+                bool fail = (fixed_periods + 1 != periods && periods + 1 != fixed_periods) || boundary > TOLERANCE;
+                if(fail) stats->failures++;
+                else stats->periods++;
+                if(fail || verbose) printf("periods: rate=%u, measurement=%u, fixed=%u, float=%u, %.4f Hz from boundary%s\n",
+                    rates[r], measurements[reference], fixed_periods, periods, boundary, fail ? " FAIL" : "");
+            }
+            double cycles = fabs((double)tune_cycles((uint32_t)CLOCK, tuned, periods) - (double)(unsigned int)((uint32_t)CLOCK / freq * periods));
+            if(cycles > stats->cycles) stats->cycles = cycles;
+            if(cycles > 1){
+                printf("cycles: measurement=%u, periods=%u, difference=%.0f FAIL\n", measurements[reference], periods, cycles);
+                stats->failures++;
+            }
+        }
+
+        unsigned int fixed_index = 0, fixed_channel = 0, index = 0, channel = 0;
+        evaluate_fixed(measurements, r, &fixed_index, &fixed_channel);
+        evaluate_float(measurements, r, &index, &channel);
+        if(fixed_index != index || fixed_channel != channel){
+            double difference = error(measurements, fixed_index, channel_rasters[fixed_channel] - rates[r] / 2.0)
+                - error(measurements, index, channel_rasters[channel] - rates[r] / 2.0);
+            bool fail = difference > TOLERANCE;
+            if(fail) stats->failures++;
+            else stats->evaluations++;
+            if(fail || verbose) printf("evaluation: rate=%u, fixed=%u@%u, float=%u@%u, worse by %.4f Hz%s\n", rates[r],
+                channel_rasters[fixed_channel], fixed_index, channel_rasters[channel], index, difference, fail ? " FAIL" : "");
+        }
+    }
+}
+
+static uint64_t nanoseconds(){
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static volatile unsigned int sink;  /* Keeps timed results alive */
+
+/**
+ * Cache rebuild of main.cpp at given rate, fixed point
+ */
+static unsigned int rebuild_fixed(const unsigned int *measurements, unsigned int rate){
+    unsigned int sum = 0;
+    for(unsigned int c=0; c<CHANNELS; c++){
+        unsigned int i = tune_closest(measurements, COUNT, MEASURE_PERIODS, channel_carrier(rate, c));
+        tune_t frequency = tune_frequency(MEASURE_PERIODS, measurements[i]);
+        unsigned int periods = tune_periods(frequency, rates[rate]);
+        sum += i + periods + tune_cycles((uint32_t)CLOCK, frequency, periods);
+    }
+    return sum;
+}
+
+/**
+ * The same in float, as it was done before
+ */
+static unsigned int rebuild_float(const unsigned int *measurements, unsigned int rate){
+    unsigned int sum = 0;
+    for(unsigned int c=0; c<CHANNELS; c++){
+        unsigned int i = tune_closest_float(measurements, COUNT, MEASURE_PERIODS, channel_rasters[c] - rates[rate] / 2.0f);
+        float frequency = MEASURE_PERIODS * 1000000.0f / measurements[i];
+        unsigned int periods = (int)(0.5f * frequency / rates[rate]);
+        sum += i + periods + (unsigned int)((uint32_t)CLOCK / frequency * periods);
+    }
+    return sum;
+}
+
+#define TIME(best, call) do { \
+    for(unsigned int repeat=0; repeat<TIMING_REPEATS; repeat++){ \
+        uint64_t begin = nanoseconds(); \
+        sink = (call); \
+        uint64_t took = nanoseconds() - begin; \
+        if(!repeat || took < best) best = took; \
+    } \
+} while(0)
+
+static unsigned int evaluated(const unsigned int *measurements, bool fixed){
+    unsigned int index = 0, channel = 0;
+    if(fixed) evaluate_fixed(measurements, 3, &index, &channel);
+    else evaluate_float(measurements, 3, &index, &channel);
+    return index + channel;
+}
+
+/**
+ * Fixed point against float on host, on one measurement set at 22050 Hz
+ */
+static void timing(const unsigned int *measurements){
+    uint64_t fixed = 0, reference = 0;
+    TIME(fixed, tune_closest(measurements, COUNT, MEASURE_PERIODS, channel_carrier(3, 0)));
+    TIME(reference, tune_closest_float(measurements, COUNT, MEASURE_PERIODS, channel_rasters[0] - rates[3] / 2.0f));
+    printf("timing: closest fixed=%u ns, float=%u ns\n", (unsigned int)fixed, (unsigned int)reference);
+    TIME(fixed, rebuild_fixed(measurements, 3));
+    TIME(reference, rebuild_float(measurements, 3));
+    printf("timing: rebuild of %u channels fixed=%u ns, float=%u ns\n", (unsigned int)CHANNELS, (unsigned int)fixed, (unsigned int)reference);
+    TIME(fixed, evaluated(measurements, true));
+    TIME(reference, evaluated(measurements, false));
+    printf("timing: evaluation fixed=%u ns, float=%u ns\n", (unsigned int)fixed, (unsigned int)reference);
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && !strcmp(argv[1], "-v")) verbose = true;
+    else if(argc > 1){
+        fprintf(stderr, "Usage: %s [-v]\n", argv[0]);
+        return 1;
+    }
+    static const char *names[] = {"square", "sine"};
+    static const double lines[][2] = {{111.06, 2.034}, {216.83, 4.068}};   /* Cycles per period, see timing_model.cpp */
+    stats_t stats = {0, 0, 0, 0, 0, 0};
+    uint32_t seed = 2463534242u;
+    unsigned int timed[COUNT];
+    for(unsigned int w=0; w<2; w++){
+        for(unsigned int s=0; s<SETS; s++){
+            unsigned int measurements[COUNT];
+            for(unsigned int i=0; i<COUNT; i++){
+                seed = seed * 1664525u + 1013904223u;
+                double us = MEASURE_PERIODS * (lines[w][0] + lines[w][1] * i) / CLOCK * 1000000.0;
+                measurements[i] = (unsigned int)(us + (seed >> 29)) + s;
+            }
+            check(measurements, &stats);
+            if(!w && !s) memcpy(timed, measurements, sizeof(timed));
+        }
+        printf("%s: sets=%u\n", names[w], SETS);
+    }
+    printf("worst frequency=%.4f Hz, worst cycles=%.0f, other location=%u, periods at boundary=%u, other evaluation=%u (all within %.3f Hz)\n",
+        stats.frequency, stats.cycles, stats.locations, stats.periods, stats.evaluations, TOLERANCE);
+    timing(timed);
+    printf("failures=%u\n", stats.failures);
+    return stats.failures ? 1 : 0;
+}
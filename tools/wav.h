@@ -0,0 +1,91 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ * 16-bit PCM WAV files for host tools
+ */
+
+struct wav_t {
+    int16_t *samples;               /* Interleaved */
+    uint32_t length;                /* Frames */
+    uint32_t rate;
+    uint32_t channels;
+};
+
+inline uint32_t wav_u32(const uint8_t *p){
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/**
+ * Load whole file, false if it isn't 16-bit PCM WAV
+ */
+inline bool wav_read(wav_t *wav, const char *path){
+    FILE *file = fopen(path, "rb");
+    if(!file) return false;
+    uint8_t header[12];
+    bool valid = fread(header, 1, 12, file) == 12 && !memcmp(header, "RIFF", 4) && !memcmp(header + 8, "WAVE", 4);
+    uint16_t format = 0, bits = 0;
+    wav->samples = 0;
+    wav->channels = wav->rate = 0;
+    while(valid){
+        uint8_t chunk[8];
+        if(fread(chunk, 1, 8, file) != 8){
+            valid = false;
+            break;
+        }
+        uint32_t size = wav_u32(chunk + 4);
+        if(!memcmp(chunk, "fmt ", 4)){
+            uint8_t fmt[16];
+            if(size < 16 || fread(fmt, 1, 16, file) != 16){
+                valid = false;
+                break;
+            }
+            format = fmt[0] | fmt[1] << 8;
+            wav->channels = fmt[2] | fmt[3] << 8;
+            wav->rate = wav_u32(fmt + 4);
+            bits = fmt[14] | fmt[15] << 8;
+            fseek(file, size - 16 + (size & 1), SEEK_CUR);
+        } else if(!memcmp(chunk, "data", 4)){
+            if(format != 1 || bits != 16 || !wav->channels || !wav->rate){
+                valid = false;
+                break;
+            }
+            wav->samples = (int16_t*)malloc(size);
+            wav->length = fread(wav->samples, 1, size, file) / 2 / wav->channels;
+            break;
+        } else fseek(file, size + (size & 1), SEEK_CUR);
+    }
+    fclose(file);
+    return valid && wav->samples;
+}
+
+/**
+ * Save mono samples in -1..1, clipped
+ */
+inline bool wav_write(const char *path, const float *samples, uint32_t length, uint32_t rate){
+    FILE *file = fopen(path, "wb");
+    if(!file) return false;
+    uint32_t data = length * 2;
+    uint8_t header[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ', 16, 0, 0, 0,
+        1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 16, 0, 'd', 'a', 't', 'a', 0, 0, 0, 0};
+    uint32_t riff = 36 + data, bytes = rate * 2;
+    memcpy(header + 4, &riff, 4);
+    memcpy(header + 24, &rate, 4);
+    memcpy(header + 28, &bytes, 4);
+    memcpy(header + 40, &data, 4);
+    fwrite(header, 1, sizeof(header), file);
+    for(uint32_t i=0; i<length; i++){
+        float s = samples[i] * 32767.0f;
+        int16_t value = (int16_t)(s > 32767.0f ? 32767 : s < -32767.0f ? -32767 : lrintf(s));
+        fwrite(&value, sizeof(value), 1, file);
+    }
+    return fclose(file) == 0;
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/**
+ * Post-mortem event trace
+ *
+ * Ring of last TRACE_ENTRIES timestamped events. Platform places it into
+ * section that startup code doesn't clear, so after warm reset (watchdog,
+ * fault, reset button) events leading to it are still there. trace_init()
+ * recognizes surviving trace by its magic and only starts new boot, anything
+ * else (power on) starts empty trace.
+ *
+ * Logging claims entry with atomic increment and fills it in, there are no
+ * locks or branches, so it can be called from anywhere, interrupts included,
+ * and stay enabled all the time. Entry being filled when reset hits may be torn.
+ *
+ * Platform provides TRACE_NOW() before including this file, time in
+ * microseconds since boot.
+ *
+ * Trace is sent out as telemetry frames (TELEMETRY_TRACE), payload is:
+ *
+ *   offset  size  content
+ *   0       2     index of first entry in this frame, 0 is the oldest one kept
+ *   2       2     entries kept
+ *   4       4     boots since trace was started
+ *   8       12*n  entries: time (4), event (2), boot (2), value (4)
+ */
+
+#define TRACE_ENTRIES 256           /* Ring size, power of two */
+#define TRACE_MAGIC 0x54524345      /* "TRCE" */
+#define TRACE_FRAME_ENTRIES 4       /* Entries per telemetry frame */
+#define TRACE_HEADER 8
+#define TRACE_ENTRY 12
+
+#define TRACE_BOOT 1                /* Value is reset cause, RCM SRS1 << 8 | SRS0 */
+#define TRACE_STATE 2               /* Value is new state */
+#define TRACE_RETUNE 3              /* Value is new channel frequency in Hz */
+#define TRACE_UNDERRUN 4            /* Carrier started repeating samples, value is drift in samples/s */
+#define TRACE_OVERRUN 5             /* Carrier started dropping samples, value is drift in samples/s */
+#define TRACE_CLIP 6                /* End of clipping burst, value is its length in samples */
+#define TRACE_TRIM 7                /* Oscillator correction changed, value is oscillator error in ppb */
+#define TRACE_PROFILE 8             /* Headroom switched profile, value is 1 for light, 0 for full */
+#define TRACE_EVENTS 9
+
+struct trace_entry_t {
+    uint32_t time;                  /* Microseconds since boot */
+    uint16_t event;                 /* One of TRACE_* */
+    uint16_t boot;                  /* Boot entry was logged in */
+    int32_t value;
+};
+
+struct trace_t {
+    uint32_t magic;
+    uint32_t boots;                 /* Warm resets survived */
+    uint32_t head;                  /* Entries ever logged, next one goes to head % TRACE_ENTRIES */
+    trace_entry_t entries[TRACE_ENTRIES];
+};
+
+/**
+ * Log event
+ */
+inline void trace_log(trace_t *trace, uint16_t event, int32_t value){
+    uint32_t i = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+    trace_entry_t *entry = &trace->entries[i & (TRACE_ENTRIES - 1)];
+    entry->time = TRACE_NOW();
+    entry->event = event;
+    entry->boot = trace->boots;
+    entry->value = value;
+}
+
+/**
+ * Pick up trace that survived reset or start new one, `cause` is logged as TRACE_BOOT
+ */
+inline void trace_init(trace_t *trace, uint32_t cause){
+    if(trace->magic == TRACE_MAGIC){
+        trace->boots++;
+    } else {
+        trace->boots = 0;
+        trace->head = 0;
+        for(unsigned int i=0; i<TRACE_ENTRIES; i++){
+            trace->entries[i].event = 0;
+        }
+        trace->magic = TRACE_MAGIC;
+    }
+    trace_log(trace, TRACE_BOOT, cause);
+}
+
+/**
+ * Entries kept, oldest is at index head - trace_kept()
+ */
+inline unsigned int trace_kept(const trace_t *trace){
+    return trace->head < TRACE_ENTRIES ? trace->head : TRACE_ENTRIES;
+}
+
+/**
+ * Encode up to TRACE_FRAME_ENTRIES of `kept` entries into payload, returns its length
+ * `from` is where the oldest one was when sending started, `first` counts from there
+ */
+inline unsigned int trace_encode(const trace_t *trace, uint32_t from, unsigned int first, unsigned int kept, uint8_t *payload){
+    unsigned int count = kept - first < TRACE_FRAME_ENTRIES ? kept - first : TRACE_FRAME_ENTRIES;
+    payload[0] = first;
+    payload[1] = first >> 8;
+    payload[2] = kept;
+    payload[3] = kept >> 8;
+    for(unsigned int i=0; i<4; i++){
+        payload[4 + i] = trace->boots >> (8 * i);
+    }
+    for(unsigned int j=0; j<count; j++){
+        const trace_entry_t *entry = &trace->entries[(from + first + j) & (TRACE_ENTRIES - 1)];
+        uint8_t *p = payload + TRACE_HEADER + j * TRACE_ENTRY;
+        for(unsigned int i=0; i<4; i++){
+            p[i] = entry->time >> (8 * i);
+            p[8 + i] = (uint32_t)entry->value >> (8 * i);
+        }
+        p[4] = entry->event;
+        p[5] = entry->event >> 8;
+        p[6] = entry->boot;
+        p[7] = entry->boot >> 8;
+    }
+    return TRACE_HEADER + count * TRACE_ENTRY;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <stdint.h>
+#include <math.h>
+
+/**
+ * Fixed point tuning
+ *
+ * Frequencies are unsigned Q28.4 Hz (1/16 Hz): carriers of channels at 11025 Hz
+ * sit half Hz off whole numbers, everything up to 268 MHz fits. Measurements
+ * are microseconds that given amount of periods took.
+ *
+ * Closest BR LX location is picked by cross multiplication, without division
+ * per candidate: error of location i is |P - f * m_i| / m_i with P being
+ * periods in microseconds, so a is better than b when
+ * |P - f * m_a| * m_b < |P - f * m_b| * m_a. With carriers below 2 MHz and
+ * measurements below 2^19 us (100000 periods of anything above 191 kHz)
+ * products stay under 2^63. Other conversions take one integer division each.
+ *
+ * Float versions (tune_*_float) are what main.cpp used before and stay as
+ * reference for tools/tuning_check.cpp and benchmark image.
+ */
+
+#define TUNE_Q 4                            /* Fraction bits */
+#define TUNE_HZ(hz) ((uint32_t)(hz) << TUNE_Q)
+
+typedef uint32_t tune_t;                    /* Frequency, Q28.4 Hz */
+
+/**
+ * Whole Hz, truncated as (int) of float would be
+ */
+inline int tune_hz(tune_t frequency){
+    return (int)(frequency >> TUNE_Q);
+}
+
+/**
+ * Difference a - b in whole Hz, truncated toward zero
+ */
+inline int tune_delta(tune_t a, tune_t b){
+    return (int32_t)(a - b) / (1 << TUNE_Q);
+}
+
+/**
+ * Frequency of `periods` periods taking `us` microseconds, rounded to nearest
+ */
+inline tune_t tune_frequency(uint32_t periods, uint32_t us){
+    return (tune_t)((((uint64_t)periods * 1000000u << TUNE_Q) + us / 2) / us);
+}
+
+/**
+ * Periods per burst, truncated: every audio sample is sent as two carrier
+ * bursts (BURSTS in main.cpp), so a burst gets half of sample's periods
+ */
+inline unsigned int tune_periods(tune_t frequency, unsigned int sample_rate){
+    return frequency / (sample_rate << (TUNE_Q + 1));
+}
+
+/**
+ * Core cycles `periods` periods of given frequency take
+ */
+inline unsigned int tune_cycles(uint32_t clock, tune_t frequency, unsigned int periods){
+    return (unsigned int)(((uint64_t)clock * periods << TUNE_Q) / frequency);
+}
+
+/**
+ * BR LX location whose measurement of `periods` periods is closest to given frequency
+ */
+inline unsigned int tune_closest(const unsigned int *measurements, unsigned int count, uint32_t periods, tune_t frequency){
+    const uint64_t total = (uint64_t)periods * 1000000u << TUNE_Q;
+    unsigned int best = 0;
+    uint64_t best_error = 0, best_us = 1;
+    for(unsigned int i=0; i<count; i++){
+        uint64_t product = (uint64_t)frequency * measurements[i];
+        uint64_t error = product > total ? product - total : total - product;
+        if(!i || error * best_us < best_error * measurements[i]){
+            best_error = error;
+            best_us = measurements[i];
+            best = i;
+        }
+    }
+    return best;
+}
+
+/**
+ * Float reference of tune_closest(), with frequency in Hz
+ */
+inline unsigned int tune_closest_float(const unsigned int *measurements, unsigned int count, uint32_t periods, float frequency){
+    unsigned int best = 0;
+    float best_diff = frequency;
+    for(unsigned int i=0; i<count; i++){
+        float diff = fabsf(periods * 1000000.0f / measurements[i] - frequency);
+        if(diff < best_diff){
+            best_diff = diff;
+            best = i;
+        }
+    }
+    return best;
+}
+
+#endif